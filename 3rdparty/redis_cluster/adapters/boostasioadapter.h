@@ -11,14 +11,6 @@
 #include "adapter.h"  // for Adapter
 #include "hiredis-boostasio-adapter/boostasio.hpp"  // for redisBoostClient
 
-namespace boost
-{
-    namespace asio
-    {
-        class io_service;
-    }
-}  // namespace boost
-
 namespace RedisCluster
 {
     // Wrap boost asio adapter.
@@ -0,0 +1,43 @@
+#include <stdlib.h>
+
+#include <atomic>
+#include <new>
+
+#include "allocation_counter.h"
+
+namespace {
+  std::atomic<int64_t> num_allocations(0);
+}
+
+int64_t AllocationCounter::count() {
+  return num_allocations.load(std::memory_order_relaxed);
+}
+
+void* operator new(size_t size) {
+  num_allocations.fetch_add(1, std::memory_order_relaxed);
+  void* retval = malloc(size > 0 ? size : 1);
+  if (retval == nullptr) {
+    throw std::bad_alloc();
+  }
+  return retval;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+  free(ptr);
+}
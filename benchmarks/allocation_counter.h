@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+
+// operator new of the benchmarks binary is replaced by the counting one, so benchmarks can check
+// how many allocations the code under test makes; blocks of AlignedMemoryPool are allocated
+// by posix_memalign, they are counted by the pool (AlignedMemoryPool::num_allocations)
+class AllocationCounter {
+ public:
+  AllocationCounter() = delete;
+
+  // calls of operator new of all threads since the start of the process
+  static int64_t count();
+};
@@ -0,0 +1,186 @@
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+#include "benchmark.h"
+
+namespace {
+  const int64_t kMaxIterations = 1000000000;
+
+  std::vector<std::pair<std::string, BenchmarkFunction>>& registered_benchmarks() {
+    static std::vector<std::pair<std::string, BenchmarkFunction>> benchmarks;
+    return benchmarks;
+  }
+
+  double process_cpu_seconds() {
+    timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+  }
+
+  struct BenchmarkResult {
+    std::string name;
+    int64_t iterations;
+    double real_ns;
+    double cpu_ns;
+    double items_per_second;
+    double bytes_per_second;
+    std::vector<std::pair<std::string, double>> counters;
+  };
+
+  BenchmarkResult run_benchmark(const std::string& name, const BenchmarkFunction& function, double min_seconds) {
+    int64_t iterations = 1;
+    while (true) {
+      BenchmarkState state(iterations);
+      function(&state);
+
+      const double seconds = state.real_seconds();
+      if (seconds >= min_seconds || iterations >= kMaxIterations) {
+        BenchmarkResult retval;
+        retval.name = name;
+        retval.iterations = iterations;
+        retval.real_ns = seconds * 1e9 / iterations;
+        retval.cpu_ns = state.cpu_seconds() * 1e9 / iterations;
+        retval.items_per_second = seconds > 0 ? state.items_per_iteration() * iterations / seconds : 0.0;
+        retval.bytes_per_second = seconds > 0 ? state.bytes_per_iteration() * iterations / seconds : 0.0;
+        retval.counters = state.counters();
+        return retval;
+      }
+
+      // aim a bit over min_seconds, but grow at most 10 times per attempt
+      const double multiplier = seconds > 0 ? std::min(10.0, 1.4 * min_seconds / seconds) : 10.0;
+      iterations = std::min(kMaxIterations, std::max(iterations + 1, static_cast<int64_t>(iterations * multiplier)));
+    }
+  }
+
+  void write_json(const std::string& path, const std::vector<BenchmarkResult>& results) {
+    std::ofstream fout(path);
+    if (!fout.is_open()) {
+      throw std::runtime_error("Unable to create file " + path);
+    }
+
+    char date[64];
+    const std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+    fout << "{\n  \"context\": {\n"
+         << "    \"date\": \"" << date << "\",\n"
+         << "    \"num_cpus\": " << sysconf(_SC_NPROCESSORS_ONLN) << ",\n"
+#ifdef NDEBUG
+         << "    \"library_build_type\": \"release\"\n"
+#else
+         << "    \"library_build_type\": \"debug\"\n"
+#endif
+         << "  },\n  \"benchmarks\": [";
+
+    for (size_t i = 0; i < results.size(); ++i) {
+      const BenchmarkResult& result = results[i];
+      fout << (i > 0 ? ",\n" : "\n")
+           << "    {\"name\": \"" << result.name << "\", \"run_type\": \"iteration\", "
+           << "\"iterations\": " << result.iterations << ", "
+           << "\"real_time\": " << result.real_ns << ", \"cpu_time\": " << result.cpu_ns << ", "
+           << "\"time_unit\": \"ns\"";
+      if (result.items_per_second > 0) {
+        fout << ", \"items_per_second\": " << result.items_per_second;
+      }
+      if (result.bytes_per_second > 0) {
+        fout << ", \"bytes_per_second\": " << result.bytes_per_second;
+      }
+      for (const auto& counter : result.counters) {
+        fout << ", \"" << counter.first << "\": " << counter.second;
+      }
+      fout << "}";
+    }
+    fout << "\n  ]\n}\n";
+  }
+}
+
+BenchmarkState::BenchmarkState(int64_t iterations)
+    : iterations_(iterations)
+    , remaining_(iterations)
+    , is_started_(false)
+    , cpu_start_(0.0)
+    , real_seconds_(0.0)
+    , cpu_seconds_(0.0)
+    , items_per_iteration_(0)
+    , bytes_per_iteration_(0) { }
+
+bool BenchmarkState::keep_running() {
+  if (!is_started_) {
+    is_started_ = true;
+    start_clock();
+  }
+
+  if (remaining_ > 0) {
+    --remaining_;
+    return true;
+  }
+
+  stop_clock();
+  return false;
+}
+
+void BenchmarkState::pause_timing() {
+  stop_clock();
+}
+
+void BenchmarkState::resume_timing() {
+  start_clock();
+}
+
+void BenchmarkState::start_clock() {
+  real_start_ = std::chrono::steady_clock::now();
+  cpu_start_ = process_cpu_seconds();
+}
+
+void BenchmarkState::stop_clock() {
+  real_seconds_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - real_start_).count();
+  cpu_seconds_ += process_cpu_seconds() - cpu_start_;
+}
+
+void BenchmarkState::set_counter(const std::string& name, double value) {
+  for (auto& counter : counters_) {
+    if (counter.first == name) {
+      counter.second = value;
+      return;
+    }
+  }
+  counters_.push_back(std::make_pair(name, value));
+}
+
+void Benchmarks::add(const std::string& name, BenchmarkFunction function) {
+  registered_benchmarks().push_back(std::make_pair(name, function));
+}
+
+int Benchmarks::run(const std::string& filter, double min_seconds, const std::string& json_path) {
+  std::vector<BenchmarkResult> results;
+
+  std::printf("%-48s %14s %14s %12s %14s\n", "Benchmark", "Time, ns", "CPU, ns", "Iterations", "Items/s");
+  for (const auto& benchmark : registered_benchmarks()) {
+    if (!filter.empty() && benchmark.first.find(filter) == std::string::npos) {
+      continue;
+    }
+
+    results.push_back(run_benchmark(benchmark.first, benchmark.second, min_seconds));
+    const BenchmarkResult& result = results.back();
+    std::printf("%-48s %14.1f %14.1f %12lld %14.4g", result.name.c_str(), result.real_ns, result.cpu_ns,
+                static_cast<long long>(result.iterations), result.items_per_second);
+    for (const auto& counter : result.counters) {
+      std::printf("  %s=%g", counter.first.c_str(), counter.second);
+    }
+    std::printf("\n");
+    std::fflush(stdout);
+  }
+
+  if (!json_path.empty()) {
+    write_json(json_path, results);
+  }
+  return static_cast<int>(results.size());
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Minimal benchmark harness in the spirit of Google Benchmark: the body is repeated until it
+// takes --min-time seconds, results are printed and written in Google Benchmark JSON format,
+// so the usual tools (e.g. compare.py) can diff two runs.
+class BenchmarkState {
+ public:
+  explicit BenchmarkState(int64_t iterations);
+
+  // the loop of the benchmark: while (state->keep_running()) { ... },
+  // the clock starts with the first call and stops when the loop ends
+  bool keep_running();
+
+  // excludes the preparation of the next iteration from the measured time
+  void pause_timing();
+  void resume_timing();
+
+  // per iteration, they are reported as rates (per second of measured time)
+  void set_items_per_iteration(int64_t items) { items_per_iteration_ = items; }
+  void set_bytes_per_iteration(int64_t bytes) { bytes_per_iteration_ = bytes; }
+
+  // user counters (e.g. allocations per iteration), they are reported as they are
+  void set_counter(const std::string& name, double value);
+
+  int64_t iterations() const { return iterations_; }
+  double real_seconds() const { return real_seconds_; }
+  double cpu_seconds() const { return cpu_seconds_; }
+  int64_t items_per_iteration() const { return items_per_iteration_; }
+  int64_t bytes_per_iteration() const { return bytes_per_iteration_; }
+  const std::vector<std::pair<std::string, double>>& counters() const { return counters_; }
+
+ private:
+  void start_clock();
+  void stop_clock();
+
+  int64_t iterations_;
+  int64_t remaining_;
+  bool is_started_;
+
+  std::chrono::steady_clock::time_point real_start_;
+  double cpu_start_;
+  double real_seconds_;
+  double cpu_seconds_;
+
+  int64_t items_per_iteration_;
+  int64_t bytes_per_iteration_;
+  std::vector<std::pair<std::string, double>> counters_;
+};
+
+typedef std::function<void(BenchmarkState*)> BenchmarkFunction;
+
+class Benchmarks {
+ public:
+  Benchmarks() = delete;
+
+  // names are 'kernel/parameters', e.g. 'blas_sdot/100'
+  static void add(const std::string& name, BenchmarkFunction function);
+
+  // runs benchmarks whose names contain filter (all if it's empty),
+  // json_path may be empty, returns the number of benchmarks that have been run
+  static int run(const std::string& filter, double min_seconds, const std::string& json_path);
+};
+
+// registers benchmarks of a file during static initialization:
+// const BenchmarkRegistrar registrar([]() { Benchmarks::add(...); });
+class BenchmarkRegistrar {
+ public:
+  explicit BenchmarkRegistrar(const std::function<void()>& register_benchmarks) {
+    register_benchmarks();
+  }
+};
+
+// keeps the compiler from removing computations whose results aren't used
+template <typename T>
+inline void do_not_optimize(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
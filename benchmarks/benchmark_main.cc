@@ -0,0 +1,37 @@
+#include <iostream>
+#include <string>
+
+#include <boost/program_options.hpp>
+
+#include "benchmark.h"
+
+namespace po = boost::program_options;
+
+int main(int argc, char* argv[]) {
+  std::string filter;
+  double min_time = 0.5;
+  std::string json_path;
+
+  po::options_description all_options("Options");
+  all_options.add_options()
+    ("help", "Show help")
+    ("filter",   po::value(&filter)->default_value(""),     "Run benchmarks whose names contain the string")  // NOLINT
+    ("min-time", po::value(&min_time)->default_value(0.5),  "Minimal measured time of each benchmark, seconds")  // NOLINT
+    ("json",     po::value(&json_path)->default_value(""),  "Path to results in Google Benchmark JSON format")  // NOLINT
+    ;
+
+  po::variables_map variables_map;
+  store(po::command_line_parser(argc, argv).options(all_options).run(), variables_map);
+  notify(variables_map);
+
+  if (variables_map.count("help") > 0) {
+    std::cerr << all_options;
+    return 0;
+  }
+
+  if (Benchmarks::run(filter, min_time, json_path) == 0) {
+    std::cerr << "No benchmarks match filter '" << filter << "'" << std::endl;
+    return 1;
+  }
+  return 0;
+}
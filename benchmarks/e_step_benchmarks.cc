@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "aligned_memory_pool.h"
+#include "blas.h"
+#include "e_step_kernels.h"
+#include "helpers.h"
+#include "processor_helpers.h"
+#include "redis_phi_matrix.h"
+#include "shm_phi_store.h"
+#include "task_pool.h"
+
+#include "allocation_counter.h"
+#include "benchmark.h"
+#include "synthetic_collection.h"
+
+namespace {
+  const int kNumTokens = 20000;
+  const int kNumDocs = 1000;
+  const int kNumInnerIters = 10;
+
+  std::vector<std::string> topic_names(int num_topics) {
+    std::vector<std::string> retval;
+    for (int topic_id = 0; topic_id < num_topics; ++topic_id) {
+      retval.push_back("topic_" + std::to_string(topic_id));
+    }
+    return retval;
+  }
+
+  // phi matrices in anonymous memory of the process, so only the computation is measured
+  std::shared_ptr<RedisPhiMatrixAdapter> create_phi(const std::string& name,
+                                                    std::shared_ptr<const TokenCollection> vocab,
+                                                    int num_topics)
+  {
+    auto store = std::make_shared<ShmPhiStore>("", vocab->token_size(), num_topics);
+    auto matrix = std::make_shared<RedisPhiMatrix>(ModelName(name), topic_names(num_topics), vocab,
+                                                   PhiMatrixCacheMode::NONE, store);
+    auto retval = std::make_shared<RedisPhiMatrixAdapter>(matrix, nullptr);
+    for (int token_id = 0; token_id < vocab->token_size(); ++token_id) {
+      retval->set(token_id, Helpers::generate_random_vector(num_topics, vocab->token(token_id)));
+    }
+    return retval;
+  }
+
+  // num_threads > 1 splits the batch between threads of a pool
+  void e_step(BenchmarkState* state, int num_topics, int nnz_per_doc, bool update_nwt, int num_threads = 1) {
+    std::shared_ptr<const TokenCollection> vocab = SyntheticCollection::generate_vocab(kNumTokens);
+    auto p_wt = create_phi("pwt", vocab, num_topics);
+    auto n_wt = create_phi("nwt", vocab, num_topics);
+    NwtWriteAdapter nwt_writer(n_wt);
+
+    artm::Batch batch;
+    SyntheticCollection::generate_batch(*vocab, { kNumDocs, nnz_per_doc, 1, 0.0 }, &batch);
+    auto sparse_ndw = ProcessorHelpers::initialize_sparse_ndw(batch);
+    CsrMatrix<float> sparse_nwd;
+    sparse_ndw->TransposeTo(&sparse_nwd);
+    std::vector<int> token_ids;
+    ProcessorHelpers::find_batch_token_ids(batch, *vocab, &token_ids);
+
+    double perplexity_value = 0.0;
+    std::unique_ptr<TaskPool> pool(num_threads > 1 ? new TaskPool(num_threads) : nullptr);
+
+    // buffers are reused and the transposed counters are kept the way executor threads do it,
+    // the first batch grows buffers
+    EStepWorkspace workspace;
+    auto process_batch = [&]() {
+      ProcessorHelpers::infer_theta_and_update_nwt_sparse(batch, *sparse_ndw, &sparse_nwd, token_ids, *p_wt,
+                                                          &workspace.theta, update_nwt ? &nwt_writer : nullptr,
+                                                          kNumInnerIters, &perplexity_value, &workspace, pool.get());
+    };
+    ProcessorHelpers::initialize_theta(num_topics, batch, &workspace.theta);
+    process_batch();
+
+    const int64_t allocations = AllocationCounter::count() + AlignedMemoryPool::num_allocations();
+    state->set_items_per_iteration(sparse_ndw->nnz());
+    while (state->keep_running()) {
+      state->pause_timing();
+      ProcessorHelpers::initialize_theta(num_topics, batch, &workspace.theta);
+      state->resume_timing();
+
+      process_batch();
+    }
+    do_not_optimize(perplexity_value);
+
+    const int64_t new_allocations = AllocationCounter::count() + AlignedMemoryPool::num_allocations() - allocations;
+    state->set_counter("allocations", static_cast<double>(new_allocations) / state->iterations());
+  }
+
+  // inner iterations of one document of nnz_per_doc tokens, without the reading of phi rows
+  void infer_theta_kernel(BenchmarkState* state, const EStepKernels& kernels, int num_topics, int nnz_per_doc) {
+    const int padded_topics = EStepKernels::padded_size(num_topics);
+    std::vector<float> phi(nnz_per_doc * padded_topics, 0.0f);
+    for (int i = 0; i < nnz_per_doc; ++i) {
+      const auto row = Helpers::generate_random_vector(num_topics, static_cast<size_t>(i));
+      std::copy(row.begin(), row.end(), phi.begin() + i * padded_topics);
+    }
+    const std::vector<float> n_dw(nnz_per_doc, 1.0f);
+    std::vector<float> theta(padded_topics, 0.0f);
+    std::vector<float> n_td(padded_topics, 0.0f);
+
+    state->set_items_per_iteration(nnz_per_doc * kNumInnerIters);
+    while (state->keep_running()) {
+      std::fill(theta.begin(), theta.begin() + num_topics, 1.0f / num_topics);
+      kernels.infer_theta(num_topics, &phi[0], &n_dw[0], nnz_per_doc, kNumInnerIters, &theta[0], &n_td[0]);
+      do_not_optimize(theta[0]);
+    }
+  }
+
+  const BenchmarkRegistrar registrar([]() {
+    for (int num_topics : { 64, 100, 256, 1000 }) {
+      const std::string parameters = std::to_string(num_topics) + "x20";
+      const EStepKernels kernels = EStepKernels::get(num_topics);
+      if (kernels.is_specialized) {
+        Benchmarks::add("e_step_infer_theta/specialized/" + parameters, [kernels, num_topics](BenchmarkState* state) {
+          infer_theta_kernel(state, kernels, num_topics, 20);
+        });
+      }
+      Benchmarks::add("e_step_infer_theta/generic/" + parameters, [num_topics](BenchmarkState* state) {
+        infer_theta_kernel(state, EStepKernels::generic(), num_topics, 20);
+      });
+    }
+
+    for (int num_topics : { 16, 64, 256 }) {
+      for (int nnz_per_doc : { 20, 200 }) {
+        const std::string parameters = std::to_string(num_topics) + "x" + std::to_string(nnz_per_doc);
+        Benchmarks::add("e_step_theta/" + parameters, [num_topics, nnz_per_doc](BenchmarkState* state) {
+          e_step(state, num_topics, nnz_per_doc, false);
+        });
+        Benchmarks::add("e_step_theta_nwt/" + parameters, [num_topics, nnz_per_doc](BenchmarkState* state) {
+          e_step(state, num_topics, nnz_per_doc, true);
+        });
+      }
+    }
+
+    for (int num_threads : { 2, 4 }) {
+      Benchmarks::add("e_step_theta_nwt/" + std::to_string(num_threads) + "threads/256x200",
+                      [num_threads](BenchmarkState* state) { e_step(state, 256, 200, true, num_threads); });
+    }
+  });
+}
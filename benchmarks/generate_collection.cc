@@ -0,0 +1,71 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include "synthetic_collection.h"
+
+namespace bf = boost::filesystem;
+namespace po = boost::program_options;
+
+// writes <output-dir>/vocab.txt and <output-dir>/batches/*.batch for end-to-end benchmarks
+int main(int argc, char* argv[]) {
+  std::string output_dir;
+  int num_tokens = 0;
+  int num_batches = 0;
+  int docs_per_batch = 0;
+  int nnz_per_doc = 0;
+  double zipf_exponent = 0.0;
+  int seed = 0;
+
+  po::options_description all_options("Options");
+  all_options.add_options()
+    ("help", "Show help")
+    ("output-dir",     po::value(&output_dir)->default_value("synthetic"),  "Directory of the collection")  // NOLINT
+    ("num-tokens",     po::value(&num_tokens)->default_value(100000),       "Size of the vocabulary")  // NOLINT
+    ("num-batches",    po::value(&num_batches)->default_value(16),          "Number of batches")  // NOLINT
+    ("docs-per-batch", po::value(&docs_per_batch)->default_value(1000),     "Number of documents in each batch")  // NOLINT
+    ("nnz-per-doc",    po::value(&nnz_per_doc)->default_value(100),         "Number of unique tokens of each document")  // NOLINT
+    ("zipf-exponent",  po::value(&zipf_exponent)->default_value(1.0),       "Exponent of Zipf distribution of tokens, 0 - uniform")  // NOLINT
+    ("seed",           po::value(&seed)->default_value(1),                  "Seed of the first batch")  // NOLINT
+    ;
+
+  po::variables_map variables_map;
+  store(po::command_line_parser(argc, argv).options(all_options).run(), variables_map);
+  notify(variables_map);
+
+  if (variables_map.count("help") > 0) {
+    std::cerr << all_options;
+    return 0;
+  }
+
+  if (num_tokens <= 0 || num_batches <= 0 || docs_per_batch <= 0 || nnz_per_doc <= 0 || zipf_exponent < 0) {
+    std::cerr << "Sizes of the collection should be positive, zipf_exponent should be non-negative" << std::endl;
+    return 1;
+  }
+
+  const bf::path batches_dir = bf::path(output_dir) / "batches";
+  bf::create_directories(batches_dir);
+
+  auto vocab = SyntheticCollection::generate_vocab(num_tokens);
+  SyntheticCollection::write_vocab(*vocab, (bf::path(output_dir) / "vocab.txt").string());
+
+  for (int batch_index = 0; batch_index < num_batches; ++batch_index) {
+    artm::Batch batch;
+    SyntheticCollection::generate_batch(*vocab, { docs_per_batch, nnz_per_doc, seed + batch_index, zipf_exponent },
+                                        &batch);
+
+    const bf::path path = batches_dir / (std::to_string(batch_index) + ".batch");
+    std::ofstream fout(path.string(), std::ofstream::binary);
+    if (!batch.SerializeToOstream(&fout)) {
+      std::cerr << "Unable to write batch " << path.string() << std::endl;
+      return 1;
+    }
+  }
+
+  std::cout << "Collection with " << num_tokens << " tokens and " << num_batches << " batches has been written into "
+            << output_dir << std::endl;
+  return 0;
+}
@@ -0,0 +1,80 @@
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+
+#include "helpers.h"
+#include "token.h"
+
+#include "benchmark.h"
+#include "synthetic_collection.h"
+
+namespace bf = boost::filesystem;
+
+namespace {
+  void token_id_lookup(BenchmarkState* state, int num_tokens) {
+    std::shared_ptr<TokenCollection> vocab = SyntheticCollection::generate_vocab(num_tokens);
+
+    // keywords are built beforehand, lookups go in a scattered order
+    std::vector<std::string> keywords;
+    for (int i = 0; i < 4096; ++i) {
+      keywords.push_back(SyntheticCollection::keyword((i * 7919) % num_tokens));
+    }
+
+    state->set_items_per_iteration(keywords.size());
+    while (state->keep_running()) {
+      for (const auto& keyword : keywords) {
+        do_not_optimize(vocab->token_id(DefaultClass, keyword));
+      }
+    }
+  }
+
+  void load_batch(BenchmarkState* state, int num_docs, int nnz_per_doc) {
+    std::shared_ptr<TokenCollection> vocab = SyntheticCollection::generate_vocab(100000);
+    artm::Batch batch;
+    SyntheticCollection::generate_batch(*vocab, { num_docs, nnz_per_doc, 1, 0.0 }, &batch);
+
+    const bf::path path = bf::temp_directory_path() / bf::unique_path("benchmark-%%%%-%%%%.batch");
+    {
+      std::ofstream fout(path.string(), std::ofstream::binary);
+      batch.SerializeToOstream(&fout);
+    }
+
+    state->set_bytes_per_iteration(bf::file_size(path));
+    while (state->keep_running()) {
+      artm::Batch loaded_batch;
+      Helpers::load_batch(path.string(), &loaded_batch);
+      do_not_optimize(loaded_batch.item_size());
+    }
+
+    bf::remove(path);
+  }
+
+  void generate_random_vector(BenchmarkState* state, int size) {
+    const Token token(DefaultClass, "token");
+
+    state->set_items_per_iteration(size);
+    while (state->keep_running()) {
+      do_not_optimize(Helpers::generate_random_vector(size, token)[0]);
+    }
+  }
+
+  const BenchmarkRegistrar registrar([]() {
+    for (int num_tokens : { 10000, 1000000 }) {
+      Benchmarks::add("token_id/" + std::to_string(num_tokens),
+                      [num_tokens](BenchmarkState* state) { token_id_lookup(state, num_tokens); });
+    }
+
+    for (int num_docs : { 100, 1000 }) {
+      const int nnz_per_doc = 100;
+      Benchmarks::add("load_batch/" + std::to_string(num_docs) + "x" + std::to_string(nnz_per_doc),
+                      [num_docs, nnz_per_doc](BenchmarkState* state) { load_batch(state, num_docs, nnz_per_doc); });
+    }
+
+    for (int size : { 16, 100, 1000 }) {
+      Benchmarks::add("generate_random_vector/" + std::to_string(size),
+                      [size](BenchmarkState* state) { generate_random_vector(state, size); });
+    }
+  });
+}
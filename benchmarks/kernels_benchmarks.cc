@@ -0,0 +1,167 @@
+#include <vector>
+
+#include "aligned_memory_pool.h"
+#include "blas.h"
+#include "e_step_workspace.h"
+#include "helpers.h"
+#include "processor_helpers.h"
+#include "task_pool.h"
+
+#include "benchmark.h"
+#include "synthetic_collection.h"
+
+namespace {
+  const int kNumTokens = 100000;
+
+  void blas_sdot(BenchmarkState* state, int size) {
+    Blas* blas = Blas::builtin();
+    std::vector<float> x = Helpers::generate_random_vector(size, 1);
+    std::vector<float> y = Helpers::generate_random_vector(size, 2);
+
+    state->set_items_per_iteration(size);
+    while (state->keep_running()) {
+      do_not_optimize(blas->sdot(size, &x[0], 1, &y[0], 1));
+    }
+  }
+
+  void blas_saxpy(BenchmarkState* state, int size) {
+    Blas* blas = Blas::builtin();
+    std::vector<float> x = Helpers::generate_random_vector(size, 1);
+    std::vector<float> y = Helpers::generate_random_vector(size, 2);
+
+    state->set_items_per_iteration(size);
+    while (state->keep_running()) {
+      blas->saxpy(size, 1e-3f, &x[0], 1, &y[0], 1);
+      do_not_optimize(y[0]);
+    }
+  }
+
+  void blas_sgemm(BenchmarkState* state, int size) {
+    Blas* blas = Blas::builtin();
+    std::vector<float> a = Helpers::generate_random_vector(size * size, 1);
+    std::vector<float> b = Helpers::generate_random_vector(size * size, 2);
+    std::vector<float> c(size * size, 0.0f);
+
+    state->set_items_per_iteration(static_cast<int64_t>(size) * size * size);
+    while (state->keep_running()) {
+      blas->sgemm(Blas::RowMajor, Blas::NoTrans, Blas::NoTrans, size, size, size, 1.0f,
+                  &a[0], size, &b[0], size, 0.0f, &c[0], size);
+      do_not_optimize(c[0]);
+    }
+  }
+
+  std::shared_ptr<CsrMatrix<float>> generate_ndw(int num_docs, int nnz_per_doc) {
+    static std::shared_ptr<TokenCollection> vocab = SyntheticCollection::generate_vocab(kNumTokens);
+
+    artm::Batch batch;
+    SyntheticCollection::generate_batch(*vocab, { num_docs, nnz_per_doc, 1, 0.0 }, &batch);
+    return ProcessorHelpers::initialize_sparse_ndw(batch);
+  }
+
+  void blas_scsr2csc(BenchmarkState* state, int num_docs, int nnz_per_doc) {
+    Blas* blas = Blas::builtin();
+    auto n_dw = generate_ndw(num_docs, nnz_per_doc);
+    std::vector<float> csc_val(n_dw->nnz());
+    std::vector<int> csc_row_ind(n_dw->nnz());
+    std::vector<int> csc_col_ptr(n_dw->n() + 1);
+
+    state->set_items_per_iteration(n_dw->nnz());
+    while (state->keep_running()) {
+      blas->scsr2csc(n_dw->m(), n_dw->n(), n_dw->nnz(), n_dw->val(), n_dw->row_ptr(), n_dw->col_ind(),
+                     &csc_val[0], &csc_row_ind[0], &csc_col_ptr[0]);
+      do_not_optimize(csc_col_ptr[0]);
+    }
+  }
+
+  // the copy is made the way the E-step makes it, but only the transpose is measured
+  void csr_transpose(BenchmarkState* state, int num_docs, int nnz_per_doc) {
+    Blas* blas = Blas::builtin();
+    auto n_dw = generate_ndw(num_docs, nnz_per_doc);
+
+    state->set_items_per_iteration(n_dw->nnz());
+    while (state->keep_running()) {
+      state->pause_timing();
+      CsrMatrix<float> n_wd(*n_dw);
+      state->resume_timing();
+
+      n_wd.Transpose(blas);
+      do_not_optimize(n_wd.row_ptr()[0]);
+    }
+  }
+
+  // the transposition of the E-step when the batch isn't cached, the pool of one thread
+  // runs the serial counting sort
+  void csr_transpose_to(BenchmarkState* state, int num_docs, int nnz_per_doc, int num_threads) {
+    auto n_dw = generate_ndw(num_docs, nnz_per_doc);
+    TaskPool pool(num_threads);
+    EStepWorkspace workspace;
+
+    state->set_items_per_iteration(n_dw->nnz());
+    while (state->keep_running()) {
+      ProcessorHelpers::transpose_sparse_ndw(*n_dw, &workspace.n_wd, &workspace, &pool);
+      do_not_optimize(workspace.n_wd.row_ptr()[0]);
+    }
+  }
+
+  // theta of a batch is allocated and initialized per batch, without the pool each matrix
+  // gets fresh memory (large blocks are mmaped, so pages are faulted in again)
+  void theta_matrix(BenchmarkState* state, int num_topics, int num_docs, bool use_pool) {
+    artm::Batch batch;
+    batch.mutable_item()->Reserve(num_docs);
+    for (int item_index = 0; item_index < num_docs; ++item_index) {
+      batch.add_item();
+    }
+
+    state->set_items_per_iteration(static_cast<int64_t>(num_topics) * num_docs);
+    while (state->keep_running()) {
+      if (!use_pool) {
+        AlignedMemoryPool::clear();
+      }
+      auto theta = ProcessorHelpers::initialize_theta(num_topics, batch);
+      do_not_optimize((*theta)(0, 0));
+    }
+  }
+
+  const BenchmarkRegistrar registrar([]() {
+    for (int size : { 16, 100, 1000 }) {
+      Benchmarks::add("blas_sdot/" + std::to_string(size),
+                      [size](BenchmarkState* state) { blas_sdot(state, size); });
+      Benchmarks::add("blas_saxpy/" + std::to_string(size),
+                      [size](BenchmarkState* state) { blas_saxpy(state, size); });
+    }
+
+    for (int size : { 32, 128 }) {
+      Benchmarks::add("blas_sgemm/" + std::to_string(size),
+                      [size](BenchmarkState* state) { blas_sgemm(state, size); });
+    }
+
+    for (int num_docs : { 100, 1000 }) {
+      for (int nnz_per_doc : { 20, 200 }) {
+        const std::string parameters = std::to_string(num_docs) + "x" + std::to_string(nnz_per_doc);
+        Benchmarks::add("blas_scsr2csc/" + parameters, [num_docs, nnz_per_doc](BenchmarkState* state) {
+          blas_scsr2csc(state, num_docs, nnz_per_doc);
+        });
+        Benchmarks::add("csr_transpose/" + parameters, [num_docs, nnz_per_doc](BenchmarkState* state) {
+          csr_transpose(state, num_docs, nnz_per_doc);
+        });
+      }
+    }
+
+    for (int num_threads : { 1, 4 }) {
+      for (int num_docs : { 1000, 10000 }) {
+        const std::string parameters = std::to_string(num_threads) + "/" + std::to_string(num_docs) + "x200";
+        Benchmarks::add("csr_transpose_to/" + parameters, [num_docs, num_threads](BenchmarkState* state) {
+          csr_transpose_to(state, num_docs, 200, num_threads);
+        });
+      }
+    }
+
+    for (int num_topics : { 100, 1000 }) {
+      const std::string parameters = std::to_string(num_topics) + "x1000";
+      Benchmarks::add("theta_matrix/pooled/" + parameters,
+                      [num_topics](BenchmarkState* state) { theta_matrix(state, num_topics, 1000, true); });
+      Benchmarks::add("theta_matrix/unpooled/" + parameters,
+                      [num_topics](BenchmarkState* state) { theta_matrix(state, num_topics, 1000, false); });
+    }
+  });
+}
@@ -0,0 +1,102 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "synthetic_collection.h"
+
+namespace {
+  // draws token ids by the cumulative distribution of their probabilities
+  class ZipfDistribution {
+   public:
+    ZipfDistribution(int size, double exponent) : cdf_(size) {
+      double sum = 0.0;
+      for (int rank = 0; rank < size; ++rank) {
+        sum += 1.0 / std::pow(rank + 1.0, exponent);
+        cdf_[rank] = sum;
+      }
+      for (double& value : cdf_) {
+        value /= sum;
+      }
+    }
+
+    int operator()(std::mt19937* rng) {
+      const double value = uniform_(*rng);
+      const int retval = static_cast<int>(std::lower_bound(cdf_.begin(), cdf_.end(), value) - cdf_.begin());
+      return std::min(retval, static_cast<int>(cdf_.size()) - 1);
+    }
+
+   private:
+    std::vector<double> cdf_;
+    std::uniform_real_distribution<double> uniform_;
+  };
+}
+
+std::string SyntheticCollection::keyword(int token_id) {
+  return "token_" + std::to_string(token_id);
+}
+
+std::shared_ptr<TokenCollection> SyntheticCollection::generate_vocab(int num_tokens) {
+  auto retval = std::make_shared<TokenCollection>();
+  retval->reserve(num_tokens);
+  for (int token_id = 0; token_id < num_tokens; ++token_id) {
+    retval->add_token(Token(DefaultClass, keyword(token_id)));
+  }
+  return retval;
+}
+
+void SyntheticCollection::generate_batch(const TokenCollection& vocab, const SyntheticBatchOptions& options,
+                                         artm::Batch* batch)
+{
+  if (options.nnz_per_doc > vocab.token_size()) {
+    throw std::runtime_error("Synthetic documents can't have more unique tokens than the vocabulary");
+  }
+
+  std::mt19937 rng(options.seed);
+  ZipfDistribution token_distribution(vocab.token_size(), options.zipf_exponent);
+  std::uniform_int_distribution<int> weight_distribution(1, 5);
+
+  batch->Clear();
+  batch->set_id("synthetic-" + std::to_string(options.seed));
+
+  // vocabulary id -> index of the token in the batch
+  std::unordered_map<int, int> batch_index;
+  std::unordered_set<int> doc_tokens;
+  for (int doc_id = 0; doc_id < options.num_docs; ++doc_id) {
+    artm::Item* item = batch->add_item();
+    item->set_id(doc_id);
+
+    doc_tokens.clear();
+    while (static_cast<int>(doc_tokens.size()) < options.nnz_per_doc) {
+      doc_tokens.insert(token_distribution(&rng));
+    }
+
+    std::vector<int> token_ids(doc_tokens.begin(), doc_tokens.end());
+    std::sort(token_ids.begin(), token_ids.end());
+    for (int token_id : token_ids) {
+      auto iter = batch_index.find(token_id);
+      if (iter == batch_index.end()) {
+        iter = batch_index.emplace(token_id, batch->token_size()).first;
+        batch->add_token(vocab.keyword(token_id));
+        batch->add_class_id(vocab.class_id(token_id));
+      }
+
+      item->add_token_id(iter->second);
+      item->add_token_weight(static_cast<float>(weight_distribution(rng)));
+    }
+  }
+}
+
+void SyntheticCollection::write_vocab(const TokenCollection& vocab, const std::string& path) {
+  std::ofstream fout(path);
+  if (!fout.is_open()) {
+    throw std::runtime_error("Unable to create file " + path);
+  }
+
+  for (int token_id = 0; token_id < vocab.token_size(); ++token_id) {
+    fout << vocab.keyword(token_id) << "\n";
+  }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "messages.pb.h"
+
+#include "token.h"
+
+struct SyntheticBatchOptions {
+  int num_docs;
+  // number of unique tokens of each document
+  int nnz_per_doc;
+  int seed;
+  // tokens are drawn with probability ~ 1 / (rank + 1)^zipf_exponent, 0 - uniformly
+  double zipf_exponent;
+};
+
+// 'class SyntheticCollection' generates deterministic vocabularies and batches for benchmarks,
+// tokens are 'token_<id>' of the default class, the id is the rank of the token in Zipf distribution.
+class SyntheticCollection {
+ public:
+  SyntheticCollection() = delete;
+
+  static std::string keyword(int token_id);
+
+  static std::shared_ptr<TokenCollection> generate_vocab(int num_tokens);
+
+  // batch tokens are the tokens of the vocabulary used by documents, weights are in [1, 5]
+  static void generate_batch(const TokenCollection& vocab, const SyntheticBatchOptions& options,
+                             artm::Batch* batch);
+
+  // vocabulary file in the format of VocabLoader (one keyword per line)
+  static void write_vocab(const TokenCollection& vocab, const std::string& path);
+};
@@ -0,0 +1,201 @@
+import argparse
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+import time
+
+# End-to-end throughput benchmark: generates a synthetic collection, starts a local
+# single-node redis cluster, runs master and executors for each caching mode and reports
+# throughput, per-phase times, redis traffic per token and peak RSS. Phase times and redis
+# counters are taken from per-iteration metrics printed by master.
+
+parser = argparse.ArgumentParser()
+parser.add_argument('--build-dir', default='.', help='Build directory with master_main, executor_main and benchmarks/generate_collection')
+parser.add_argument('--work-dir', default='throughput-benchmark')
+parser.add_argument('--redis-server', default='redis-server')
+parser.add_argument('--redis-cli', default='redis-cli')
+parser.add_argument('--redis-port', type=int, default=7100)
+parser.add_argument('--num-executors', type=int, default=2)
+parser.add_argument('--num-threads', type=int, default=2)
+parser.add_argument('--num-topics', type=int, default=64)
+parser.add_argument('--num-iters', type=int, default=3)
+parser.add_argument('--num-inner-iter', type=int, default=10)
+parser.add_argument('--caching-modes', default='none,pwt,nwt,all')
+parser.add_argument('--executor-args', default='', help='Extra arguments of executors, e.g. "--pwt-encoding fp16"')
+parser.add_argument('--num-tokens', type=int, default=100000)
+parser.add_argument('--num-batches', type=int, default=16)
+parser.add_argument('--docs-per-batch', type=int, default=1000)
+parser.add_argument('--nnz-per-doc', type=int, default=100)
+parser.add_argument('--zipf-exponent', type=float, default=1.0)
+parser.add_argument('--json', default='', help='Path to results')
+
+METRIC_PATTERN = re.compile(r'^Iteration: (\d+), (\S+): count= (\S+), total= (\S+), max_thread= (\S+), max= (\S+), p99= (\S+)$')
+SLOTS_PATTERN = re.compile(r'Total number of token slots in collection: (\S+)')
+
+
+def compute_indices(num_parts, size):
+	step = (size + num_parts - 1) // num_parts
+	return [(step * i, min(step * (i + 1), size)) for i in range(num_parts)]
+
+
+def run(cmd, **kwargs):
+	print(' '.join(cmd))
+	return subprocess.check_output(cmd, **kwargs).decode()
+
+
+# the collection is reused by later runs with the same parameters, they're kept in parameters.json
+def generate_collection(args):
+	collection_dir = os.path.join(args.work_dir, 'collection')
+	parameters_path = os.path.join(collection_dir, 'parameters.json')
+	parameters = {'num_tokens': args.num_tokens, 'num_batches': args.num_batches,
+				  'docs_per_batch': args.docs_per_batch, 'nnz_per_doc': args.nnz_per_doc,
+				  'zipf_exponent': args.zipf_exponent}
+	if os.path.exists(parameters_path) and json.load(open(parameters_path)) == parameters:
+		return collection_dir
+
+	if os.path.exists(collection_dir):
+		shutil.rmtree(collection_dir)
+	run([os.path.join(args.build_dir, 'benchmarks', 'generate_collection'), '--output-dir', collection_dir,
+		 '--num-tokens', str(args.num_tokens), '--num-batches', str(args.num_batches),
+		 '--docs-per-batch', str(args.docs_per_batch), '--nnz-per-doc', str(args.nnz_per_doc),
+		 '--zipf-exponent', str(args.zipf_exponent)])
+	json.dump(parameters, open(parameters_path, 'w'))
+	return collection_dir
+
+
+def start_redis(args):
+	redis_dir = os.path.join(args.work_dir, 'redis')
+	if not os.path.exists(redis_dir):
+		os.makedirs(redis_dir)
+	for name in os.listdir(redis_dir):
+		os.remove(os.path.join(redis_dir, name))
+
+	process = subprocess.Popen([args.redis_server, '--port', str(args.redis_port), '--dir', redis_dir,
+								'--cluster-enabled', 'yes', '--cluster-config-file', 'nodes.conf',
+								'--save', '', '--appendonly', 'no'], stdout=open(os.devnull, 'w'))
+	cli = [args.redis_cli, '-p', str(args.redis_port)]
+	for _ in range(100):
+		if subprocess.call(cli + ['PING'], stdout=open(os.devnull, 'w'), stderr=open(os.devnull, 'w')) == 0:
+			break
+		time.sleep(0.1)
+
+	run(cli + ['CLUSTER', 'ADDSLOTS'] + [str(slot) for slot in range(16384)])
+	for _ in range(100):
+		if 'cluster_state:ok' in run(cli + ['CLUSTER', 'INFO']):
+			return process
+		time.sleep(0.1)
+	raise RuntimeError('redis cluster has not started')
+
+
+def run_mode(args, collection_dir, caching_mode):
+	run([args.redis_cli, '-p', str(args.redis_port), 'FLUSHALL'])
+
+	batches_dir = os.path.join(collection_dir, 'batches')
+	vocab_path = os.path.join(collection_dir, 'vocab.txt')
+	num_batches = len(os.listdir(batches_dir))
+	# token ranges follow the vocabulary the collection actually has
+	num_tokens = sum(1 for _ in open(vocab_path))
+	token_indices = compute_indices(args.num_executors, num_tokens)
+	batch_indices = compute_indices(args.num_executors, num_batches)
+
+	executors = []
+	for executor_id in range(args.num_executors):
+		cmd = [os.path.join(args.build_dir, 'executor_main'), '--num-topics', str(args.num_topics),
+			   '--num-inner-iter', str(args.num_inner_iter), '--num-threads', str(args.num_threads),
+			   '--batches-dir-path', batches_dir, '--vocab-path', vocab_path,
+			   '--redis-ip', '127.0.0.1', '--redis-port', str(args.redis_port), '--caching-mode', caching_mode,
+			   '--executor-id', str(executor_id),
+			   '--token-begin-index', str(token_indices[executor_id][0]),
+			   '--token-end-index', str(token_indices[executor_id][1]),
+			   '--batch-begin-index', str(batch_indices[executor_id][0]),
+			   '--batch-end-index', str(batch_indices[executor_id][1])] + args.executor_args.split()
+		executors.append(subprocess.Popen(cmd, cwd=args.work_dir, stdout=open(os.devnull, 'w')))
+
+	output = run([os.path.join(args.build_dir, 'master_main'), '--num-topics', str(args.num_topics),
+				  '--num-outer-iter', str(args.num_iters), '--num-executors', str(args.num_executors),
+				  '--num-executor-threads', str(args.num_threads), '--batches-dir-path', batches_dir,
+				  '--vocab-path', vocab_path, '--redis-ip', '127.0.0.1', '--redis-port', str(args.redis_port)],
+				 cwd=args.work_dir)
+	for executor in executors:
+		executor.wait()
+
+	return summarize(output, caching_mode)
+
+
+def summarize(output, caching_mode):
+	num_slots = None
+	iterations = {}
+	for line in output.splitlines():
+		match = SLOTS_PATTERN.search(line)
+		if match:
+			num_slots = float(match.group(1))
+		match = METRIC_PATTERN.match(line.strip())
+		if match:
+			metric = {'count': float(match.group(3)), 'total': float(match.group(4)),
+					  'max_thread': float(match.group(5)), 'max': float(match.group(6))}
+			iterations.setdefault(int(match.group(1)), {})[match.group(2)] = metric
+
+	if not num_slots or not iterations:
+		raise RuntimeError('master output has no metrics, caching mode ' + caching_mode)
+
+	def mean(values):
+		return sum(values) / len(values)
+
+	seconds_per_iteration = mean([(m['master.e_step_us']['total'] + m['master.m_step_us']['total']) / 1e6
+								  for m in iterations.values()])
+
+	# the slowest thread defines the duration of the phase
+	phases = {}
+	for name in sorted(set(name for m in iterations.values() for name in m)):
+		if name.startswith('executor.') and name.endswith('_us'):
+			phases[name[len('executor.'):-len('_us')]] = mean([m[name]['max_thread'] / 1e6 if name in m else 0.0
+															   for m in iterations.values()])
+
+	# master reports its own redis commands as master.redis.*, they're not counted
+	def redis_total(suffixes):
+		return mean([sum(value['total'] for name, value in m.items()
+						 if name.startswith('redis.') and name.endswith(suffixes)) for m in iterations.values()])
+
+	return {
+		'caching_mode': caching_mode,
+		'token_slots': num_slots,
+		'seconds_per_iteration': seconds_per_iteration,
+		'tokens_per_second': num_slots / seconds_per_iteration,
+		'phase_seconds': phases,
+		'redis_ops_per_token': redis_total(('.ops',)) / num_slots,
+		'redis_bytes_per_token': redis_total(('.bytes_sent', '.bytes_received')) / num_slots,
+		'executor_peak_rss_kb': max(m.get('executor.maxrss_kb', {'max': 0})['max'] for m in iterations.values()),
+	}
+
+
+def main():
+	args = parser.parse_args()
+	if not os.path.exists(args.work_dir):
+		os.makedirs(args.work_dir)
+	args.build_dir = os.path.abspath(args.build_dir)
+
+	collection_dir = os.path.abspath(generate_collection(args))
+	redis = start_redis(args)
+	try:
+		results = [run_mode(args, collection_dir, mode) for mode in args.caching_modes.split(',')]
+	finally:
+		redis.terminate()
+		redis.wait()
+
+	print('{:<8} {:>14} {:>10} {:>12} {:>14} {:>12}  {}'.format(
+		'mode', 'tokens/s', 's/iter', 'ops/token', 'bytes/token', 'rss, KB', 'phases, s'))
+	for result in results:
+		phases = ', '.join('{}={:.2f}'.format(name, value) for name, value in sorted(result['phase_seconds'].items()))
+		print('{:<8} {:>14.0f} {:>10.2f} {:>12.3f} {:>14.1f} {:>12.0f}  {}'.format(
+			result['caching_mode'], result['tokens_per_second'], result['seconds_per_iteration'],
+			result['redis_ops_per_token'], result['redis_bytes_per_token'], result['executor_peak_rss_kb'], phases))
+
+	if args.json:
+		json.dump({'parameters': vars(args), 'results': results}, open(args.json, 'w'), indent=2)
+
+
+if __name__ == '__main__':
+	sys.exit(main())
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// 'class AlignedMemoryPool' keeps blocks released by dense matrices, so matrices of the next batch
+// reuse them instead of going to the allocator and faulting in fresh pages. Each thread has its own
+// pool and no locking is needed. A block released by another thread than the one that has acquired
+// it goes to the pool of the releasing thread. The pool keeps at most kMaxBlocks blocks, the
+// smallest ones are freed first.
+class AlignedMemoryPool {
+ public:
+  AlignedMemoryPool() = delete;
+
+  // cache line, it's also the width of the widest vector registers (AVX-512)
+  static const size_t kAlignment = 64;
+  static const int kMaxBlocks = 16;
+
+  // returns a block of at least size bytes aligned to kAlignment and writes its actual size to
+  // capacity, a pooled block is reused if it's not more than twice larger; throws std::bad_alloc
+  static void* acquire(size_t size, size_t* capacity);
+
+  // capacity is the one returned by acquire
+  static void release(void* ptr, size_t capacity);
+
+  // frees blocks kept by the pool of the calling thread
+  static void clear();
+
+  // total size of blocks kept by the pool of the calling thread
+  static size_t pooled_bytes();
+
+  // blocks allocated by pools of all threads since the start of the process
+  static int64_t num_allocations();
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "boost/asio.hpp"
+#include "boost/thread.hpp"
+#include "boost/utility.hpp"
+
+#include "redis_cluster/asynchirediscommand.h"
+#include "redis_cluster/adapters/boostasioadapter.h"
+
+#include "common.h"
+#include "value_encoding.h"
+
+using namespace RedisCluster;
+
+// 'class AsyncRedisClient' sends commands to redis cluster without waiting for replies, so one
+// connection may have many requests in flight. Replies are processed by the event loop of the
+// client running in its own thread. The cluster object isn't thread-safe, so commands are issued
+// by the loop thread too, and methods of the client may be called from any thread.
+// All futures should be ready before the client is destroyed.
+class AsyncRedisClient : boost::noncopyable {
+ public:
+  // reply is nullptr if the command hasn't been sent, callbacks are called by the loop thread
+  typedef std::function<void(const redisReply* reply)> ReplyCallback;
+
+  AsyncRedisClient(const std::string& ip, int port);
+  ~AsyncRedisClient();
+
+  // args[0] is the name of the command, key is used to find the node of the cluster
+  void command(const std::string& key, const std::vector<std::string>& args, const ReplyCallback& callback);
+
+  // futures of failed commands (and of error replies) hold std::runtime_error,
+  // missing keys are read as empty strings and zero values
+  std::future<std::string> get_raw_value(const std::string& key);
+
+  // bytes [byte_begin, byte_end) of the value, the result is shorter if the value is
+  std::future<std::string> get_raw_range(const std::string& key, int byte_begin, int byte_end);
+
+  std::future<void> set_raw_value(const std::string& key, const std::string& data);
+
+  std::future<std::vector<float>> get_values(const std::string& key, int values_size,
+                                             ValueEncoding encoding = ValueEncoding::FLOAT32);
+
+  std::future<void> set_values(const std::string& key, const std::vector<float>& values,
+                               ValueEncoding encoding = ValueEncoding::FLOAT32);
+
+  // atomic increase of float32 values (the lua script of RedisClient::increase_range_values),
+  // the script is sent with EVAL, so there are no per-node sha caches to keep
+  std::future<bool> increase_values(const std::string& key, const std::vector<float>& increments);
+
+ private:
+  std::future<void> execute(const std::string& key, const std::vector<std::string>& args);
+
+  boost::asio::io_service io_service_;
+  boost::asio::io_service::work work_;
+  BoostAsioAdapter adapter_;
+  Cluster<redisAsyncContext>* cluster_;
+  boost::thread loop_thread_;
+};
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <assert.h>
+#include <string.h>
+#include <algorithm>
 #include <memory>
 #include <vector>
 #include <sstream>
@@ -10,6 +12,8 @@
 
 #include "messages.pb.h"
 
+#include "aligned_memory_pool.h"
+
 typedef void blas_sgemm_type(int order, const int transa, const int transb,
                              const int m, const int n, const int k,
                              const float alpha,
@@ -59,6 +63,10 @@ class Blas {
   Blas() { }  // Singleton (make constructor private)
 };
 
+// Storage of 'class DenseMatrix' is aligned to AlignedMemoryPool::kAlignment bytes and taken from
+// the pool of the thread, rows (columns if the matrix is stored by columns) are padded with zeros
+// up to the alignment, so each of them starts at a cache line. stride() is the distance between
+// starts of rows (columns), get_data() of padded matrix isn't contiguous in terms of no_columns().
 template<typename T>
 class DenseMatrix {
  public:
@@ -66,82 +74,135 @@ class DenseMatrix {
     : no_rows_(no_rows),
     no_columns_(no_columns),
     store_by_rows_(store_by_rows),
+    stride_(padded_size(store_by_rows ? no_columns : no_rows)),
+    capacity_(0),
     data_(nullptr) {
-    if (no_rows > 0 && no_columns > 0) {
-      try {
-        data_ = new T[no_rows_ * no_columns_];
-      } CATCH_BIG_ALLOCATION(no_rows_, no_columns_)
+    allocate();
+    InitializeZeros();
+  }
+
+  DenseMatrix(const DenseMatrix<T>& src_matrix)
+    : no_rows_(src_matrix.no_rows_),
+    no_columns_(src_matrix.no_columns_),
+    store_by_rows_(src_matrix.store_by_rows_),
+    stride_(src_matrix.stride_),
+    capacity_(0),
+    data_(nullptr) {
+    allocate();
+    if (data_ != nullptr) {
+      memcpy(data_, src_matrix.data_, sizeof(T) * storage_size());
     }
   }
 
-  DenseMatrix(const DenseMatrix<T>& src_matrix) {
-    no_rows_ = src_matrix.no_rows();
-    no_columns_ = src_matrix.no_columns();
-    store_by_rows_ = src_matrix.store_by_rows_;
-    if (no_columns_ >0 && no_rows_ > 0) {
-      try {
-        data_ = new T[no_rows_ * no_columns_];
-      } CATCH_BIG_ALLOCATION(no_rows_, no_columns_)
+  DenseMatrix(DenseMatrix<T>&& src_matrix) noexcept
+    : no_rows_(src_matrix.no_rows_),
+    no_columns_(src_matrix.no_columns_),
+    store_by_rows_(src_matrix.store_by_rows_),
+    stride_(src_matrix.stride_),
+    capacity_(src_matrix.capacity_),
+    data_(src_matrix.data_) {
+    src_matrix.reset();
+  }
 
-      for (int i = 0; i < no_rows_ * no_columns_; ++i) {
-        data_[i] = src_matrix.get_data()[i];
-      }
-    } else {
+  virtual ~DenseMatrix() {
+    AlignedMemoryPool::release(data_, capacity_);
+  }
+
+  // the storage is kept if it's large enough, so matrices reused for batches only grow,
+  // values are zeroed
+  void Resize(int no_rows, int no_columns) {
+    const int stride = padded_size(store_by_rows_ ? no_columns : no_rows);
+    const size_t bytes = sizeof(T) * (store_by_rows_ ? no_rows : no_columns) * stride;
+    if (bytes > capacity_) {
+      AlignedMemoryPool::release(data_, capacity_);
       data_ = nullptr;
+      capacity_ = 0;
     }
-  }
 
-  virtual ~DenseMatrix() {
-    delete[] data_;
+    no_rows_ = no_rows;
+    no_columns_ = no_columns;
+    stride_ = stride;
+    if (data_ == nullptr) {
+      allocate();
+    }
+    InitializeZeros();
   }
 
+  // padding is zeroed too
   void InitializeZeros() {
-    memset(data_, 0, sizeof(T)* no_rows_ * no_columns_);
+    if (data_ != nullptr) {
+      memset(data_, 0, sizeof(T) * storage_size());
+    }
   }
 
   T& operator() (int index_row, int index_col) {
     assert(index_row < no_rows_);
     assert(index_col < no_columns_);
     if (store_by_rows_) {
-      return data_[index_row * no_columns_ + index_col];
+      return data_[index_row * stride_ + index_col];
     }
-    return data_[index_col * no_rows_ + index_row];
+    return data_[index_col * stride_ + index_row];
   }
 
   const T& operator() (int index_row, int index_col) const {
     assert(index_row < no_rows_);
     assert(index_col < no_columns_);
     if (store_by_rows_) {
-      return data_[index_row * no_columns_ + index_col];
+      return data_[index_row * stride_ + index_col];
     }
-    return data_[index_col * no_rows_ + index_row];
+    return data_[index_col * stride_ + index_row];
   }
 
   DenseMatrix<T>& operator= (const DenseMatrix<T>& src_matrix) {
-    no_rows_ = src_matrix.no_rows();
-    no_columns_ = src_matrix.no_columns();
-    store_by_rows_ = src_matrix.store_by_rows_;
-    if (data_ != nullptr) {
-      delete[] data_;
+    if (this == &src_matrix) {
+      return *this;
     }
-    if (no_columns_ >0 && no_rows_ > 0) {
-      try {
-        data_ = new  T[no_rows_ * no_columns_];
-      } CATCH_BIG_ALLOCATION(no_rows_, no_columns_);
 
-      for (int i = 0; i < no_rows_ * no_columns_; ++i) {
-        data_[i] = src_matrix.get_data()[i];
-      }
-    } else {
+    // the storage is kept if it's large enough
+    const size_t src_bytes = sizeof(T) * src_matrix.storage_size();
+    if (src_bytes > capacity_) {
+      AlignedMemoryPool::release(data_, capacity_);
       data_ = nullptr;
+      capacity_ = 0;
+    }
+
+    no_rows_ = src_matrix.no_rows_;
+    no_columns_ = src_matrix.no_columns_;
+    store_by_rows_ = src_matrix.store_by_rows_;
+    stride_ = src_matrix.stride_;
+    if (data_ == nullptr) {
+      allocate();
+    }
+    if (src_bytes > 0) {
+      memcpy(data_, src_matrix.data_, src_bytes);
     }
 
     return *this;
   }
 
+  DenseMatrix<T>& operator= (DenseMatrix<T>&& src_matrix) noexcept {
+    if (this == &src_matrix) {
+      return *this;
+    }
+
+    AlignedMemoryPool::release(data_, capacity_);
+    no_rows_ = src_matrix.no_rows_;
+    no_columns_ = src_matrix.no_columns_;
+    store_by_rows_ = src_matrix.store_by_rows_;
+    stride_ = src_matrix.stride_;
+    capacity_ = src_matrix.capacity_;
+    data_ = src_matrix.data_;
+    src_matrix.reset();
+
+    return *this;
+  }
+
   int no_rows() const { return no_rows_; }
   int no_columns() const { return no_columns_; }
   int size() const { return no_rows_ * no_columns_; }
+  int stride() const { return stride_; }
+  // number of elements in the storage including padding
+  int storage_size() const { return (store_by_rows_ ? no_rows_ : no_columns_) * stride_; }
   bool is_equal_size(const DenseMatrix<T>& rhs) const {
     return no_rows_ == rhs.no_rows_ && no_columns_ == rhs.no_columns_;
   }
@@ -154,19 +215,42 @@ class DenseMatrix {
     return data_;
   }
 
+  // size of rows (columns) with the padding
+  static int padded_size(int size) {
+    const int alignment = static_cast<int>(AlignedMemoryPool::kAlignment / sizeof(T));
+    return alignment > 0 ? (size + alignment - 1) / alignment * alignment : size;
+  }
+
  private:
+  void allocate() {
+    if (no_columns_ > 0 && no_rows_ > 0) {
+      try {
+        data_ = static_cast<T*>(AlignedMemoryPool::acquire(sizeof(T) * storage_size(), &capacity_));
+      } CATCH_BIG_ALLOCATION(no_rows_, no_columns_)
+    }
+  }
+
+  void reset() {
+    no_rows_ = 0;
+    no_columns_ = 0;
+    stride_ = 0;
+    capacity_ = 0;
+    data_ = nullptr;
+  }
+
   int no_rows_;
   int no_columns_;
   bool store_by_rows_;
+  int stride_;
+  size_t capacity_;
   T* data_;
 };
 
 template<typename T>
 class LocalThetaMatrix : public DenseMatrix<T> {
  public:
-  explicit LocalThetaMatrix(int num_topics, int num_items)
+  explicit LocalThetaMatrix(int num_topics = 0, int num_items = 0)
       : DenseMatrix<T>(num_topics, num_items, /* store_by_rows = */ false) { }
-  virtual ~LocalThetaMatrix() { }
   int num_topics() const { return this->no_rows(); }
   int num_items() const { return this->no_columns(); }
 };
@@ -174,9 +258,8 @@ class LocalThetaMatrix : public DenseMatrix<T> {
 template<typename T>
 class LocalPhiMatrix : public DenseMatrix<T> {
  public:
-  explicit LocalPhiMatrix(int num_tokens, int num_topics)
+  explicit LocalPhiMatrix(int num_tokens = 0, int num_topics = 0)
       : DenseMatrix<T>(num_tokens, num_topics, /* store_by_rows = */ true) { }
-  virtual ~LocalPhiMatrix() { }
   int num_tokens() const { return this->no_rows(); }
   int num_topics() const { return this->no_columns(); }
 };
@@ -184,6 +267,8 @@ class LocalPhiMatrix : public DenseMatrix<T> {
 template<typename T>
 class CsrMatrix {
  public:
+  CsrMatrix() : m_(0), n_(0), nnz_(0) { }
+
   explicit CsrMatrix(int m, int n, int nnz) : m_(m), n_(n), nnz_(nnz) {
     assert(m > 0 && n > 0 && nnz > 0);
     val_.resize(nnz);
@@ -208,6 +293,44 @@ class CsrMatrix {
     row_ptr_.swap(row_ptr_new_);
   }
 
+  // the transposed matrix is written into result, its storage is reused; the counting sort
+  // keeps elements of each row of result in the order of rows of this matrix
+  void TransposeTo(CsrMatrix<T>* result) const {
+    result->Resize(n_, m_, nnz_);
+
+    std::vector<int>& result_row_ptr = result->row_ptr_;
+    std::fill(result_row_ptr.begin(), result_row_ptr.end(), 0);
+    for (int i = 0; i < nnz_; ++i) {
+      ++result_row_ptr[col_ind_[i] + 1];
+    }
+    for (int j = 0; j < n_; ++j) {
+      result_row_ptr[j + 1] += result_row_ptr[j];
+    }
+
+    // starts of rows of result are used as insertion positions and are restored after
+    for (int i = 0; i < m_; ++i) {
+      for (int k = row_ptr_[i]; k < row_ptr_[i + 1]; ++k) {
+        const int position = result_row_ptr[col_ind_[k]]++;
+        result->col_ind_[position] = i;
+        result->val_[position] = val_[k];
+      }
+    }
+    for (int j = n_; j > 0; --j) {
+      result_row_ptr[j] = result_row_ptr[j - 1];
+    }
+    result_row_ptr[0] = 0;
+  }
+
+  // sizes are changed, the storage is kept if it's large enough, values are undefined
+  void Resize(int m, int n, int nnz) {
+    m_ = m;
+    n_ = n;
+    nnz_ = nnz;
+    val_.resize(nnz);
+    col_ind_.resize(nnz);
+    row_ptr_.resize(m + 1);
+  }
+
   T* val() { return &val_[0]; }
   const T* val() const { return &val_[0]; }
 
@@ -241,7 +364,7 @@ void AssignDenseMatrixByProduct(const DenseMatrix<T>& first_matrix,
   T* result_data = result_matrix->get_data();
   const T* first_data = first_matrix.get_data();
   const T* second_data = second_matrix.get_data();
-  const int size = result_matrix->size();
+  const int size = result_matrix->storage_size();
 
   for (int i = 0; i < size; ++i)
     result_data[i] = first_data[i] * second_data[i];
@@ -258,7 +381,7 @@ void AssignDenseMatrixByDivision(const DenseMatrix<T>& first_matrix,
   T* result_data = result_matrix->get_data();
   const T* first_data = first_matrix.get_data();
   const T* second_data = second_matrix.get_data();
-  const int size = result_matrix->size();
+  const int size = result_matrix->storage_size();
 
   for (int i = 0; i < size; ++i) {
     if (first_data[i] == 0 || second_data[i] == 0)
@@ -25,6 +25,21 @@ const std::string CACHING_MODE_PWT = "pwt";
 const std::string CACHING_MODE_NWT = "nwt";
 const std::string CACHING_MODE_ALL = "all";
 
+const std::string KEY_LAYOUT_TEXT = "text";
+const std::string KEY_LAYOUT_BLOCK = "block";
+const std::string KEY_LAYOUT_SLOT = "slot";
+
+const std::string VALUE_ENCODING_FP32 = "fp32";
+const std::string VALUE_ENCODING_FP16 = "fp16";
+const std::string VALUE_ENCODING_BF16 = "bf16";
+
+const std::string ROW_FORMAT_DENSE = "dense";
+const std::string ROW_FORMAT_ADAPTIVE = "adaptive";
+
+const std::string PHI_STORE_REDIS = "redis";
+const std::string PHI_STORE_SHM = "shm";
+const std::string PHI_STORE_PARTITIONED = "partitioned";
+
 typedef std::unordered_map<std::string, std::vector<double>> Normalizers;
 
 inline std::vector<std::string> generate_command_keys(int executor_id, int num_threads) {
@@ -42,3 +57,16 @@ inline std::vector<std::string> generate_data_keys(int executor_id, int num_thre
   }
   return retval;
 }
+
+// per-iteration metrics of executor threads, see MetricsRegistry::serialize
+inline std::vector<std::string> generate_metrics_keys(int executor_id, int num_threads) {
+  std::vector<std::string> retval;
+  for (int thread_id = 0; thread_id < num_threads; ++thread_id) {
+    retval.push_back(kEscChar + std::string("met-") + std::to_string(executor_id) + "-" + std::to_string(thread_id));
+  }
+  return retval;
+}
+
+inline std::string generate_server_key(int executor_id) {
+  return kEscChar + std::string("srv-") + std::to_string(executor_id);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "aligned_memory_pool.h"
+
+// 'class EStepKernels' keeps loops over topics of E-step. Topic vectors of local phi, theta and n_td
+// of one document are padded with zeros to kTopicPadding floats (a cache line, as rows and columns
+// of DenseMatrix are), so loops over them have no remainder, and sums are accumulated in
+// kTopicPadding lanes, which lets compiler vectorize them without reordering of float operations.
+// Kernels for topic counts of E_STEP_TOPIC_SIZES are compiled (see e_step_kernels.cc and the option
+// of cmake) with the constant number of topics, so their loops are fully unrolled, other counts use
+// the generic kernels.
+class EStepKernels {
+ public:
+  static const int kTopicPadding = static_cast<int>(AlignedMemoryPool::kAlignment / sizeof(float));
+
+  // inner iterations of one document: phi - padded rows of num_tokens tokens of the document,
+  // n_dw - counters of the tokens, theta - padded theta of the document (it's updated),
+  // n_td - padded scratch vector
+  typedef void InferThetaKernel(int num_topics, const float* phi, const float* n_dw, int num_tokens,
+                                int num_inner_iters, float* theta, float* n_td);
+
+  // accumulates n_wd / p_wd * theta_d of documents of one token into n_wt, p_wd = <p_wt, theta_d>,
+  // theta_d is column doc_ids[i] of theta with theta_stride floats between columns, documents with
+  // p_wd < kEps are skipped; returns sum of n_wd * log(p_wd) (perplexity of the token)
+  typedef double UpdateNwtKernel(int num_topics, const float* p_wt, const float* theta, int theta_stride,
+                                 const int* doc_ids, const float* n_wd, int num_docs, float* n_wt);
+
+  static int padded_size(int num_topics) {
+    return (num_topics + kTopicPadding - 1) / kTopicPadding * kTopicPadding;
+  }
+
+  // kernels compiled for num_topics if it's in E_STEP_TOPIC_SIZES, generic ones otherwise
+  static EStepKernels get(int num_topics);
+  static EStepKernels generic();
+
+  InferThetaKernel* infer_theta;
+  UpdateNwtKernel* update_nwt;
+  bool is_specialized;
+};
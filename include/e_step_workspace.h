@@ -0,0 +1,41 @@
+#pragma once
+
+#include <future>
+#include <vector>
+
+#include "boost/utility.hpp"
+
+#include "blas.h"
+
+// 'class EStepWorkspace' keeps buffers of E-step of one batch. An executor thread owns one and
+// passes it to each of its batches, buffers keep their storage between batches and only grow,
+// so E-steps of steady state iterations don't allocate (except of futures of asynchronous reads
+// of phi rows, see RedisPhiMatrixAdapter::has_async_client).
+class EStepWorkspace : boost::noncopyable {
+ public:
+  // buffers of one part of documents and then of tokens of the batch,
+  // parts are processed in parallel when E-step is given a task pool
+  struct Part {
+    // rows of p_wt of the current and of the next document
+    LocalPhiMatrix<float> local_phi[2];
+    std::vector<std::future<void>> pending_rows[2];
+    std::vector<float> n_td;
+
+    std::vector<float> p_wt;
+    std::vector<float> n_wt;
+    double perplexity_value;
+  };
+
+  // counters of the batch by documents and their transposition by tokens
+  CsrMatrix<float> n_dw;
+  CsrMatrix<float> n_wd;
+  LocalThetaMatrix<float> theta;
+
+  // part p has documents (or tokens) [part_bounds[p], part_bounds[p + 1])
+  std::vector<Part> parts;
+  std::vector<int> part_bounds;
+
+  // scratch of the parallel transposition, see ProcessorHelpers::transpose_sparse_ndw
+  std::vector<int> transpose_chunks;
+  std::vector<int> transpose_counts;
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <boost/program_options.hpp>
+
+class TaskPool;
+
+// Parameters of executor threads and of the storage of phi matrices in redis that are common to
+// executor_main and local_main. Each main derives its parameters from this struct and adds its own
+// options and checks: local_main runs all threads on MockRedis, so options of other phi stores,
+// of the async client and of connection pools are executor_main only.
+struct ExecutorParameters {
+  int num_topics;
+  int num_inner_iters;
+  int num_threads;
+  int e_step_threads;
+  std::string batches_dir_path;
+  std::string vocab_path;
+  std::string caching_mode;
+  std::string key_layout;
+  int key_block_size;
+  int rows_per_value;
+  std::string pwt_encoding;
+  std::string pwt_row_format;
+  int nwt_compressed_flush;
+
+  // options write values into this object, so it should outlive parsing
+  void add_options(boost::program_options::options_description* options);
+
+  // "name: value; " for each parameter, for logs
+  std::string to_string() const;
+
+  // throws std::runtime_error if a parameter is invalid
+  void check() const;
+
+  // pool shared by all executor threads for E-steps of batches, nullptr if e_step_threads is 1
+  std::shared_ptr<TaskPool> create_e_step_pool() const;
+};
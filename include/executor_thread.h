@@ -3,6 +3,8 @@
 #include <atomic>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "boost/thread.hpp"
 #include "boost/thread/mutex.hpp"
@@ -11,13 +13,17 @@
 #include "messages.pb.h"
 
 #include "blas.h"
+#include "e_step_workspace.h"
+#include "metrics.h"
 #include "protocol.h"
 #include "redis_phi_matrix.h"
+#include "task_pool.h"
 
 class ExecutorThread : boost::noncopyable {
  public:
   explicit ExecutorThread(const std::string& command_key,
   	                      const std::string& data_key,
+  	                      const std::string& metrics_key,
   	                      std::shared_ptr<RedisClient> redis_client,
   	                      bool continue_fitting,
   	                      const std::string& batches_dir_path,
@@ -27,9 +33,11 @@ class ExecutorThread : boost::noncopyable {
   	                      int batch_end_index,
   	                      int num_inner_iters,
   	                      std::shared_ptr<RedisPhiMatrixAdapter> p_wt,
-  	                      std::shared_ptr<RedisPhiMatrixAdapter> n_wt)
+  	                      std::shared_ptr<RedisPhiMatrixAdapter> n_wt,
+  	                      std::shared_ptr<TaskPool> e_step_pool)
     : command_key_(command_key)
     , data_key_(data_key)
+    , metrics_key_(metrics_key)
     , redis_client_(redis_client)
     , continue_fitting_(continue_fitting)
     , batches_dir_path_(batches_dir_path)
@@ -40,6 +48,7 @@ class ExecutorThread : boost::noncopyable {
     , num_inner_iters_(num_inner_iters)
     , p_wt_(p_wt)
     , n_wt_(n_wt)
+    , e_step_pool_(e_step_pool)
     , is_stopping_(false)
     , thread_()
 {
@@ -66,6 +75,7 @@ bool is_stopping() {
  private:
   std::string command_key_;
   std::string data_key_;
+  std::string metrics_key_;
   std::shared_ptr<RedisClient> redis_client_;
   bool continue_fitting_;
   std::string batches_dir_path_;
@@ -77,9 +87,34 @@ bool is_stopping() {
   std::shared_ptr<RedisPhiMatrixAdapter> p_wt_;
   std::shared_ptr<RedisPhiMatrixAdapter> n_wt_;
 
+  // splits E-step of a batch between threads, it's shared by all executor threads
+  // and is used by one of them at a time (may be nullptr)
+  std::shared_ptr<TaskPool> e_step_pool_;
+
+  // timings of phases and redis commands of this thread, they are published
+  // into metrics_key_ and reset at the end of each normalization
+  MetricsRegistry metrics_;
+
   mutable std::atomic<bool> is_stopping_;
   boost::thread thread_;
 
+  // what is derived from a batch and doesn't change during the whole run: resolved token ids
+  // (strings are hashed only on first iteration) and counters by documents and by tokens
+  // (the transposition isn't repeated on each iteration); they take about as much memory
+  // as the batches themselves
+  struct BatchData {
+    std::vector<int> token_ids;
+    CsrMatrix<float> n_dw;
+    CsrMatrix<float> n_wd;
+  };
+
+  // data of each processed batch by the path of its file, ids of batches from different
+  // collections may coincide
+  std::unordered_map<std::string, std::shared_ptr<BatchData>> batches_;
+
+  // buffers of E-step reused by all batches of the thread
+  EStepWorkspace e_step_workspace_;
+
   void thread_function();
 
   bool check_non_terminated_and_update(const std::string& flag, bool force = false);
@@ -99,5 +134,9 @@ bool is_stopping() {
   // 10) set FINISH_NORMALIZATION flag and return
   bool normalize_nwt();
 
-  void process_e_step(const artm::Batch& batch, Blas* blas, double* perplexity_value);
+  void publish_metrics();
+
+  const BatchData& get_batch_data(const std::string& batch_name, const artm::Batch& batch);
+
+  void process_e_step(const std::string& batch_name, const artm::Batch& batch, double* perplexity_value);
 };
@@ -2,6 +2,7 @@
 
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "boost/filesystem.hpp"
@@ -25,4 +26,7 @@ class Helpers {
 
   static void load_batch(const std::string& full_filename, artm::Batch* batch);
   static long get_peak_memory_kb();
+
+  // splits [begin_index, end_index) into num_parts ranges of equal size (the last one may be shorter)
+  static std::vector<std::pair<int, int>> split_indices(int num_parts, int begin_index, int end_index);
 };
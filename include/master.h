@@ -0,0 +1,53 @@
+#pragma once
+
+#include <signal.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "boost/utility.hpp"
+
+#include "redis_client.h"
+
+// 'class Master' drives executor threads through the protocol of protocol.h: all threads start and
+// load their batches, n_wt is normalized into p_wt, then each iteration is an E-step followed by the
+// normalization. Flags are exchanged via command keys of threads, results via their data keys and
+// per-iteration metrics via their metrics keys. Executors may live in other processes or in this one.
+class Master : boost::noncopyable {
+ public:
+  Master(std::shared_ptr<RedisClient> redis_client,
+         const std::vector<std::string>& command_keys,
+         const std::vector<std::string>& data_keys,
+         const std::vector<std::string>& metrics_keys,
+         int num_topics)
+      : redis_client_(redis_client)
+      , command_keys_(command_keys)
+      , data_keys_(data_keys)
+      , metrics_keys_(metrics_keys)
+      , num_topics_(num_topics) { }
+
+  // runs the fitting, executors are asked to terminate in any case, the exception is thrown if
+  // some of them has terminated, hasn't started in start_timeout microseconds or SIGINT has been caught
+  void fit(int num_outer_iters, bool continue_fitting, int start_timeout);
+
+  // waits for executors to confirm termination
+  void wait_for_termination();
+
+  // it's called by signal handler, the master stops at the next synchronization
+  static void interrupt() { interrupted_ = 1; }
+
+ private:
+  bool check_finished_or_terminated(const std::string& old_flag, const std::string& new_flag, int timeout = -1);
+  bool check_non_terminated_and_update(const std::string& flag);
+  bool normalize_nwt();
+  void print_iteration_metrics(int iteration);
+
+  std::shared_ptr<RedisClient> redis_client_;
+  std::vector<std::string> command_keys_;
+  std::vector<std::string> data_keys_;
+  std::vector<std::string> metrics_keys_;
+  int num_topics_;
+
+  static volatile sig_atomic_t interrupted_;
+};
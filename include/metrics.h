@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "boost/thread/locks.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/utility.hpp"
+
+class Counter : boost::noncopyable {
+ public:
+  Counter() : value_(0) { }
+
+  void add(int64_t value = 1) { value_.fetch_add(value, std::memory_order_relaxed); }
+  int64_t value() const { return value_.load(std::memory_order_relaxed); }
+  void reset() { value_.store(0, std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int64_t> value_;
+};
+
+class Gauge : boost::noncopyable {
+ public:
+  Gauge() : value_(0.0) { }
+
+  void set(double value) { value_.store(value, std::memory_order_relaxed); }
+  double value() const { return value_.load(std::memory_order_relaxed); }
+  void reset() { set(0.0); }
+
+ private:
+  std::atomic<double> value_;
+};
+
+// 'class LatencyHistogram' is a log-linear (HDR-style) histogram of non-negative values:
+// values below kSubBuckets are counted exactly, larger ones fall into kSubBuckets buckets
+// per power of two, so percentiles have relative error below 1 / kSubBuckets.
+class LatencyHistogram : boost::noncopyable {
+ public:
+  static const int kSubBucketBits = 5;
+  static const int kSubBuckets = 1 << kSubBucketBits;
+  static const int kNumBuckets = kSubBuckets + (64 - kSubBucketBits) * kSubBuckets;
+
+  LatencyHistogram();
+
+  void record(int64_t value);
+
+  int64_t count() const { return count_.load(std::memory_order_relaxed); }
+  int64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+  int64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+  // q is in [0, 1], the result is the middle of the bucket holding the q-th value
+  int64_t percentile(double q) const;
+
+  void reset();
+
+ private:
+  static int bucket_index(uint64_t value);
+  static int64_t bucket_value(int index);
+
+  std::atomic<int64_t> buckets_[kNumBuckets];
+  std::atomic<int64_t> count_;
+  std::atomic<int64_t> sum_;
+  std::atomic<int64_t> max_;
+};
+
+// state of one metric, counters have count == sum == value, gauges have count == 1 and sum == max == value
+struct MetricSnapshot {
+  std::string name;
+  int64_t count;
+  double sum;
+  double max;
+  double p50;
+  double p99;
+};
+
+// 'class MetricsRegistry' owns named metrics, references to them stay valid for the lifetime of the
+// registry, so callers may look metrics up once and then update them without locks.
+// Names should not contain whitespaces.
+class MetricsRegistry : boost::noncopyable {
+ public:
+  Counter& counter(const std::string& name);
+  Gauge& gauge(const std::string& name);
+  LatencyHistogram& histogram(const std::string& name);
+
+  // all metrics sorted by name
+  std::vector<MetricSnapshot> snapshot() const;
+  void reset();
+
+  // one line per metric: name count sum max p50 p99
+  static std::string serialize(const std::vector<MetricSnapshot>& metrics);
+  static std::vector<MetricSnapshot> parse(const std::string& data);
+
+  static MetricsRegistry& global();
+
+  // registry of the calling thread, global() unless the thread has set its own (nullptr resets it)
+  static MetricsRegistry& current();
+  static void set_current(MetricsRegistry* registry);
+
+ private:
+  mutable boost::mutex lock_;
+  std::map<std::string, std::unique_ptr<Counter>> counters_;
+  std::map<std::string, std::unique_ptr<Gauge>> gauges_;
+  std::map<std::string, std::unique_ptr<LatencyHistogram>> histograms_;
+};
+
+// records the lifetime of the object into histogram in microseconds
+class ScopedLatency : boost::noncopyable {
+ public:
+  explicit ScopedLatency(LatencyHistogram* histogram)
+      : histogram_(histogram)
+      , start_(std::chrono::steady_clock::now()) { }
+
+  ~ScopedLatency() {
+    auto duration = std::chrono::steady_clock::now() - start_;
+    histogram_->record(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+  }
+
+ private:
+  LatencyHistogram* histogram_;
+  std::chrono::steady_clock::time_point start_;
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdarg>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "boost/thread/mutex.hpp"
+#include "boost/utility.hpp"
+
+#include "redis_cluster/hirediscommand.h"
+
+// 'class MockRedis' is an in-memory stand-in of redis cluster, RedisClient created with it sends
+// commands here instead of the network, so master and executors can run in one process (see local_main).
+// Commands used by RedisClient are implemented: GET, SET, GETSET, GETRANGE, SETRANGE, EXISTS, DEL,
+// HSET, HGET, HKEYS, TIME, SCRIPT LOAD, EVAL, EVALSHA and MULTI/EXEC/DISCARD. Lua isn't interpreted,
+// the scripts of RedisClient (range get_set and increase of float32 values) are recognized by their
+// text and executed natively, other scripts get an error reply.
+//
+// Each command is delayed by latency_us plus transfer time of its payload (arguments and reply) at the
+// given bandwidth, 0 is unlimited. The delay is spent outside of the lock, so concurrent commands
+// overlap like commands of different connections. MULTI state belongs to the calling thread.
+class MockRedis : boost::noncopyable {
+ public:
+  explicit MockRedis(int latency_us = 0, double bandwidth_mb_per_second = 0.0)
+      : latency_us_(latency_us)
+      , bandwidth_mb_per_second_(bandwidth_mb_per_second) { }
+
+  // reply is allocated the same way as hiredis does it, so it should be freed by freeReplyObject
+  redisReply* command(const std::vector<std::string>& argv);
+
+  // splits the format of redisCommand into arguments: words of the format with substituted
+  // '%b' (binary string and its size), '%s' (c string) and '%d' (int) arguments
+  static std::vector<std::string> format_command(const char* format, va_list ap);
+
+ private:
+  typedef std::unordered_map<std::string, std::string> Hash;
+
+  // executes the command, the caller should hold mutex_
+  redisReply* execute(const std::vector<std::string>& argv);
+  redisReply* run_script(const std::string& script, const std::vector<std::string>& keys,
+                         const std::vector<std::string>& args);
+
+  // adds float32 increments (size bytes) to the values stored at byte offset of the string,
+  // missing values are read as zeros
+  void increase_range(const std::string& key, size_t byte_offset, const char* increments, size_t size);
+
+  // the string of the key, a hash of the same key is removed
+  std::string& string_value(const std::string& key);
+
+  int latency_us_;
+  double bandwidth_mb_per_second_;
+
+  boost::mutex mutex_;
+  std::unordered_map<std::string, std::string> strings_;
+  std::unordered_map<std::string, Hash> hashes_;
+
+  // scripts loaded by SCRIPT LOAD, by their digest
+  std::unordered_map<std::string, std::string> scripts_;
+
+  // commands queued after MULTI, by calling thread
+  std::unordered_map<std::thread::id, std::vector<std::vector<std::string>>> transactions_;
+};
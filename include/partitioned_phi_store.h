@@ -0,0 +1,79 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "boost/asio.hpp"
+
+#include "phi_server.h"
+#include "phi_store.h"
+
+// Token range served by the phi server of one executor.
+struct PhiPartition {
+  std::string host;
+  int port;
+  int token_begin_index;
+  int token_end_index;
+};
+
+// 'class PartitionedPhiStore' implements owner-computes parameter server: rows of tokens owned
+// by this executor are kept by the local PhiServer, other rows are requested from servers of
+// their owners over tcp. Redis is used only to find the servers: each executor publishes its
+// partition before connecting to master, partitions of others are read on the first remote
+// access (after the global start, so all of them are published by then).
+class PartitionedPhiStore : public PhiStore {
+ public:
+  PartitionedPhiStore(const ModelName& model_name, int token_size, int topic_size,
+                      std::shared_ptr<PhiServer> local_server);
+  ~PartitionedPhiStore();
+
+  static void publish_partition(std::shared_ptr<RedisClient> redis_client, int executor_id,
+                                const PhiPartition& partition);
+
+  // reads partitions of executors 0, 1, ... until they cover all tokens
+  static std::vector<PhiPartition> discover_partitions(std::shared_ptr<RedisClient> redis_client, int token_size);
+
+  int topic_size() const override { return topic_size_; }
+
+  void read_row(std::shared_ptr<RedisClient> redis_client, int token_id, float* buffer) const override;
+  void read_rows(std::shared_ptr<RedisClient> redis_client, int token_begin_index, int token_end_index,
+                 float* buffer) const override;
+
+  void write_row(std::shared_ptr<RedisClient> redis_client, int token_id,
+                 const std::vector<float>& values) override;
+
+  void exchange_row(std::shared_ptr<RedisClient> redis_client, int token_id,
+                    const std::vector<float>& values, float* old_values) override;
+
+  bool add_to_row(std::shared_ptr<RedisClient> redis_client, int token_id,
+                  const std::vector<float>& increment) override;
+
+ private:
+  // idle connections to the server of one partition, each request takes one for its duration
+  class ConnectionPool;
+
+  bool is_local(int token_id) const {
+    return token_id >= local_server_->token_begin_index() && token_id < local_server_->token_end_index();
+  }
+
+  int local_id(int token_id) const { return token_id - local_server_->token_begin_index(); }
+
+  // index of the partition of the token, partitions are discovered on the first call
+  int partition_of(std::shared_ptr<RedisClient> redis_client, int token_id) const;
+
+  // sends request and reads response of response_size floats, returns false on error status
+  bool request(std::shared_ptr<RedisClient> redis_client, PhiProtocol::Operation operation, int token_id,
+               int num_tokens, const std::vector<float>* row, float* response, size_t response_size) const;
+
+  ModelName model_name_;
+  int token_size_;
+  int topic_size_;
+  std::shared_ptr<PhiServer> local_server_;
+  std::shared_ptr<ShmPhiStore> local_store_;
+
+  mutable std::once_flag discover_flag_;
+  mutable std::vector<PhiPartition> partitions_;
+  mutable std::vector<std::unique_ptr<ConnectionPool>> pools_;
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "boost/asio.hpp"
+#include "boost/thread.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/utility.hpp"
+
+#include "common.h"
+#include "shm_phi_store.h"
+
+// Binary protocol of phi servers. Each request is a header, the model name and, for
+// WRITE_ROW, EXCHANGE_ROW and ADD_ROW, one row of topic_size floats. Each response is
+// a status and, for READ_ROWS and EXCHANGE_ROW, the requested rows. Numbers are sent in
+// host byte order, all nodes of the cluster are expected to have the same architecture.
+class PhiProtocol {
+ public:
+  enum Operation : uint8_t { READ_ROWS = 1, WRITE_ROW = 2, EXCHANGE_ROW = 3, ADD_ROW = 4 };
+  enum Status : uint32_t { OK = 0, ERROR = 1 };
+
+  struct RequestHeader {
+    uint8_t operation;
+    uint8_t model_name_size;
+    uint16_t reserved;
+    uint32_t token_id;
+    uint32_t num_tokens;
+  };
+
+  PhiProtocol() = delete;
+};
+
+// 'class PhiServer' holds the slices of phi matrices owned by this executor (tokens
+// [token_begin_index, token_end_index)) in local memory and serves reads and increments
+// of them to other executors. Each connection is served by its own thread with blocking io,
+// clients keep their connections open, so there are few of them. The destructor closes all
+// connections and waits for their threads.
+class PhiServer : boost::noncopyable {
+ public:
+  // port 0 means any free port, see port()
+  PhiServer(const std::string& host, int port, int token_begin_index, int token_end_index);
+  ~PhiServer();
+
+  // all models should be added before start()
+  void add_model(const ModelName& model_name, int topic_size);
+  std::shared_ptr<ShmPhiStore> local_store(const ModelName& model_name) const;
+
+  void start();
+
+  const std::string& host() const { return host_; }
+  int port() const { return port_; }
+  int token_begin_index() const { return token_begin_index_; }
+  int token_end_index() const { return token_end_index_; }
+
+ private:
+  void accept_loop();
+  void serve(std::shared_ptr<boost::asio::ip::tcp::socket> socket);
+
+  std::string host_;
+  int port_;
+  int token_begin_index_;
+  int token_end_index_;
+  std::unordered_map<ModelName, std::shared_ptr<ShmPhiStore>> stores_;
+
+  boost::asio::io_context io_context_;
+  boost::asio::ip::tcp::acceptor acceptor_;
+  boost::thread accept_thread_;
+
+  // accepted connections and their threads, they are kept until the server is destroyed
+  boost::mutex connections_mutex_;
+  std::vector<std::shared_ptr<boost::asio::ip::tcp::socket>> connections_;
+  boost::thread_group serve_threads_;
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "boost/utility.hpp"
+
+#include "common.h"
+#include "redis_client.h"
+#include "redis_key_layout.h"
+#include "row_codec.h"
+#include "value_encoding.h"
+
+class AsyncRedisClient;
+
+// 'class PhiStore' is the storage of rows of one phi matrix used by RedisPhiMatrix,
+// the matrix itself is responsible for caching and for locking of tokens inside the process.
+// Operations get redis client of the calling thread, backends that don't use redis ignore it.
+class PhiStore : boost::noncopyable {
+ public:
+  virtual ~PhiStore() { }
+
+  virtual int topic_size() const = 0;
+
+  // buffer should have topic_size() values, missing rows are read as zeros
+  virtual void read_row(std::shared_ptr<RedisClient> redis_client, int token_id, float* buffer) const = 0;
+
+  // reads rows of tokens [token_begin_index, token_end_index) into buffer (row by row)
+  virtual void read_rows(std::shared_ptr<RedisClient> redis_client, int token_begin_index, int token_end_index,
+                         float* buffer) const = 0;
+
+  // starts reading of the row, the row is in buffer after get() of the result, so buffer should live
+  // until then; by default the row is read by get() itself with redis_client, async_client may be nullptr
+  virtual std::future<void> read_row_async(std::shared_ptr<RedisClient> redis_client,
+                                           std::shared_ptr<AsyncRedisClient> async_client,
+                                           int token_id, float* buffer) const;
+
+  virtual void write_row(std::shared_ptr<RedisClient> redis_client, int token_id,
+                         const std::vector<float>& values) = 0;
+
+  // atomically replaces the row with values, old_values should have topic_size() values
+  virtual void exchange_row(std::shared_ptr<RedisClient> redis_client, int token_id,
+                            const std::vector<float>& values, float* old_values) = 0;
+
+  virtual bool add_to_row(std::shared_ptr<RedisClient> redis_client, int token_id,
+                          const std::vector<float>& increment) = 0;
+
+  // bulk increase (e.g. flush of write cache), by default rows are increased one by one
+  virtual bool add_to_rows(std::shared_ptr<RedisClient> redis_client, const std::vector<int>& token_ids,
+                           const std::vector<std::shared_ptr<std::vector<float>>>& increments);
+};
+
+// Rows are stored in redis cluster, see RedisKeyLayout, ValueEncoding and RowFormat for the storage formats.
+// Lossy encodings and adaptive rows are allowed only for matrices that are never increased (p_wt);
+// compress_flush allows add_to_rows to send increments as sparse rows in bulk lua calls.
+class RedisPhiStore : public PhiStore {
+ public:
+  // limits of compressed flushes
+  static const size_t kMaxRowsPerFlush = 256;
+  static constexpr double kMaxFlushCompressionRatio = 0.8;
+
+  RedisPhiStore(const ModelName& model_name,
+                int topic_size,
+                const RedisKeyLayout& key_layout = RedisKeyLayout(),
+                ValueEncoding encoding = ValueEncoding::FLOAT32,
+                RowFormat row_format = RowFormat::DENSE,
+                bool compress_flush = false);
+
+  int topic_size() const override { return topic_size_; }
+
+  void read_row(std::shared_ptr<RedisClient> redis_client, int token_id, float* buffer) const override;
+  void read_rows(std::shared_ptr<RedisClient> redis_client, int token_begin_index, int token_end_index,
+                 float* buffer) const override;
+
+  // the data is requested by async_client and decoded by get() of the result
+  std::future<void> read_row_async(std::shared_ptr<RedisClient> redis_client,
+                                   std::shared_ptr<AsyncRedisClient> async_client,
+                                   int token_id, float* buffer) const override;
+
+  void write_row(std::shared_ptr<RedisClient> redis_client, int token_id,
+                 const std::vector<float>& values) override;
+
+  void exchange_row(std::shared_ptr<RedisClient> redis_client, int token_id,
+                    const std::vector<float>& values, float* old_values) override;
+
+  bool add_to_row(std::shared_ptr<RedisClient> redis_client, int token_id,
+                  const std::vector<float>& increment) override;
+
+  bool add_to_rows(std::shared_ptr<RedisClient> redis_client, const std::vector<int>& token_ids,
+                   const std::vector<std::shared_ptr<std::vector<float>>>& increments) override;
+
+ private:
+  std::string to_key(int i) const { return key_layout_.key(i, model_name_); }
+
+  // sends increments of rows placed on one cluster slot in one lua call, returns the size of encoded rows
+  size_t add_to_slot_rows(std::shared_ptr<RedisClient> redis_client, const std::vector<int>& token_ids,
+                          const std::vector<const std::vector<float>*>& increments, bool* is_ok);
+
+  ModelName model_name_;
+  int topic_size_;
+  RedisKeyLayout key_layout_;
+  ValueEncoding encoding_;
+  RowFormat row_format_;
+  bool compress_flush_;
+};
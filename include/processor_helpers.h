@@ -9,6 +9,8 @@
 #include "redis_phi_matrix.h"
 #include "protobuf_helpers.h"
 #include "blas.h"
+#include "e_step_workspace.h"
+#include "task_pool.h"
 
 class NwtWriteAdapter {
  public:
@@ -32,21 +34,53 @@ class NwtWriteAdapter {
 class ProcessorHelpers {
  public:
   static std::shared_ptr<LocalThetaMatrix<float>> initialize_theta(int topic_size, const artm::Batch& batch);
+  // the same, but storage of theta is reused
+  static void initialize_theta(int topic_size, const artm::Batch& batch, LocalThetaMatrix<float>* theta);
 
   static std::shared_ptr<CsrMatrix<float>> initialize_sparse_ndw(const artm::Batch& batch);
+  // the same, but storage of sparse_ndw is reused
+  static void initialize_sparse_ndw(const artm::Batch& batch, CsrMatrix<float>* sparse_ndw);
+
+  // sparse_nwd is sparse_ndw transposed, elements of each token are ordered by documents; if pool
+  // is given and the batch is large enough, rows of sparse_ndw are split into chunks of about the
+  // same number of elements, which are counted and scattered in parallel; scratch is taken from
+  // workspace (its n_wd may be sparse_nwd)
+  static void transpose_sparse_ndw(const CsrMatrix<float>& sparse_ndw,
+                                   CsrMatrix<float>* sparse_nwd,
+                                   EStepWorkspace* workspace,
+                                   TaskPool* pool);
 
   static void find_batch_token_ids(const artm::Batch& batch,
-                                   const RedisPhiMatrixAdapter& phi_matrix,
+                                   const TokenCollection& token_collection,
                                    std::vector<int>* token_id);
 
+  // token_id should be computed by find_batch_token_ids, p_wt and n_wt are
+  // expected to share the same token collection
   static void infer_theta_and_update_nwt_sparse(const artm::Batch& batch,
                                                 const CsrMatrix<float>& sparse_ndw,
+                                                const std::vector<int>& token_id,
                                                 const RedisPhiMatrixAdapter& p_wt,
                                                 LocalThetaMatrix<float>* theta_matrix,
                                                 NwtWriteAdapter* nwt_writer,
-                                                Blas* blas,
                                                 int num_inner_iters,
                                                 double* perplexity_value);
 
+  // the same, but buffers are taken from workspace (see EStepWorkspace), sparse_ndw and
+  // theta_matrix may be its n_dw and theta; sparse_nwd is the transposed sparse_ndw if it's
+  // kept by the caller, otherwise (nullptr) it's made in workspace; if pool is given (may be
+  // nullptr), documents and then tokens are split into parts processed by its threads, so
+  // nwt_writer and p_wt should be thread-safe (adapters are)
+  static void infer_theta_and_update_nwt_sparse(const artm::Batch& batch,
+                                                const CsrMatrix<float>& sparse_ndw,
+                                                const CsrMatrix<float>* sparse_nwd,
+                                                const std::vector<int>& token_id,
+                                                const RedisPhiMatrixAdapter& p_wt,
+                                                LocalThetaMatrix<float>* theta_matrix,
+                                                NwtWriteAdapter* nwt_writer,
+                                                int num_inner_iters,
+                                                double* perplexity_value,
+                                                EStepWorkspace* workspace,
+                                                TaskPool* pool);
+
   ProcessorHelpers() = delete;
 };
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <string>
+
 const std::string START_GLOBAL_START = "0";
 const std::string FINISH_GLOBAL_START = "1";
 
@@ -14,3 +16,16 @@ const std::string FINISH_NORMALIZATION = "7";
 
 const std::string START_TERMINATION = "8";
 const std::string FINISH_TERMINATION = "9";
+
+// name of the flag with static lifetime, e.g. for details of trace spans; nullptr for unknown flags
+inline const char* flag_name(const std::string& flag) {
+  static const char* const kNames[] = {
+    "START_GLOBAL_START", "FINISH_GLOBAL_START", "START_PREPARATION", "FINISH_PREPARATION",
+    "START_ITERATION", "FINISH_ITERATION", "START_NORMALIZATION", "FINISH_NORMALIZATION",
+    "START_TERMINATION", "FINISH_TERMINATION"
+  };
+  if (flag.size() != 1 || flag[0] < '0' || flag[0] > '9') {
+    return nullptr;
+  }
+  return kNames[flag[0] - '0'];
+}
@@ -1,37 +1,107 @@
 #pragma once
 
+#include <memory>
 #include <vector>
 #include <string>
 #include <sstream>
 
+#include "boost/thread/mutex.hpp"
+#include "boost/utility.hpp"
+
 #include "redis_cluster/hirediscommand.h"
 
 #include "common.h"
+#include "redis_connection_pool.h"
+#include "value_encoding.h"
 
 using namespace RedisCluster;
 
-class RedisClient {
+// reply of one command, it's freed when the handle goes out of scope
+struct RedisReplyDeleter {
+  void operator()(redisReply* reply) const {
+    if (reply != nullptr) {
+      freeReplyObject(reply);
+    }
+  }
+};
+
+typedef std::unique_ptr<redisReply, RedisReplyDeleter> RedisReplyPtr;
+
+class MockRedis;
+
+// Each call leases a connection of the pool and keeps its reply in a local handle,
+// so one client may be used by several threads at once.
+class RedisClient : boost::noncopyable {
  public:
+  // client with its own connection
   RedisClient(const std::string& ip, int port, int timeout = kDefaultTimeout)
+      : RedisClient(std::make_shared<RedisConnectionPool>(ip, port, 1), timeout) { }
+
+  // clients of one process share connections of the pool, each command leases one of them
+  explicit RedisClient(std::shared_ptr<RedisConnectionPool> pool, int timeout = kDefaultTimeout)
       : timeout_(timeout)
-      , reply_(nullptr)
-  {
-    context_ = HiredisCommand<>::createCluster(ip.c_str(), port);
-  }
+      , pool_(pool) { }
 
-  ~RedisClient() {
-    delete context_;
-    clean_reply();
-  }
+  // client of in-memory redis, see MockRedis
+  explicit RedisClient(std::shared_ptr<MockRedis> mock, int timeout = kDefaultTimeout)
+      : timeout_(timeout)
+      , mock_(mock) { }
 
-  // both set and get operations are atomic by default
-  void set_values(const std::string& key, const std::vector<float>& values) const;
+  // both set and get operations are atomic by default,
+  // keys are sent as binary strings, so they may contain any bytes,
+  // values are stored in the given encoding and decoded back into floats
+  void set_values(const std::string& key, const std::vector<float>& values,
+                  ValueEncoding encoding = ValueEncoding::FLOAT32) const;
 
   // compiler should return rvalue without coping, see
   // https://stackoverflow.com/questions/44065808/returning-stdvector-with-stdmove
-  std::vector<float> get_values(const std::string& key, int values_size) const;
+  std::vector<float> get_values(const std::string& key, int values_size,
+                                ValueEncoding encoding = ValueEncoding::FLOAT32) const;
+
+  // decodes the value right into values (e.g. a row of local phi), nothing is allocated by the client
+  void get_values(const std::string& key, float* values, int values_size,
+                  ValueEncoding encoding = ValueEncoding::FLOAT32) const;
+
+  std::vector<float> get_set_values(const std::string& key, const std::vector<float>& values,
+                                    ValueEncoding encoding = ValueEncoding::FLOAT32);
+
+  // operations with rows packed into one value (row-block storage), offset is
+  // the index of the first value of the row inside the value, missing data is read as zeros
+  void set_range_values(const std::string& key, int offset, const std::vector<float>& values,
+                        ValueEncoding encoding = ValueEncoding::FLOAT32) const;
+  std::vector<float> get_range_values(const std::string& key, int offset, int values_size,
+                                      ValueEncoding encoding = ValueEncoding::FLOAT32) const;
+  void get_range_values(const std::string& key, int offset, float* values, int values_size,
+                        ValueEncoding encoding = ValueEncoding::FLOAT32) const;
+
+  // get_set and increase of the range are atomic, they are executed as lua scripts on the server,
+  // the increase script sums float32 values, so increments are always sent as FLOAT32
+  std::vector<float> get_set_range_values(const std::string& key, int offset, const std::vector<float>& values,
+                                          ValueEncoding encoding = ValueEncoding::FLOAT32);
+  bool increase_range_values(const std::string& key, int offset, const std::vector<float>& increments) const;
 
-  std::vector<float> get_set_values(const std::string& key, const std::vector<float>& values);
+  // adds increments of several rows in one lua call, all keys should be placed on one cluster slot
+  // (duplicates are allowed); rows are float32 rows encoded by RowCodec, so sparse rows update
+  // only their non-zero values, offsets are indices of the first values of rows inside values
+  bool increase_encoded_rows(const std::vector<std::string>& keys, const std::vector<int>& offsets,
+                             const std::vector<std::string>& rows, int num_values) const;
+
+  // binary values of any format, missing key is read as an empty string
+  void set_raw_value(const std::string& key, const std::string& data) const;
+  std::string get_raw_value(const std::string& key) const;
+
+  // passes bytes of the value (empty for missing key) to decode(const char* data, size_t size)
+  // without copying them, the bytes are valid only during the call
+  template <typename Decoder>
+  void get_raw_value(const std::string& key, Decoder decode) const {
+    auto reply = command(key, "GET %b", key.data(), key.size());
+    if (reply->type == REDIS_REPLY_STRING) {
+      decode(static_cast<const char*>(reply->str), static_cast<size_t>(reply->len));
+    } else {
+      decode(static_cast<const char*>(nullptr), static_cast<size_t>(0));
+    }
+  }
+  std::string get_set_raw_value(const std::string& key, const std::string& data);
 
   void set_value(const std::string& key, const std::string& value) const;
   std::string get_value(const std::string& key) const;
@@ -39,19 +109,59 @@ class RedisClient {
   void set_hashmap(const std::string& key, const Normalizers& hashmap) const;
   Normalizers get_hashmap(const std::string& key, int values_size) const;
 
-  // this operation is atomic, see https://redis.io/topics/transactions
+  // read-modify-write of the value, updates of one key are serialized by the
+  // token locks of RedisPhiMatrix and by the token ranges of executors
   bool increase_values(const std::string& key, const std::vector<float>& increments) const;
 
+  // current time of the node serving route_key in microseconds (TIME command)
+  int64_t get_server_time_us(const std::string& route_key) const;
+
+  // lua scripts of get_set_range_values, increase_range_values and increase_encoded_rows,
+  // increase of the range is shared with AsyncRedisClient, MockRedis recognizes all of them
+  static const std::string& get_set_range_script();
+  static const std::string& increase_range_script();
+  static const std::string& increase_rows_script();
+
  private:
-  void clean_reply() const {
-    if (reply_ != nullptr) {
-      freeReplyObject(reply_);
-      reply_ = nullptr;
+  // sha1 digest of lua script, it's loaded once and shared by all threads using the client
+  class ScriptSha {
+   public:
+    std::string get() const {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      return sha_;
     }
-  }
+
+    void set(const std::string& sha) {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      sha_ = sha;
+    }
+
+   private:
+    mutable boost::mutex mutex_;
+    std::string sha_;
+  };
+
+  // sends one command over a leased connection (or to the mock), the connection is closed if the command fails
+  RedisReplyPtr command(const std::string& key, const char* format, ...) const;
+  RedisReplyPtr command(const std::string& key, int argc, const char** argv, const size_t* argvlen) const;
+
+  // returns sha of the script (empty if SCRIPT LOAD has failed)
+  std::string load_script(const std::string& script, ScriptSha* sha, const std::string& route_key) const;
+
+  // runs script by its sha1 digest, falls back to EVAL if the node hasn't cached the script yet
+  RedisReplyPtr eval_range_script(const std::string& script, ScriptSha* sha, const std::string& key,
+                                  int byte_offset, const char* data, size_t data_size) const;
+
+  // the same for scripts with arbitrary number of keys and arguments
+  RedisReplyPtr eval_script(const std::string& script, ScriptSha* sha, const std::string& route_key,
+                            const std::vector<std::string>& keys, const std::vector<std::string>& args) const;
 
   int timeout_;
 
-  mutable redisReply* reply_;
-  Cluster<redisContext>* context_;
+  mutable ScriptSha get_set_range_sha_;
+  mutable ScriptSha increase_range_sha_;
+  mutable ScriptSha increase_rows_sha_;
+
+  std::shared_ptr<RedisConnectionPool> pool_;
+  std::shared_ptr<MockRedis> mock_;
 };
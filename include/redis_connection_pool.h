@@ -0,0 +1,85 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "boost/thread/condition_variable.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/utility.hpp"
+
+#include "redis_cluster/hirediscommand.h"
+
+using namespace RedisCluster;
+
+// 'class RedisConnectionPool' shares connections to redis cluster between RedisClients of the process.
+// The slot map (CLUSTER SLOTS) is requested once, each connection is a cluster object built from it
+// (one socket per node), and at most max_connections of them exist at once, so every node has at most
+// max_connections sockets from the process. Connections are leased for one command: a connection that
+// has failed is closed and the next lease opens a new one, after MOVED redirections the slot map is
+// requested again and the connections built from the old map are replaced on return.
+class RedisConnectionPool : boost::noncopyable {
+ public:
+  struct Connection {
+    Cluster<redisContext>* cluster;
+    int slots_version;
+  };
+
+  class Lease : boost::noncopyable {
+   public:
+    Lease(RedisConnectionPool* pool, Connection* connection)
+        : pool_(pool)
+        , connection_(connection)
+        , is_broken_(false) { }
+
+    Lease(Lease&& other)
+        : pool_(other.pool_)
+        , connection_(other.connection_)
+        , is_broken_(other.is_broken_)
+    {
+      other.pool_ = nullptr;
+    }
+
+    ~Lease() {
+      if (pool_ != nullptr) {
+        pool_->release(connection_, is_broken_);
+      }
+    }
+
+    Cluster<redisContext>* cluster() const { return connection_->cluster; }
+
+    // the connection will be closed instead of being returned to the pool
+    void set_broken() { is_broken_ = true; }
+
+   private:
+    RedisConnectionPool* pool_;
+    Connection* connection_;
+    bool is_broken_;
+  };
+
+  RedisConnectionPool(const std::string& ip, int port, int max_connections);
+  ~RedisConnectionPool();
+
+  // waits while all max_connections connections are leased
+  Lease lease();
+
+  int max_connections() const { return max_connections_; }
+
+ private:
+  void release(Connection* connection, bool is_broken);
+
+  // requests CLUSTER SLOTS from the seed node, the caller should hold mutex_
+  void refresh_slots();
+
+  std::string ip_;
+  int port_;
+  int max_connections_;
+
+  boost::mutex mutex_;
+  boost::condition_variable released_;
+  std::vector<Connection*> idle_connections_;
+  int num_connections_;
+
+  std::shared_ptr<redisReply> slots_;
+  int slots_version_;
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+// TEXT  - legacy keys "<token_id><model_name>", spread over random cluster slots
+// BLOCK - binary keys, tokens from one block of 'block_size' consecutive ids share the hash tag,
+//         so they are placed on one cluster slot (and one node)
+// SLOT  - binary keys, the token range is mapped monotonically on the slot range, e.g.
+//         tokens [0, N/K) go to slots [0, 16384/K), so contiguous token ranges of executors
+//         are stored on nodes owning contiguous slot ranges (see README, step 4 of part 1)
+enum class RedisKeyMode { TEXT, BLOCK, SLOT };
+
+// Binary keys have the fixed format "{<tag>}<4 bytes of token id><model_name>", for
+// default model names they are short enough to fit into the internal buffer of std::string,
+// so building a key doesn't allocate memory.
+//
+// If rows_per_value > 1, rows of rows_per_value consecutive tokens are packed into one redis
+// value (row-block storage), the key of the token is the key of its value (the id of the
+// value is used instead of the token id) and the row is a sub-range starting at row_offset().
+class RedisKeyLayout {
+ public:
+  static const int kNumSlots = 16384;
+  static const int kBlockTagLength = 6;
+
+  explicit RedisKeyLayout(RedisKeyMode mode = RedisKeyMode::TEXT,
+                          int block_size = 1,
+                          int num_tokens = 0,
+                          int rows_per_value = 1);
+
+  std::string key(int token_id, const ModelName& model_name) const {
+    std::string retval;
+    make_key(token_id, model_name, &retval);
+    return retval;
+  }
+
+  void make_key(int token_id, const ModelName& model_name, std::string* key) const;
+
+  // returns cluster slot of the given token
+  int slot(int token_id) const;
+
+  RedisKeyMode mode() const { return mode_; }
+  int block_size() const { return block_size_; }
+
+  int rows_per_value() const { return rows_per_value_; }
+  bool is_row_block() const { return rows_per_value_ > 1; }
+
+  // index of the token row inside its redis value
+  int row_offset(int token_id) const { return token_id % rows_per_value_; }
+
+  // first token of the redis value that contains given token
+  int value_begin(int token_id) const { return token_id - row_offset(token_id); }
+
+  static RedisKeyMode parse_mode(const std::string& mode);
+
+ private:
+  RedisKeyMode mode_;
+  int block_size_;
+  int num_tokens_;
+  int rows_per_value_;
+
+  // tags_for_slots()[i] is the shortest tag with cluster slot i
+  static const std::vector<std::string>& tags_for_slots();
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <atomic>
+#include <future>
 #include <iterator>
 #include <vector>
 #include <memory>
@@ -13,6 +14,10 @@
 #include "token.h"
 #include "thread_safe_collection_holder.h"
 #include "redis_client.h"
+#include "phi_store.h"
+#include "redis_key_layout.h"
+#include "row_codec.h"
+#include "value_encoding.h"
 
 enum PhiMatrixCacheMode { NONE, READ, WRITE };
 
@@ -32,15 +37,34 @@ class RedisPhiMatrix : boost::noncopyable {
  public:
   static const int kUndefIndex = -1;
 
+  // token collection is immutable and can be shared between several matrices,
+  // so the vocabulary is stored only once per process; rows are kept by the store
   RedisPhiMatrix(const ModelName& model_name,
   	             const std::vector<std::string>& topic_name,
-                 PhiMatrixCacheMode cache_mode = PhiMatrixCacheMode::NONE)
+                 std::shared_ptr<const TokenCollection> token_collection,
+                 PhiMatrixCacheMode cache_mode,
+                 std::shared_ptr<PhiStore> store)
       : model_name_(model_name)
       , topic_name_(topic_name)
-      , token_collection_()
+      , token_collection_(token_collection)
+      , spin_locks_(token_collection->token_size())
       , cache_mode_(cache_mode)
+      , store_(store)
       , cache_() { }
 
+  // matrix stored in redis, see RedisPhiStore for the meaning of storage parameters
+  RedisPhiMatrix(const ModelName& model_name,
+  	             const std::vector<std::string>& topic_name,
+                 std::shared_ptr<const TokenCollection> token_collection,
+                 PhiMatrixCacheMode cache_mode = PhiMatrixCacheMode::NONE,
+                 const RedisKeyLayout& key_layout = RedisKeyLayout(),
+                 ValueEncoding encoding = ValueEncoding::FLOAT32,
+                 RowFormat row_format = RowFormat::DENSE,
+                 bool compress_flush = false)
+      : RedisPhiMatrix(model_name, topic_name, token_collection, cache_mode,
+                       std::make_shared<RedisPhiStore>(model_name, topic_name.size(), key_layout,
+                                                       encoding, row_format, compress_flush)) { }
+
   int token_size() const;
 
   int topic_size() const { return topic_name_.size(); }
@@ -57,22 +81,34 @@ class RedisPhiMatrix : boost::noncopyable {
   ModelName model_name() const { return model_name_; }
 
   const Token token(int token_id) const;
+  const ClassId& class_id(int token_id) const;
   bool has_token(const Token& token) const;
   int token_index(const Token& token) const;
 
+  std::shared_ptr<const TokenCollection> token_collection() const { return token_collection_; }
+
   void set(std::shared_ptr<RedisClient> redis_client, int token_id, const std::vector<float>& buffer);
 
   float get(std::shared_ptr<RedisClient> redis_client, int token_id, int topic_id) const;
   void get(std::shared_ptr<RedisClient> redis_client, int token_id, std::vector<float>* buffer) const;
 
+  // decodes the row right into buffer of topic_size() values (e.g. a row of local phi)
+  void get(std::shared_ptr<RedisClient> redis_client, int token_id, float* buffer) const;
+
+  // the same as above, but the row is ready only after get() of the result (see PhiStore::read_row_async)
+  std::future<void> get_async(std::shared_ptr<RedisClient> redis_client,
+                              std::shared_ptr<AsyncRedisClient> async_client,
+                              int token_id, float* buffer) const;
+
   void get_set(std::shared_ptr<RedisClient> redis_client, int token_id,
                std::vector<float>* buffer, const std::vector<float>& values);
 
-  void increase(std::shared_ptr<RedisClient> redis_client, int token_id, const std::vector<float>& increment);
+  // reads rows of tokens [token_begin_index, token_end_index) into buffer (row by row),
+  // in row-block storage each redis value is requested only once
+  void get_range(std::shared_ptr<RedisClient> redis_client, int token_begin_index, int token_end_index,
+                 std::vector<float>* buffer) const;
 
-  int add_token(std::shared_ptr<RedisClient> redis_client, const Token& token, bool flag);
-  int add_token(std::shared_ptr<RedisClient> redis_client,
-                const Token& token, bool flag, const std::vector<float>& values);
+  void increase(std::shared_ptr<RedisClient> redis_client, int token_id, const std::vector<float>& increment);
 
   void clear_read_cache(std::shared_ptr<RedisClient> redis_client) {
     if (cache_mode_ == PhiMatrixCacheMode::READ) {
@@ -83,8 +119,6 @@ class RedisPhiMatrix : boost::noncopyable {
   void dump_write_cache(std::shared_ptr<RedisClient> redis_client, int token_begin_index, int token_end_index);
 
   ~RedisPhiMatrix() {
-    token_collection_.clear();
-    spin_locks_.clear();
     cache_.clear();
   }
 
@@ -93,30 +127,39 @@ class RedisPhiMatrix : boost::noncopyable {
   }
 
  private:
-  void lock(int token_id) { spin_locks_[token_id]->lock(); }
-  void unlock(int token_id) { spin_locks_[token_id]->unlock(); }
-
-  std::string to_key(int i) const { return std::to_string(i) + model_name_; }
+  void lock(int token_id) { spin_locks_[token_id].lock(); }
+  void unlock(int token_id) { spin_locks_[token_id].unlock(); }
 
   ModelName model_name_;
   std::vector<std::string> topic_name_;
-  TokenCollection token_collection_;
-  std::vector<std::shared_ptr<SpinLock> > spin_locks_;
+  std::shared_ptr<const TokenCollection> token_collection_;
+  std::vector<SpinLock> spin_locks_;
   PhiMatrixCacheMode cache_mode_;
+  std::shared_ptr<PhiStore> store_;
   mutable ThreadSafeCollectionHolder<int, std::vector<float>> cache_;
 };
 
+// Binds the matrix to redis clients. Clients, matrices and stores are thread-safe,
+// so one adapter may be shared by all threads of the process.
 class RedisPhiMatrixAdapter {
  public:
-  RedisPhiMatrixAdapter(std::shared_ptr<RedisPhiMatrix> phi_matrix, std::shared_ptr<RedisClient> redis_client)
+  // async_client is used only by get_async, rows are read synchronously without it
+  RedisPhiMatrixAdapter(std::shared_ptr<RedisPhiMatrix> phi_matrix, std::shared_ptr<RedisClient> redis_client,
+                        std::shared_ptr<AsyncRedisClient> async_client = nullptr)
       : phi_matrix_(phi_matrix)
-      , redis_client_(redis_client) { }
+      , redis_client_(redis_client)
+      , async_client_(async_client) { }
 
   RedisPhiMatrixAdapter(std::shared_ptr<RedisClient> redis_client,
                         const ModelName& model_name,
                         const std::vector<std::string>& topic_name,
-                        PhiMatrixCacheMode cache_mode = PhiMatrixCacheMode::NONE)
-      : phi_matrix_(std::shared_ptr<RedisPhiMatrix>(new RedisPhiMatrix(model_name, topic_name, cache_mode)))
+                        std::shared_ptr<const TokenCollection> token_collection,
+                        PhiMatrixCacheMode cache_mode = PhiMatrixCacheMode::NONE,
+                        const RedisKeyLayout& key_layout = RedisKeyLayout(),
+                        ValueEncoding encoding = ValueEncoding::FLOAT32,
+                        RowFormat row_format = RowFormat::DENSE)
+      : phi_matrix_(std::shared_ptr<RedisPhiMatrix>(
+          new RedisPhiMatrix(model_name, topic_name, token_collection, cache_mode, key_layout, encoding, row_format)))
       , redis_client_(redis_client) { }
 
   int token_size() const { return phi_matrix_->token_size(); }
@@ -133,9 +176,12 @@ class RedisPhiMatrixAdapter {
   ModelName model_name() const { return phi_matrix_->model_name(); }
 
   const Token token(int token_id) const { return phi_matrix_->token(token_id); }
+  const ClassId& class_id(int token_id) const { return phi_matrix_->class_id(token_id); }
   bool has_token(const Token& token) const { return phi_matrix_->has_token(token); }
   int token_index(const Token& token) const { return phi_matrix_->token_index(token); }
 
+  std::shared_ptr<const TokenCollection> token_collection() const { return phi_matrix_->token_collection(); }
+
   void set(int token_id, const std::vector<float>& buffer) {
     phi_matrix_->set(redis_client_, token_id, buffer);
   }
@@ -148,20 +194,28 @@ class RedisPhiMatrixAdapter {
     phi_matrix_->get(redis_client_, token_id, buffer);
   }
 
+  void get(int token_id, float* buffer) const {
+    phi_matrix_->get(redis_client_, token_id, buffer);
+  }
+
+  std::future<void> get_async(int token_id, float* buffer) const {
+    return phi_matrix_->get_async(redis_client_, async_client_, token_id, buffer);
+  }
+
+  // without async client rows of get_async are read by get() of its result,
+  // so callers may read them synchronously and save the futures
+  bool has_async_client() const { return async_client_ != nullptr; }
+
   void get_set(int token_id, std::vector<float>* buffer, const std::vector<float>& values) {
     phi_matrix_->get_set(redis_client_, token_id, buffer, values);
   }
 
-  void increase(int token_id, const std::vector<float>& increment) {
-    phi_matrix_->increase(redis_client_, token_id, increment);
+  void get_range(int token_begin_index, int token_end_index, std::vector<float>* buffer) const {
+    phi_matrix_->get_range(redis_client_, token_begin_index, token_end_index, buffer);
   }
 
-  int add_token(const Token& token, bool flag) {
-    return phi_matrix_->add_token(redis_client_, token, flag);
-  }
-  
-  int add_token(const Token& token, bool flag, const std::vector<float>& values) {
-    return phi_matrix_->add_token(redis_client_, token, flag, values);
+  void increase(int token_id, const std::vector<float>& increment) {
+    phi_matrix_->increase(redis_client_, token_id, increment);
   }
 
   void clear_read_cache() { phi_matrix_->clear_read_cache(redis_client_); }
@@ -174,4 +228,5 @@ class RedisPhiMatrixAdapter {
  private:
   std::shared_ptr<RedisPhiMatrix> phi_matrix_;
   std::shared_ptr<RedisClient> redis_client_;
+  std::shared_ptr<AsyncRedisClient> async_client_;
 };
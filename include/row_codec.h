@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "value_encoding.h"
+
+// Format of phi rows in redis. DENSE rows are plain arrays of encoded values.
+// ADAPTIVE rows start with a header byte and are stored either dense or as
+// (index, value) pairs of non-zero values, whichever is shorter. Normalized p_wt
+// rows become mostly zero after several iterations, so the sparse form saves
+// most of the traffic. Rows have variable length, so the format can't be used
+// with row-block storage.
+enum class RowFormat { DENSE, ADAPTIVE };
+
+class RowCodec {
+ public:
+  static const char kDenseHeader = 0;
+  static const char kSparseHeader = 1;
+
+  // encodes adaptive row, out is overwritten
+  static void encode(const float* values, int size, ValueEncoding encoding, std::string* out);
+
+  // decodes adaptive row into size values, empty data (missing key) is decoded as zeros
+  static void decode(const char* data, size_t data_size, int size, ValueEncoding encoding, float* out);
+
+  static RowFormat parse_format(const std::string& format);
+
+  RowCodec() = delete;
+
+ private:
+  // indices are stored as uint16 when it's possible
+  static size_t bytes_per_index(int size) { return size <= 65536 ? 2 : 4; }
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "phi_store.h"
+
+// Rows are stored dense (float32) in POSIX shared memory segment "/<name>", so executors of one
+// node share the matrix without going through the network stack. Each row is protected by one of
+// striped spin locks placed in the segment too, increments are applied in place under the lock.
+//
+// The segment is created and zeroed by the first process, the others wait until it's initialized.
+// Like redis data the segment outlives processes (so the fitting can be continued), it should be
+// removed manually (/dev/shm/<name>) if the sizes of the matrix change.
+// Empty name means anonymous memory visible only in this process (e.g. for benchmarks).
+class ShmPhiStore : public PhiStore {
+ public:
+  static const int kNumStripes = 4096;
+
+  // numa_interleave spreads pages of rows over all NUMA nodes, so threads on
+  // different sockets get the same memory bandwidth (requires build with USE_NUMA)
+  ShmPhiStore(const std::string& name, int token_size, int topic_size, bool numa_interleave = false);
+  ~ShmPhiStore() override;
+
+  int topic_size() const override { return topic_size_; }
+
+  void read_row(std::shared_ptr<RedisClient> redis_client, int token_id, float* buffer) const override;
+  void read_rows(std::shared_ptr<RedisClient> redis_client, int token_begin_index, int token_end_index,
+                 float* buffer) const override;
+
+  void write_row(std::shared_ptr<RedisClient> redis_client, int token_id,
+                 const std::vector<float>& values) override;
+
+  void exchange_row(std::shared_ptr<RedisClient> redis_client, int token_id,
+                    const std::vector<float>& values, float* old_values) override;
+
+  bool add_to_row(std::shared_ptr<RedisClient> redis_client, int token_id,
+                  const std::vector<float>& increment) override;
+
+ private:
+  struct Header;
+
+  // separate cache lines, so threads working with different stripes don't invalidate each other
+  struct alignas(64) Stripe {
+    std::atomic<uint32_t> state;
+  };
+
+  void lock(int token_id) const;
+  void unlock(int token_id) const;
+
+  float* row(int token_id) const { return values_ + static_cast<size_t>(token_id) * topic_size_; }
+
+  void map_segment(bool numa_interleave);
+
+  std::string name_;
+  int token_size_;
+  int topic_size_;
+  size_t size_;
+  char* data_;
+  Stripe* stripes_;
+  float* values_;
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <vector>
+
+#include "boost/thread.hpp"
+#include "boost/thread/condition_variable.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/utility.hpp"
+
+#include "metrics.h"
+
+// 'class TaskPool' runs parallel loops on size() - 1 threads and the calling thread. The pool runs
+// one loop at a time: executor threads share one pool, and a loop started while another one is
+// running is run by its caller alone, so busy executors don't wait for each other and the pool
+// helps those that are left at the tail of an iteration. Loops mustn't be nested. Tasks are taken
+// by index from a shared counter, the function is called by reference, so loops don't allocate.
+// Redis commands of tasks are counted in the metrics registry of the caller.
+class TaskPool : boost::noncopyable {
+ public:
+  // size is the number of threads of a loop including the caller
+  explicit TaskPool(int size);
+  ~TaskPool();
+
+  int size() const { return static_cast<int>(threads_.size()) + 1; }
+
+  // calls function(task_index) for task_index in [0, num_tasks) and returns when all of them are done,
+  // the first exception of tasks is rethrown
+  template <typename Function>
+  void parallel_for(int num_tasks, const Function& function) {
+    run(num_tasks, &function, [](const void* context, int task_index) {
+      (*static_cast<const Function*>(context))(task_index);
+    });
+  }
+
+ private:
+  typedef void TaskFunction(const void* context, int task_index);
+
+  void run(int num_tasks, const void* context, TaskFunction* function);
+  // takes tasks of the current loop until they're over
+  void execute_tasks();
+  void thread_function();
+
+  std::vector<boost::thread> threads_;
+
+  // the caller of the current loop, other callers run their loops alone
+  boost::mutex run_mutex_;
+
+  boost::mutex mutex_;
+  boost::condition_variable started_;
+  boost::condition_variable finished_;
+  bool is_stopping_;
+  int generation_;
+  // threads inside execute_tasks, the next loop starts only when it's 0
+  int num_active_;
+
+  const void* context_;
+  TaskFunction* function_;
+  MetricsRegistry* metrics_;
+  int num_tasks_;
+  std::atomic<int> next_task_;
+  std::exception_ptr error_;
+};
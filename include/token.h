@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <sstream>
 #include <unordered_map>
@@ -50,18 +51,18 @@ struct Token {
 
   size_t hash() const { return hash_; }
 
-  const std::string keyword;
-  const ClassId class_id;
-
- private:
-  const size_t hash_;
-
   static size_t calc_hash(const ClassId& class_id, const std::string& keyword) {
     size_t hash = 0;
     boost::hash_combine<std::string>(hash, keyword);
     boost::hash_combine<std::string>(hash, class_id);
     return hash;
   }
+
+  const std::string keyword;
+  const ClassId class_id;
+
+ private:
+  const size_t hash_;
 };
 
 struct TokenHasher {
@@ -70,18 +71,42 @@ struct TokenHasher {
   }
 };
 
+// Tokens are stored in interned form: all keywords are packed into one contiguous
+// arena, class_id is kept as a small index into the table of classes. Lookups go through
+// an open-addressing hash table of token ids keyed by the precomputed token hash,
+// so the collection takes ~20 bytes per token plus the keyword itself.
 class TokenCollection {
  public:
+  TokenCollection() { clear(); }
+
   void clear();
+  void reserve(int size);
   int  add_token(const Token& token);
+  // hash should be equal to Token::calc_hash(class_id, keyword)
+  int  add_token(const ClassId& class_id, const char* keyword, size_t keyword_size, size_t hash);
   void swap(TokenCollection* rhs);
 
   int token_size() const;
   bool has_token(const Token& token) const;
   int token_id(const Token& token) const;
-  const Token& token(int index) const;
+  int token_id(const ClassId& class_id, const std::string& keyword) const;
+
+  // tokens aren't stored as objects, so they are built on demand
+  Token token(int index) const;
+  std::string keyword(int index) const;
+  const ClassId& class_id(int index) const;
 
  private:
-  std::unordered_map<Token, int, TokenHasher> token_to_token_id_;
-  std::vector<Token> token_id_to_token_;
+  static const uint32_t kEmptySlot = 0xFFFFFFFF;
+
+  int find(size_t hash, const ClassId& class_id, const char* keyword, size_t keyword_size) const;
+  int find_class_index(const ClassId& class_id) const;
+  void rehash(size_t num_slots);
+
+  std::vector<char> keyword_arena_;
+  std::vector<uint32_t> keyword_offset_;  // token_size() + 1 elements
+  std::vector<uint16_t> class_index_;
+  std::vector<uint32_t> hash_;            // lower bits of token hash, used for probing and rehashing
+  std::vector<ClassId> class_table_;
+  std::vector<uint32_t> slots_;           // size is always a power of 2
 };
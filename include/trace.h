@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "boost/utility.hpp"
+
+class RedisClient;
+
+// 'class Tracer' records scoped spans of threads into per-thread ring buffers and writes them
+// as Chrome trace JSON (chrome://tracing, ui.perfetto.dev). Each buffer has the only writer,
+// so a span costs two clock reads and a few stores, the oldest spans are overwritten when the
+// buffer is full. Timestamps are written on the clock of redis server (see synchronize), and
+// merge_traces.py shifts traces of all processes by the epoch published by master.
+class Tracer {
+ public:
+  Tracer() = delete;
+
+  // spans are dropped until tracing is enabled, each thread keeps the last buffer_size spans
+  static void enable(int buffer_size);
+  static bool is_enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+  // name of the calling thread in the trace
+  static void set_thread_name(const std::string& name);
+
+  // name and detail should live until the trace is written (e.g. literals)
+  static void record(const char* name, const char* detail, int64_t begin_us, int64_t end_us);
+
+  // local steady clock of spans
+  static int64_t now_us();
+
+  // estimates offset of the local clock from the clock of redis server by several TIME requests
+  static void synchronize(const RedisClient& redis_client);
+
+  // sets zero of the merged timeline to the current time of redis server, it's called by master
+  static void publish_epoch(const RedisClient& redis_client);
+
+  // writes spans of all threads of the process, pid distinguishes processes in the merged trace
+  static void write(const std::string& path, int pid, const std::string& process_name,
+                    const RedisClient& redis_client);
+
+ private:
+  static std::atomic<bool> enabled_;
+};
+
+class TraceSpan : boost::noncopyable {
+ public:
+  explicit TraceSpan(const char* name, const char* detail = nullptr)
+      : name_(name)
+      , detail_(detail)
+      , begin_us_(Tracer::is_enabled() ? Tracer::now_us() : -1) { }
+
+  ~TraceSpan() {
+    if (begin_us_ >= 0) {
+      Tracer::record(name_, detail_, begin_us_, Tracer::now_us());
+    }
+  }
+
+ private:
+  const char* name_;
+  const char* detail_;
+  int64_t begin_us_;
+};
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Encoding of float values in redis. FLOAT16 is IEEE half precision, BFLOAT16 keeps
+// the exponent range of float32 (so small probabilities don't turn into zeros) with 8 bits
+// of mantissa. Both halve network traffic and server memory, but they are lossy, so
+// they are used only for p_wt, n_wt is always accumulated in FLOAT32.
+enum class ValueEncoding { FLOAT32, FLOAT16, BFLOAT16 };
+
+class ValueEncoder {
+ public:
+  static size_t bytes_per_value(ValueEncoding encoding) {
+    return encoding == ValueEncoding::FLOAT32 ? 4 : 2;
+  }
+
+  // out should have size * bytes_per_value(encoding) bytes
+  static void encode(const float* values, int size, ValueEncoding encoding, char* out);
+
+  // decodes min(size, data_size / bytes_per_value) values, the rest of output is filled with zeros
+  static void decode(const char* data, size_t data_size, int size, ValueEncoding encoding, float* out);
+
+  static ValueEncoding parse(const std::string& encoding);
+
+  ValueEncoder() = delete;
+};
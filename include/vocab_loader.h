@@ -0,0 +1,18 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "token.h"
+
+// 'class VocabLoader' builds the token collection from the vocabulary file.
+// The file is mapped into memory and split into line-aligned chunks, each chunk
+// is parsed (and its tokens are hashed) by a separate thread, after that the
+// tokens are merged into one collection preserving the order of lines.
+class VocabLoader {
+ public:
+  // num_threads <= 0 means 'use all available cores'
+  static std::shared_ptr<TokenCollection> load(const std::string& vocab_path, int num_threads = 0);
+
+  VocabLoader() = delete;
+};
@@ -0,0 +1,36 @@
+import argparse
+import json
+
+# Merges Chrome traces written by master and executors (--trace-file) into one timeline.
+# Timestamps of the traces are on the clock of redis server, they are shifted by the epoch
+# published by master, so the timeline starts with the start of master.
+
+parser = argparse.ArgumentParser()
+parser.add_argument('-o', '--output', required=True)
+parser.add_argument('traces', nargs='+')
+
+def main():
+	args = parser.parse_args()
+
+	traces = [json.load(open(path)) for path in args.traces]
+
+	epochs = set(trace['otherData']['epoch_us'] for trace in traces) - set([0])
+	if len(epochs) > 1:
+		print('Traces have different epochs {}, the earliest one is used'.format(sorted(epochs)))
+
+	events = [event for trace in traces for event in trace['traceEvents']]
+	if epochs:
+		epoch = min(epochs)
+	else:
+		# master hasn't been traced, the first span becomes zero
+		epoch = min(event['ts'] for event in events if 'ts' in event)
+
+	for event in events:
+		if 'ts' in event:
+			event['ts'] -= epoch
+
+	json.dump({'traceEvents': events, 'displayTimeUnit': 'ms'}, open(args.output, 'w'))
+	print('{} events of {} traces have been written into {}'.format(len(events), len(traces), args.output))
+
+if __name__ == '__main__':
+	main()
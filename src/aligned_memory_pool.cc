@@ -0,0 +1,109 @@
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <vector>
+
+#include "aligned_memory_pool.h"
+
+namespace {
+  struct Block {
+    void* ptr;
+    size_t capacity;
+  };
+
+  // blocks of matrices destroyed after the pool of the thread (at its exit) are freed right away
+  thread_local bool is_pool_destroyed = false;
+
+  class ThreadBlocks {
+   public:
+    ThreadBlocks() { blocks.reserve(AlignedMemoryPool::kMaxBlocks); }
+
+    ~ThreadBlocks() {
+      for (const auto& block : blocks) {
+        free(block.ptr);
+      }
+      is_pool_destroyed = true;
+    }
+
+    std::vector<Block> blocks;
+  };
+
+  thread_local ThreadBlocks thread_blocks;
+
+  std::atomic<int64_t> num_allocated_blocks(0);
+}
+
+void* AlignedMemoryPool::acquire(size_t size, size_t* capacity) {
+  auto& blocks = thread_blocks.blocks;
+
+  auto best = blocks.end();
+  for (auto iter = blocks.begin(); iter != blocks.end(); ++iter) {
+    if (iter->capacity >= size && iter->capacity / 2 <= size &&
+        (best == blocks.end() || iter->capacity < best->capacity)) {
+      best = iter;
+    }
+  }
+
+  if (best != blocks.end()) {
+    void* retval = best->ptr;
+    *capacity = best->capacity;
+    *best = blocks.back();
+    blocks.pop_back();
+    return retval;
+  }
+
+  const size_t aligned_size = std::max<size_t>((size + kAlignment - 1) / kAlignment * kAlignment, kAlignment);
+  void* retval = nullptr;
+  if (posix_memalign(&retval, kAlignment, aligned_size) != 0) {
+    throw std::bad_alloc();
+  }
+  num_allocated_blocks.fetch_add(1, std::memory_order_relaxed);
+  *capacity = aligned_size;
+  return retval;
+}
+
+void AlignedMemoryPool::release(void* ptr, size_t capacity) {
+  if (ptr == nullptr) {
+    return;
+  }
+
+  if (is_pool_destroyed) {
+    free(ptr);
+    return;
+  }
+
+  auto& blocks = thread_blocks.blocks;
+  if (blocks.size() < kMaxBlocks) {
+    blocks.push_back({ ptr, capacity });
+    return;
+  }
+
+  auto smallest = std::min_element(blocks.begin(), blocks.end(),
+                                   [](const Block& lhs, const Block& rhs) { return lhs.capacity < rhs.capacity; });
+  if (smallest->capacity < capacity) {
+    std::swap(smallest->ptr, ptr);
+    std::swap(smallest->capacity, capacity);
+  }
+  free(ptr);
+}
+
+void AlignedMemoryPool::clear() {
+  for (const auto& block : thread_blocks.blocks) {
+    free(block.ptr);
+  }
+  thread_blocks.blocks.clear();
+}
+
+size_t AlignedMemoryPool::pooled_bytes() {
+  size_t retval = 0;
+  for (const auto& block : thread_blocks.blocks) {
+    retval += block.capacity;
+  }
+  return retval;
+}
+
+int64_t AlignedMemoryPool::num_allocations() {
+  return num_allocated_blocks.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,178 @@
+#include <stdexcept>
+
+#include "glog/logging.h"
+
+#include "async_redis_client.h"
+#include "redis_client.h"
+
+namespace {
+  // error of the command or nullptr if the reply may be used
+  std::exception_ptr reply_error(const redisReply* reply) {
+    if (reply == nullptr) {
+      return std::make_exception_ptr(std::runtime_error("Redis command has not been sent"));
+    }
+    if (reply->type == REDIS_REPLY_ERROR) {
+      return std::make_exception_ptr(std::runtime_error("Redis error: " + std::string(reply->str, reply->len)));
+    }
+    return nullptr;
+  }
+
+  std::string reply_to_string(const redisReply* reply) {
+    if (reply->type == REDIS_REPLY_STRING) {
+      return std::string(reply->str, reply->len);
+    }
+    return std::string();
+  }
+
+  std::string values_to_string(const std::vector<float>& values, ValueEncoding encoding) {
+    std::string retval(values.size() * ValueEncoder::bytes_per_value(encoding), '\0');
+    if (!values.empty()) {
+      ValueEncoder::encode(values.data(), values.size(), encoding, &retval[0]);
+    }
+    return retval;
+  }
+}
+
+AsyncRedisClient::AsyncRedisClient(const std::string& ip, int port)
+    : io_service_()
+    , work_(io_service_)
+    , adapter_(io_service_)
+    , cluster_(nullptr)
+{
+  cluster_ = AsyncHiredisCommand<>::createCluster(ip.c_str(), port, adapter_);
+
+  boost::thread t([this]() { io_service_.run(); });
+  loop_thread_.swap(t);
+}
+
+AsyncRedisClient::~AsyncRedisClient() {
+  // connections are owned by the cluster object, so it's destroyed by the loop thread
+  io_service_.post([this]() {
+    delete cluster_;
+    cluster_ = nullptr;
+    io_service_.stop();
+  });
+
+  if (loop_thread_.joinable()) {
+    loop_thread_.join();
+  }
+}
+
+void AsyncRedisClient::command(const std::string& key, const std::vector<std::string>& args,
+                               const ReplyCallback& callback)
+{
+  auto command_args = std::make_shared<std::vector<std::string>>(args);
+
+  io_service_.post([this, key, command_args, callback]() {
+    std::vector<const char*> argv;
+    std::vector<size_t> argvlen;
+    for (const auto& arg : *command_args) {
+      argv.push_back(arg.data());
+      argvlen.push_back(arg.size());
+    }
+
+    try {
+      // the command object formats arguments into its own buffer and deletes itself after the reply
+      AsyncHiredisCommand<>::Command(cluster_, key, argv.size(), &argv[0], &argvlen[0],
+                                     [callback](const redisReply& reply) { callback(&reply); });
+    } catch (const std::exception& error) {
+      LOG(ERROR) << "Unable to send async redis command " << (*command_args)[0] << ": " << error.what();
+      callback(nullptr);
+    }
+  });
+}
+
+std::future<std::string> AsyncRedisClient::get_raw_value(const std::string& key) {
+  auto promise = std::make_shared<std::promise<std::string>>();
+
+  command(key, { "GET", key }, [promise](const redisReply* reply) {
+    auto error = reply_error(reply);
+    if (error) {
+      promise->set_exception(error);
+    } else {
+      promise->set_value(reply_to_string(reply));
+    }
+  });
+
+  return promise->get_future();
+}
+
+std::future<std::string> AsyncRedisClient::get_raw_range(const std::string& key, int byte_begin, int byte_end) {
+  auto promise = std::make_shared<std::promise<std::string>>();
+
+  command(key, { "GETRANGE", key, std::to_string(byte_begin), std::to_string(byte_end - 1) },
+          [promise](const redisReply* reply) {
+    auto error = reply_error(reply);
+    if (error) {
+      promise->set_exception(error);
+    } else {
+      promise->set_value(reply_to_string(reply));
+    }
+  });
+
+  return promise->get_future();
+}
+
+std::future<void> AsyncRedisClient::set_raw_value(const std::string& key, const std::string& data) {
+  return execute(key, { "SET", key, data });
+}
+
+std::future<std::vector<float>> AsyncRedisClient::get_values(const std::string& key, int values_size,
+                                                             ValueEncoding encoding)
+{
+  auto promise = std::make_shared<std::promise<std::vector<float>>>();
+
+  command(key, { "GET", key }, [promise, values_size, encoding](const redisReply* reply) {
+    auto error = reply_error(reply);
+    if (error) {
+      promise->set_exception(error);
+      return;
+    }
+
+    std::vector<float> values(values_size, 0.0f);
+    if (reply->type == REDIS_REPLY_STRING && values_size > 0) {
+      ValueEncoder::decode(reply->str, reply->len, values_size, encoding, &values[0]);
+    }
+    promise->set_value(std::move(values));
+  });
+
+  return promise->get_future();
+}
+
+std::future<void> AsyncRedisClient::set_values(const std::string& key, const std::vector<float>& values,
+                                               ValueEncoding encoding)
+{
+  return execute(key, { "SET", key, values_to_string(values, encoding) });
+}
+
+std::future<bool> AsyncRedisClient::increase_values(const std::string& key, const std::vector<float>& increments) {
+  auto promise = std::make_shared<std::promise<bool>>();
+
+  command(key, { "EVAL", RedisClient::increase_range_script(), "1", key, "0",
+                 values_to_string(increments, ValueEncoding::FLOAT32) },
+          [promise](const redisReply* reply) {
+    auto error = reply_error(reply);
+    if (error) {
+      promise->set_exception(error);
+    } else {
+      promise->set_value(reply->type == REDIS_REPLY_INTEGER);
+    }
+  });
+
+  return promise->get_future();
+}
+
+std::future<void> AsyncRedisClient::execute(const std::string& key, const std::vector<std::string>& args) {
+  auto promise = std::make_shared<std::promise<void>>();
+
+  command(key, args, [promise](const redisReply* reply) {
+    auto error = reply_error(reply);
+    if (error) {
+      promise->set_exception(error);
+    } else {
+      promise->set_value();
+    }
+  });
+
+  return promise->get_future();
+}
@@ -0,0 +1,190 @@
+#include <cmath>
+#include <type_traits>
+
+#include "common.h"
+#include "e_step_kernels.h"
+
+// topic counts the kernels are compiled for, cmake passes E_STEP_TOPIC_SIZES option here
+#ifndef E_STEP_TOPIC_SIZES
+#define E_STEP_TOPIC_SIZES 64, 100, 128, 200, 256, 512, 1000
+#endif
+
+namespace {
+  // partial sums are kept in kLanes floats (two SSE or one AVX register), more lanes
+  // make gcc spill them to the stack; the padding of vectors is a multiple of it
+  const int kLanes = 8;
+  static_assert(EStepKernels::kTopicPadding % kLanes == 0, "padding should be a multiple of lanes");
+
+  // Size of kernels is either int or std::integral_constant<int, N>,
+  // the latter makes trip counts of all loops over topics constant.
+  // Vectors of kernels never overlap, __restrict__ lets compiler vectorize the updates at -O2.
+
+  inline float sum_lanes(const float* lanes) {
+    float retval = 0.0f;
+    for (int j = 0; j < kLanes; ++j) {
+      retval += lanes[j];
+    }
+    return retval;
+  }
+
+  // size is a multiple of kLanes
+  template <typename Size>
+  inline float padded_dot(Size size, const float* x, const float* y) {
+    float lanes[kLanes] = { 0.0f };
+    for (int k = 0; k < size; k += kLanes) {
+      for (int j = 0; j < kLanes; ++j) {
+        lanes[j] += x[k + j] * y[k + j];
+      }
+    }
+    return sum_lanes(lanes);
+  }
+
+  template <typename Size>
+  inline float dot(Size size, const float* x, const float* y) {
+    const int body_size = size / kLanes * kLanes;
+    float retval = padded_dot(body_size, x, y);
+    for (int k = body_size; k < size; ++k) {
+      retval += x[k] * y[k];
+    }
+    return retval;
+  }
+
+  // theta of the document is normalized, values below kEps become zeros
+  template <typename Size>
+  inline void normalize_theta(Size size, float* theta) {
+    float lanes[kLanes] = { 0.0f };
+    for (int k = 0; k < size; k += kLanes) {
+      for (int j = 0; j < kLanes; ++j) {
+        lanes[j] += theta[k + j] > 0.0f ? theta[k + j] : 0.0f;
+      }
+    }
+
+    const float sum = sum_lanes(lanes);
+    const float sum_inv = sum > 0.0f ? (1.0f / sum) : 0.0f;
+    for (int k = 0; k < size; ++k) {
+      const float value = sum_inv * theta[k];
+      theta[k] = value < kEps ? 0.0f : value;
+    }
+  }
+
+  template <typename PaddedSize>
+  void infer_theta(PaddedSize num_topics, const float* __restrict__ phi, const float* n_dw, int num_tokens,
+                   int num_inner_iters, float* __restrict__ theta, float* __restrict__ n_td)
+  {
+    for (int inner_iter = 0; inner_iter < num_inner_iters; ++inner_iter) {
+      for (int k = 0; k < num_topics; ++k) {
+        n_td[k] = 0.0f;
+      }
+
+      for (int i = 0; i < num_tokens; ++i) {
+        const float* phi_ptr = phi + i * num_topics;
+
+        const float p_dw = padded_dot(num_topics, phi_ptr, theta);
+        if (p_dw == 0) {
+          continue;
+        }
+
+        const float alpha = n_dw[i] / p_dw;
+        for (int k = 0; k < num_topics; ++k) {
+          n_td[k] += alpha * phi_ptr[k];
+        }
+      }
+
+      for (int k = 0; k < num_topics; ++k) {
+        theta[k] *= n_td[k];
+      }
+
+      normalize_theta(num_topics, theta);
+    }
+  }
+
+  template <typename Size>
+  double update_nwt(Size num_topics, const float* __restrict__ p_wt, const float* __restrict__ theta, int theta_stride,
+                    const int* doc_ids, const float* n_wd, int num_docs, float* __restrict__ n_wt)
+  {
+    double retval = 0.0;
+    for (int i = 0; i < num_docs; ++i) {
+      const float* theta_ptr = theta + static_cast<size_t>(doc_ids[i]) * theta_stride;
+
+      const float p_wd = dot(num_topics, p_wt, theta_ptr);
+      if (p_wd < kEps) {
+        continue;
+      }
+
+      const float alpha = n_wd[i] / p_wd;
+      for (int k = 0; k < num_topics; ++k) {
+        n_wt[k] += alpha * theta_ptr[k];
+      }
+
+      retval += static_cast<double>(n_wd[i] * log(p_wd));
+    }
+    return retval;
+  }
+
+  template <int NumTopics>
+  void infer_theta_fixed(int /* num_topics */, const float* phi, const float* n_dw, int num_tokens,
+                         int num_inner_iters, float* theta, float* n_td)
+  {
+    const int kPadding = EStepKernels::kTopicPadding;
+    typedef std::integral_constant<int, (NumTopics + kPadding - 1) / kPadding * kPadding> PaddedSize;
+    infer_theta(PaddedSize(), phi, n_dw, num_tokens, num_inner_iters, theta, n_td);
+  }
+
+  void infer_theta_generic(int num_topics, const float* phi, const float* n_dw, int num_tokens,
+                           int num_inner_iters, float* theta, float* n_td)
+  {
+    infer_theta(EStepKernels::padded_size(num_topics), phi, n_dw, num_tokens, num_inner_iters, theta, n_td);
+  }
+
+  template <int NumTopics>
+  double update_nwt_fixed(int /* num_topics */, const float* p_wt, const float* theta, int theta_stride,
+                          const int* doc_ids, const float* n_wd, int num_docs, float* n_wt)
+  {
+    typedef std::integral_constant<int, NumTopics> Size;
+    return update_nwt(Size(), p_wt, theta, theta_stride, doc_ids, n_wd, num_docs, n_wt);
+  }
+
+  double update_nwt_generic(int num_topics, const float* p_wt, const float* theta, int theta_stride,
+                            const int* doc_ids, const float* n_wd, int num_docs, float* n_wt)
+  {
+    return update_nwt(num_topics, p_wt, theta, theta_stride, doc_ids, n_wd, num_docs, n_wt);
+  }
+
+  template <int... TopicSizes>
+  struct SpecializedKernels;
+
+  template <>
+  struct SpecializedKernels<> {
+    static bool find(int /* num_topics */, EStepKernels* /* kernels */) {
+      return false;
+    }
+  };
+
+  template <int NumTopics, int... TopicSizes>
+  struct SpecializedKernels<NumTopics, TopicSizes...> {
+    static bool find(int num_topics, EStepKernels* kernels) {
+      if (num_topics != NumTopics) {
+        return SpecializedKernels<TopicSizes...>::find(num_topics, kernels);
+      }
+
+      kernels->infer_theta = &infer_theta_fixed<NumTopics>;
+      kernels->update_nwt = &update_nwt_fixed<NumTopics>;
+      kernels->is_specialized = true;
+      return true;
+    }
+  };
+}
+
+EStepKernels EStepKernels::get(int num_topics) {
+  EStepKernels retval = generic();
+  SpecializedKernels<E_STEP_TOPIC_SIZES>::find(num_topics, &retval);
+  return retval;
+}
+
+EStepKernels EStepKernels::generic() {
+  EStepKernels retval;
+  retval.infer_theta = &infer_theta_generic;
+  retval.update_nwt = &update_nwt_generic;
+  retval.is_specialized = false;
+  return retval;
+}
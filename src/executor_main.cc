@@ -12,12 +12,19 @@
 
 #include "glog/logging.h"
 
+#include "async_redis_client.h"
+#include "executor_parameters.h"
 #include "executor_thread.h"
 #include "helpers.h"
 #include "redis_phi_matrix.h"
 #include "redis_client.h"
+#include "partitioned_phi_store.h"
 #include "protocol.h"
+#include "shm_phi_store.h"
+#include "task_pool.h"
 #include "token.h"
+#include "trace.h"
+#include "vocab_loader.h"
 
 namespace po = boost::program_options;
 
@@ -29,17 +36,20 @@ namespace po = boost::program_options;
 //  signal_flag = 1;
 //}
 
-struct Parameters {
-  int num_topics;
-  int num_inner_iters;
-  int num_threads;
-  std::string batches_dir_path;
-  std::string vocab_path;
+struct Parameters : ExecutorParameters {
+  int redis_connections;
   std::string redis_ip;
   std::string redis_port;
   int continue_fitting;
-  std::string caching_mode;
+  int pwt_prefetch;
+  std::string phi_store;
+  std::string shm_name;
+  int shm_numa_interleave;
+  std::string server_host;
+  int server_port;
   int delayed_update;
+  std::string trace_file;
+  int trace_buffer_size;
   int token_begin_index;
   int token_end_index;
   int batch_begin_index;
@@ -48,16 +58,20 @@ struct Parameters {
 };
 
 void log_parameters(const Parameters& parameters) {
-    LOG(INFO) << "num-topics: "        << parameters.num_topics        << "; "
-              << "num-inner-iter: "    << parameters.num_inner_iters   << "; "
-              << "num-threads: "       << parameters.num_threads       << "; "
-              << "batches-dir-path: "  << parameters.batches_dir_path  << "; "
-              << "vocab-path: "        << parameters.vocab_path        << "; "
+    LOG(INFO) << parameters.to_string()
+              << "redis-connections: " << parameters.redis_connections << "; "
               << "redis-ip: "          << parameters.redis_ip          << "; "
               << "redis-port: "        << parameters.redis_port        << "; "
               << "continue-fitting: "  << parameters.continue_fitting  << "; "
-              << "caching-mode: "      << parameters.caching_mode      << "; "
+              << "pwt-prefetch: "      << parameters.pwt_prefetch      << "; "
+              << "phi-store: "         << parameters.phi_store         << "; "
+              << "shm-name: "          << parameters.shm_name          << "; "
+              << "shm-numa-interleave: " << parameters.shm_numa_interleave << "; "
+              << "server-host: "       << parameters.server_host       << "; "
+              << "server-port: "       << parameters.server_port       << "; "
               << "delayed-update: "    << parameters.delayed_update    << "; "
+              << "trace-file: "        << parameters.trace_file        << "; "
+              << "trace-buffer-size: " << parameters.trace_buffer_size << "; "
               << "token-begin-index: " << parameters.token_begin_index << "; "
               << "token-end-index: "   << parameters.token_end_index   << "; "
               << "batch-begin-index: " << parameters.batch_begin_index << "; "
@@ -66,30 +80,20 @@ void log_parameters(const Parameters& parameters) {
 }
 
 void check_parameters(const Parameters& parameters) {
-  if (parameters.num_topics <= 0) {
-    throw std::runtime_error("num_topics should be a positive integer");
-  }
-
-  if (parameters.num_inner_iters <= 0) {
-    throw std::runtime_error("num_inner_iters should be a positive integer");
-  }
+  parameters.check();
 
-  if (parameters.num_threads <= 0) {
-    throw std::runtime_error("num_threads should be a positive integer");
-  }
-
-  if (parameters.batches_dir_path == "") {
-    throw std::runtime_error("batches_dir_path should be non-empty");
-  }
-
-  if (parameters.vocab_path == "") {
-    throw std::runtime_error("vocab_path should be non-empty");
+  if (parameters.redis_connections < 0) {
+    throw std::runtime_error("redis_connections should be a non-negative integer");
   }
 
   if (parameters.redis_ip == "") {
     throw std::runtime_error("redis_ip should be non-empty");
   }
 
+  if (parameters.trace_buffer_size <= 0) {
+    throw std::runtime_error("trace_buffer_size should be a positive integer");
+  }
+
   if (parameters.redis_port == "") {
     throw std::runtime_error("redis_port should be non-empty");
   }
@@ -98,12 +102,41 @@ void check_parameters(const Parameters& parameters) {
     throw std::runtime_error("continue_fitting should be equal to 0 or 1");
   }
 
-  if (parameters.caching_mode != CACHING_MODE_NONE &&
-      parameters.caching_mode != CACHING_MODE_PWT &&
-      parameters.caching_mode != CACHING_MODE_NWT &&
-      parameters.caching_mode != CACHING_MODE_ALL)
+  if (parameters.pwt_prefetch != 0 && parameters.pwt_prefetch != 1) {
+    throw std::runtime_error("pwt_prefetch should be equal to 0 or 1");
+  }
+
+  if (parameters.phi_store != PHI_STORE_REDIS &&
+      parameters.phi_store != PHI_STORE_SHM &&
+      parameters.phi_store != PHI_STORE_PARTITIONED)
   {
-    throw std::runtime_error("caching_mode should be in none|pwt|nwt|all");
+    throw std::runtime_error("phi_store should be in redis|shm|partitioned");
+  }
+
+  if (parameters.phi_store != PHI_STORE_REDIS &&
+      (parameters.pwt_encoding != VALUE_ENCODING_FP32 ||
+       parameters.pwt_row_format != ROW_FORMAT_DENSE ||
+       parameters.nwt_compressed_flush != 0 ||
+       parameters.pwt_prefetch != 0))
+  {
+    throw std::runtime_error("shm and partitioned phi_store keep dense float32 rows, "
+                             "encodings, compression and prefetch are redis only");
+  }
+
+  if (parameters.phi_store == PHI_STORE_SHM && parameters.shm_name.empty()) {
+    throw std::runtime_error("shm_name should be non-empty");
+  }
+
+  if (parameters.shm_numa_interleave != 0 && parameters.shm_numa_interleave != 1) {
+    throw std::runtime_error("shm_numa_interleave should be equal to 0 or 1");
+  }
+
+  if (parameters.phi_store == PHI_STORE_PARTITIONED && parameters.continue_fitting != 0) {
+    throw std::runtime_error("partitioned phi_store lives in executors memory, continue_fitting should be 0");
+  }
+
+  if (parameters.server_port < 0 || parameters.server_port > 65535) {
+    throw std::runtime_error("server_port should be in [0, 65535]");
   }
 
   if (parameters.delayed_update != 0 && parameters.delayed_update != 1) {
@@ -135,16 +168,22 @@ bool parse_and_print_parameters(int argc, char* argv[], Parameters* parameters)
   po::options_description all_options("Options");
   all_options.add_options()
     ("help", "Show help")
-    ("num-topics",        po::value(&parameters->num_topics)->default_value(1),            "Number of topics")                                // NOLINT
-    ("num-inner-iter",    po::value(&parameters->num_inner_iters)->default_value(1),       "Number of document passes")                       // NOLINT
-    ("num-threads",       po::value(&parameters->num_threads)->default_value(1),           "Number of executor processor threads")            // NOLINT
-    ("batches-dir-path",  po::value(&parameters->batches_dir_path)->default_value("."),    "Path to files with documents")                    // NOLINT
-    ("vocab-path",        po::value(&parameters->vocab_path)->default_value("."),          "Path to files with documents")                    // NOLINT
+    ;
+  parameters->add_options(&all_options);
+  all_options.add_options()
+    ("redis-connections", po::value(&parameters->redis_connections)->default_value(0),     "Max connections to each redis node, 0 - num-threads + e-step-threads - 1")  // NOLINT
     ("redis-ip",          po::value(&parameters->redis_ip)->default_value(""),             "IP of redis instance")                            // NOLINT
     ("redis-port",        po::value(&parameters->redis_port)->default_value(""),           "Port of redis instance")                          // NOLINT
     ("continue-fitting",  po::value(&parameters->continue_fitting)->default_value(0),      "1 - continue fitting redis model, 0 - restart")   // NOLINT
-    ("caching-mode",      po::value(&parameters->caching_mode)->default_value("none"),     "Cache usage policy: none|pwt|nwt|all")            // NOLINT
+    ("pwt-prefetch",      po::value(&parameters->pwt_prefetch)->default_value(0),          "1 - request p_wt rows of next item asynchronously, 0 - not")  // NOLINT
+    ("phi-store",         po::value(&parameters->phi_store)->default_value("redis"),       "Storage of phi matrices: redis|shm|partitioned")  // NOLINT
+    ("shm-name",          po::value(&parameters->shm_name)->default_value("cluster-bigartm"), "Prefix of shared memory segments of phi")   // NOLINT
+    ("shm-numa-interleave", po::value(&parameters->shm_numa_interleave)->default_value(0), "1 - interleave shm phi over NUMA nodes, 0 - not")  // NOLINT
+    ("server-host",       po::value(&parameters->server_host)->default_value("127.0.0.1"), "Address of phi server reachable by other executors")  // NOLINT
+    ("server-port",       po::value(&parameters->server_port)->default_value(0),           "Port of phi server, 0 - any free port")           // NOLINT
     ("delayed-update",    po::value(&parameters->delayed_update)->default_value(0),        "1 - update n_wt matrix per iter, 0 - per batch")  // NOLINT
+    ("trace-file",        po::value(&parameters->trace_file)->default_value(""),           "Path to Chrome trace of executor threads, empty - no tracing")  // NOLINT
+    ("trace-buffer-size", po::value(&parameters->trace_buffer_size)->default_value(65536), "Number of last trace spans kept by each thread")  // NOLINT
     ("token-begin-index", po::value(&parameters->token_begin_index)->default_value(0),     "Index of token to init/norm from")                // NOLINT
     ("token-end-index",   po::value(&parameters->token_end_index)->default_value(0),       "Index of token to init/norm to (excluding)")      // NOLINT
     ("batch-begin-index", po::value(&parameters->batch_begin_index)->default_value(0),     "Index of batch to process from")                  // NOLINT
@@ -165,18 +204,6 @@ bool parse_and_print_parameters(int argc, char* argv[], Parameters* parameters)
   return false;
 }
 
-std::vector<std::pair<int, int>> get_indices(int num_threads, int begin_index, int end_index) {
-  int step = std::ceil((end_index - begin_index) / static_cast<double>(num_threads));
-
-  std::vector<std::pair<int, int>> retval;
-  for (int thread_id = 0; thread_id < num_threads; ++thread_id) {
-    retval.push_back(std::make_pair(begin_index + step * thread_id,
-                                    std::min(begin_index + step * (thread_id + 1), end_index)));
-  }
-
-  return retval;
-}
-
 int main(int argc, char* argv[]) {
   //signal(SIGINT, signal_handler);
 
@@ -200,24 +227,36 @@ int main(int argc, char* argv[]) {
   LOG(INFO) << "Executor " << executor_id << ": start connecting redis at "
             << parameters.redis_ip << ":" << parameters.redis_port;
 
-  auto redis_client = std::shared_ptr<RedisClient>(new RedisClient(parameters.redis_ip,
-                                                                   std::stoi(parameters.redis_port)));
+  // all clients of the executor share connections, the slot map is requested only once;
+  // workers of E-step pool read and write rows too
+  const int redis_connections = parameters.redis_connections > 0 ? parameters.redis_connections
+                                                                 : parameters.num_threads + parameters.e_step_threads - 1;
+  auto redis_pool = std::make_shared<RedisConnectionPool>(parameters.redis_ip, std::stoi(parameters.redis_port),
+                                                          redis_connections);
+  auto redis_client = std::make_shared<RedisClient>(redis_pool);
 
   LOG(INFO) << "Executor " << executor_id << ": finish connecting to redis";
+
+  if (!parameters.trace_file.empty()) {
+    Tracer::enable(parameters.trace_buffer_size);
+    Tracer::synchronize(*redis_client);
+    Tracer::set_thread_name("main");
+  }
  
   LOG(INFO) << "Executor " << executor_id << ": start creating threads";
 
   std::vector<std::string> command_keys = generate_command_keys(parameters.executor_id, parameters.num_threads);
   std::vector<std::string> data_keys = generate_data_keys(parameters.executor_id, parameters.num_threads);
+  std::vector<std::string> metrics_keys = generate_metrics_keys(parameters.executor_id, parameters.num_threads);
 
   try {
-    std::vector<std::pair<int, int>> token_indices = get_indices(parameters.num_threads,
-                                                                 parameters.token_begin_index,
-                                                                 parameters.token_end_index);
+    std::vector<std::pair<int, int>> token_indices = Helpers::split_indices(parameters.num_threads,
+                                                                            parameters.token_begin_index,
+                                                                            parameters.token_end_index);
 
-    std::vector<std::pair<int, int>> batch_indices = get_indices(parameters.num_threads,
-                                                                 parameters.batch_begin_index,
-                                                                 parameters.batch_end_index);
+    std::vector<std::pair<int, int>> batch_indices = Helpers::split_indices(parameters.num_threads,
+                                                                            parameters.batch_begin_index,
+                                                                            parameters.batch_end_index);
     LOG(INFO) << "Executor " << executor_id
               << ": first token index is " << token_indices[0].first
               << ", last token index is " << token_indices[token_indices.size() - 1].second
@@ -243,49 +282,92 @@ int main(int argc, char* argv[]) {
       nwt_mode = PhiMatrixCacheMode::WRITE;
     }
 
-    auto p_wt = std::shared_ptr<RedisPhiMatrix>(new RedisPhiMatrix(ModelName("pwt"), topics, pwt_mode));
-    auto n_wt = std::shared_ptr<RedisPhiMatrix>(new RedisPhiMatrix(ModelName("nwt"), topics, nwt_mode));
+    LOG(INFO) << "Executor " << executor_id << ": start loading vocabulary";
+    std::shared_ptr<const TokenCollection> vocab = VocabLoader::load(parameters.vocab_path, parameters.num_threads);
+    LOG(INFO) << "Executor " << executor_id << ": finish loading vocabulary";
+
+    RedisKeyLayout key_layout(RedisKeyLayout::parse_mode(parameters.key_layout),
+                              parameters.key_block_size,
+                              vocab->token_size(),
+                              parameters.rows_per_value);
+
+    std::shared_ptr<PhiStore> p_wt_store;
+    std::shared_ptr<PhiStore> n_wt_store;
+    if (parameters.phi_store == PHI_STORE_PARTITIONED) {
+      // this executor owns rows of its token range and serves them to others
+      PhiPartition partition = { parameters.server_host, parameters.server_port, parameters.token_begin_index,
+                                 std::min(parameters.token_end_index, vocab->token_size()) };
+
+      auto phi_server = std::make_shared<PhiServer>(partition.host, partition.port,
+                                                    partition.token_begin_index, partition.token_end_index);
+      phi_server->add_model(ModelName("pwt"), topics.size());
+      phi_server->add_model(ModelName("nwt"), topics.size());
+      phi_server->start();
+
+      partition.port = phi_server->port();
+      PartitionedPhiStore::publish_partition(redis_client, executor_id, partition);
+      LOG(INFO) << "Executor " << executor_id << ": phi server is listening at "
+                << partition.host << ":" << partition.port;
+
+      p_wt_store = std::make_shared<PartitionedPhiStore>(ModelName("pwt"), vocab->token_size(),
+                                                         topics.size(), phi_server);
+      n_wt_store = std::make_shared<PartitionedPhiStore>(ModelName("nwt"), vocab->token_size(),
+                                                         topics.size(), phi_server);
+    } else if (parameters.phi_store == PHI_STORE_SHM) {
+      const bool numa_interleave = parameters.shm_numa_interleave == 1;
+      p_wt_store = std::make_shared<ShmPhiStore>(parameters.shm_name + "-pwt", vocab->token_size(),
+                                                 topics.size(), numa_interleave);
+      n_wt_store = std::make_shared<ShmPhiStore>(parameters.shm_name + "-nwt", vocab->token_size(),
+                                                 topics.size(), numa_interleave);
+    } else {
+      // n_wt is accumulated in float32
+      p_wt_store = std::make_shared<RedisPhiStore>(ModelName("pwt"), topics.size(), key_layout,
+                                                   ValueEncoder::parse(parameters.pwt_encoding),
+                                                   RowCodec::parse_format(parameters.pwt_row_format));
+      n_wt_store = std::make_shared<RedisPhiStore>(ModelName("nwt"), topics.size(), key_layout,
+                                                   ValueEncoding::FLOAT32, RowFormat::DENSE,
+                                                   parameters.nwt_compressed_flush == 1);
+    }
 
-    int counter = 0;
-    auto zero_vector = std::vector<float>(p_wt->topic_size(), 0.0f);
+    // both matrices share the same vocabulary
+    auto p_wt = std::shared_ptr<RedisPhiMatrix>(
+        new RedisPhiMatrix(ModelName("pwt"), topics, vocab, pwt_mode, p_wt_store));
+    auto n_wt = std::shared_ptr<RedisPhiMatrix>(
+        new RedisPhiMatrix(ModelName("nwt"), topics, vocab, nwt_mode, n_wt_store));
 
-    std::ifstream fin;
-    std::string line;
-    fin.open(parameters.vocab_path);
+    auto zero_vector = std::vector<float>(p_wt->topic_size(), 0.0f);
 
     bool continue_fitting = parameters.continue_fitting == 1;
-    while (std::getline(fin, line)) {
-      auto token = Token(DefaultClass, line);
-      bool add_token_to_redis = false;
-
-      if (counter >= parameters.token_begin_index && counter < parameters.token_end_index) {
-        add_token_to_redis = !continue_fitting;
+    if (!continue_fitting) {
+      int token_end_index = std::min(parameters.token_end_index, vocab->token_size());
+      for (int token_id = parameters.token_begin_index; token_id < token_end_index; ++token_id) {
+        p_wt->set(redis_client, token_id, zero_vector);
+        n_wt->set(redis_client, token_id, Helpers::generate_random_vector(n_wt->topic_size(), vocab->token(token_id)));
       }
-
-      p_wt->add_token(redis_client, token, add_token_to_redis, zero_vector);
-      n_wt->add_token(redis_client,
-                      token,
-                      add_token_to_redis,
-                      add_token_to_redis ? Helpers::generate_random_vector(p_wt->topic_size(), token) : zero_vector);
-      ++counter;
     }
-    fin.close();
 
     LOG(INFO) << "Executor " << executor_id << ": " << "number of tokens: " << p_wt->token_size()
               << "; redis matrices had been reset: " << !continue_fitting;
 
+    // one event loop per executor, its connections are shared by all threads
+    std::shared_ptr<AsyncRedisClient> async_client;
+    if (parameters.pwt_prefetch == 1) {
+      async_client = std::make_shared<AsyncRedisClient>(parameters.redis_ip, std::stoi(parameters.redis_port));
+    }
+
+    // clients and matrices are thread-safe, all threads share one pair of adapters
+    auto p_wt_adapter = std::make_shared<RedisPhiMatrixAdapter>(p_wt, redis_client, async_client);
+    auto n_wt_adapter = std::make_shared<RedisPhiMatrixAdapter>(n_wt, redis_client);
+
+    std::shared_ptr<TaskPool> e_step_pool = parameters.create_e_step_pool();
+
     std::vector<std::shared_ptr<ExecutorThread>> threads;
     for (int thread_id = 0; thread_id < parameters.num_threads; ++thread_id) {
-      std::string ip = parameters.redis_ip;
-      int port = std::stoi(parameters.redis_port);
-      auto thread_client = std::shared_ptr<RedisClient>(new RedisClient(ip, port));
-      auto p_wt_client = std::shared_ptr<RedisClient>(new RedisClient(ip, port));
-      auto n_wt_client = std::shared_ptr<RedisClient>(new RedisClient(ip, port));
-
       threads.push_back(std::shared_ptr<ExecutorThread>(
         new ExecutorThread(command_keys[thread_id],
                            data_keys[thread_id],
-                           thread_client,
+                           metrics_keys[thread_id],
+                           redis_client,
                            continue_fitting,
                            parameters.batches_dir_path,
                            token_indices[thread_id].first,
@@ -293,8 +375,9 @@ int main(int argc, char* argv[]) {
                            batch_indices[thread_id].first,
                            batch_indices[thread_id].second,
                            parameters.num_inner_iters,
-                           std::make_shared<RedisPhiMatrixAdapter>(RedisPhiMatrixAdapter(p_wt, p_wt_client)),
-                           std::make_shared<RedisPhiMatrixAdapter>(RedisPhiMatrixAdapter(n_wt, n_wt_client)))
+                           p_wt_adapter,
+                           n_wt_adapter,
+                           e_step_pool)
       ));
     }
 
@@ -312,6 +395,13 @@ int main(int argc, char* argv[]) {
       }
       usleep(2000);
     }
+
+    if (!parameters.trace_file.empty()) {
+      // spans of threads are read only after they have stopped
+      threads.clear();
+      Tracer::write(parameters.trace_file, executor_id + 1, "executor " + std::to_string(executor_id),
+                    *redis_client);
+    }
   } catch (const std::exception& error) {
     LOG(FATAL) << "Error in executor " << executor_id << ": " << error.what();
   } catch (...) {
@@ -0,0 +1,126 @@
+#include <sstream>
+#include <stdexcept>
+
+#include "common.h"
+#include "executor_parameters.h"
+#include "task_pool.h"
+
+namespace po = boost::program_options;
+
+void ExecutorParameters::add_options(po::options_description* options) {
+  options->add_options()
+    ("num-topics",           po::value(&num_topics)->default_value(1),                "Number of topics")  // NOLINT
+    ("num-inner-iter",       po::value(&num_inner_iters)->default_value(1),           "Number of document passes")  // NOLINT
+    ("num-threads",          po::value(&num_threads)->default_value(1),               "Number of executor processor threads")  // NOLINT
+    ("e-step-threads",       po::value(&e_step_threads)->default_value(1),            "Number of threads sharing E-step of a batch, 1 - no sharing")  // NOLINT
+    ("batches-dir-path",     po::value(&batches_dir_path)->default_value("."),        "Path to batches with documents")  // NOLINT
+    ("vocab-path",           po::value(&vocab_path)->default_value("."),              "Path to file with vocabulary")  // NOLINT
+    ("caching-mode",         po::value(&caching_mode)->default_value("none"),         "Cache usage policy: none|pwt|nwt|all")  // NOLINT
+    ("key-layout",           po::value(&key_layout)->default_value("text"),           "Layout of redis keys: text|block|slot")  // NOLINT
+    ("key-block-size",       po::value(&key_block_size)->default_value(1),            "Number of tokens sharing slot in block layout")  // NOLINT
+    ("rows-per-value",       po::value(&rows_per_value)->default_value(1),            "Number of token rows packed into redis value")  // NOLINT
+    ("pwt-encoding",         po::value(&pwt_encoding)->default_value("fp32"),         "Encoding of p_wt values: fp32|fp16|bf16")  // NOLINT
+    ("pwt-row-format",       po::value(&pwt_row_format)->default_value("dense"),      "Format of p_wt rows: dense|adaptive")  // NOLINT
+    ("nwt-compressed-flush", po::value(&nwt_compressed_flush)->default_value(0),      "1 - flush n_wt cache as sparse rows, 0 - dense")  // NOLINT
+    ;
+}
+
+std::string ExecutorParameters::to_string() const {
+  std::stringstream stream;
+  stream << "num-topics: "           << num_topics           << "; "
+         << "num-inner-iter: "       << num_inner_iters      << "; "
+         << "num-threads: "          << num_threads          << "; "
+         << "e-step-threads: "       << e_step_threads       << "; "
+         << "batches-dir-path: "     << batches_dir_path     << "; "
+         << "vocab-path: "           << vocab_path           << "; "
+         << "caching-mode: "         << caching_mode         << "; "
+         << "key-layout: "           << key_layout           << "; "
+         << "key-block-size: "       << key_block_size       << "; "
+         << "rows-per-value: "       << rows_per_value       << "; "
+         << "pwt-encoding: "         << pwt_encoding         << "; "
+         << "pwt-row-format: "       << pwt_row_format       << "; "
+         << "nwt-compressed-flush: " << nwt_compressed_flush << "; ";
+  return stream.str();
+}
+
+void ExecutorParameters::check() const {
+  if (num_topics <= 0) {
+    throw std::runtime_error("num_topics should be a positive integer");
+  }
+
+  if (num_inner_iters <= 0) {
+    throw std::runtime_error("num_inner_iters should be a positive integer");
+  }
+
+  if (num_threads <= 0) {
+    throw std::runtime_error("num_threads should be a positive integer");
+  }
+
+  if (e_step_threads <= 0) {
+    throw std::runtime_error("e_step_threads should be a positive integer");
+  }
+
+  if (batches_dir_path == "") {
+    throw std::runtime_error("batches_dir_path should be non-empty");
+  }
+
+  if (vocab_path == "") {
+    throw std::runtime_error("vocab_path should be non-empty");
+  }
+
+  if (caching_mode != CACHING_MODE_NONE &&
+      caching_mode != CACHING_MODE_PWT &&
+      caching_mode != CACHING_MODE_NWT &&
+      caching_mode != CACHING_MODE_ALL)
+  {
+    throw std::runtime_error("caching_mode should be in none|pwt|nwt|all");
+  }
+
+  if (key_layout != KEY_LAYOUT_TEXT &&
+      key_layout != KEY_LAYOUT_BLOCK &&
+      key_layout != KEY_LAYOUT_SLOT)
+  {
+    throw std::runtime_error("key_layout should be in text|block|slot");
+  }
+
+  if (key_block_size <= 0) {
+    throw std::runtime_error("key_block_size should be a positive integer");
+  }
+
+  if (rows_per_value <= 0) {
+    throw std::runtime_error("rows_per_value should be a positive integer");
+  }
+
+  if (pwt_encoding != VALUE_ENCODING_FP32 &&
+      pwt_encoding != VALUE_ENCODING_FP16 &&
+      pwt_encoding != VALUE_ENCODING_BF16)
+  {
+    throw std::runtime_error("pwt_encoding should be in fp32|fp16|bf16");
+  }
+
+  if (pwt_row_format != ROW_FORMAT_DENSE && pwt_row_format != ROW_FORMAT_ADAPTIVE) {
+    throw std::runtime_error("pwt_row_format should be in dense|adaptive");
+  }
+
+  if (pwt_row_format == ROW_FORMAT_ADAPTIVE && rows_per_value > 1) {
+    throw std::runtime_error("adaptive pwt_row_format can't be used with rows_per_value > 1");
+  }
+
+  if (nwt_compressed_flush != 0 && nwt_compressed_flush != 1) {
+    throw std::runtime_error("nwt_compressed_flush should be equal to 0 or 1");
+  }
+
+  if (nwt_compressed_flush == 1 &&
+      caching_mode != CACHING_MODE_NWT &&
+      caching_mode != CACHING_MODE_ALL)
+  {
+    throw std::runtime_error("nwt_compressed_flush requires nwt write cache, caching_mode should be in nwt|all");
+  }
+}
+
+std::shared_ptr<TaskPool> ExecutorParameters::create_e_step_pool() const {
+  if (e_step_threads == 1) {
+    return nullptr;
+  }
+  return std::make_shared<TaskPool>(e_step_threads);
+}
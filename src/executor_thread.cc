@@ -16,11 +16,17 @@
 #include "helpers.h"
 #include "processor_helpers.h"
 #include "redis_client.h"
+#include "trace.h"
 
 #include "executor_thread.h"
 
 namespace bf = boost::filesystem;
 
+namespace {
+  // number of n_wt rows requested at once during computation of n_t
+  const int kFindNtChunkSize = 1024;
+}
+
 bool ExecutorThread::check_non_terminated_and_update(const std::string& flag, bool force) {
   if (!force) {
     auto reply = redis_client_->get_value(command_key_);
@@ -34,6 +40,8 @@ bool ExecutorThread::check_non_terminated_and_update(const std::string& flag, bo
 }
 
 bool ExecutorThread::wait_for_flag(const std::string& flag) {
+  TraceSpan span("wait_for_flag", flag_name(flag));
+  ScopedLatency latency(&metrics_.histogram("executor.barrier_wait_us"));
   while (true) {
     auto reply = redis_client_->get_value(command_key_);
     if (reply == START_TERMINATION) {
@@ -51,26 +59,31 @@ bool ExecutorThread::wait_for_flag(const std::string& flag) {
 
 Normalizers ExecutorThread::find_nt() {
   LOG(INFO) << "Executor thread " << command_key_ << ": start find_nt";
+  TraceSpan span("find_nt");
+  ScopedLatency latency(&metrics_.histogram("executor.find_nt_us"));
 
-  Normalizers retval;
-  std::vector<float> helper = std::vector<float>(n_wt_->topic_size(), 0.0f);
-  for (int token_id = 0; token_id < n_wt_->token_size(); ++token_id) {
-    if (token_id < token_begin_index_ || token_id >= token_end_index_) {
-      continue;
-    }
-
-    const Token& token = n_wt_->token(token_id);
-    auto normalizer_key = token.class_id;
+  const int num_topics = n_wt_->topic_size();
+  const int token_end_index = std::min(token_end_index_, n_wt_->token_size());
 
-    auto iter = retval.find(normalizer_key);
-    if (iter == retval.end()) {
-      retval.insert(std::make_pair(normalizer_key, std::vector<double>(n_wt_->topic_size(), 0)));
-      iter = retval.find(normalizer_key);
-    }
+  Normalizers retval;
+  std::vector<float> helper;
+  for (int chunk_begin = token_begin_index_; chunk_begin < token_end_index; chunk_begin += kFindNtChunkSize) {
+    const int chunk_end = std::min(chunk_begin + kFindNtChunkSize, token_end_index);
+    n_wt_->get_range(chunk_begin, chunk_end, &helper);
+
+    for (int token_id = chunk_begin; token_id < chunk_end; ++token_id) {
+      const ClassId& normalizer_key = n_wt_->class_id(token_id);
+
+      auto iter = retval.find(normalizer_key);
+      if (iter == retval.end()) {
+        retval.insert(std::make_pair(normalizer_key, std::vector<double>(num_topics, 0)));
+        iter = retval.find(normalizer_key);
+      }
 
-    n_wt_->get(token_id, &helper);
-    for (int topic_id = 0; topic_id < n_wt_->topic_size(); ++topic_id) {
-      iter->second[topic_id] += helper[topic_id];
+      const float* values = &helper[(token_id - chunk_begin) * num_topics];
+      for (int topic_id = 0; topic_id < num_topics; ++topic_id) {
+        iter->second[topic_id] += values[topic_id];
+      }
     }
   }
   LOG(INFO) << "Executor thread " << command_key_ << ": finish find_nt";
@@ -78,6 +91,7 @@ Normalizers ExecutorThread::find_nt() {
 }
 
 bool ExecutorThread::normalize_nwt() {
+  TraceSpan span("normalize_nwt");
   if(!wait_for_flag(START_NORMALIZATION)) {
     return false;
   }
@@ -90,6 +104,8 @@ bool ExecutorThread::normalize_nwt() {
 
   if (n_wt_->cache_mode() == PhiMatrixCacheMode::WRITE) {
     LOG(INFO) << "Executor thread " << command_key_ << ": dump executor nwt cache";
+    TraceSpan span("dump_write_cache");
+    ScopedLatency latency(&metrics_.histogram("executor.flush_us"));
     n_wt_->dump_write_cache(token_begin_index_, token_end_index_);
   }
 
@@ -122,32 +138,36 @@ bool ExecutorThread::normalize_nwt() {
 
   n_t = redis_client_->get_hashmap(data_key_, num_topics);
 
-  for (int token_id = 0; token_id < num_tokens; ++token_id) {
-    if (token_id < token_begin_index_ || token_id >= token_end_index_) {
-      continue;
-    }
+  {
+    ScopedLatency latency(&metrics_.histogram("executor.normalize_us"));
+    for (int token_id = 0; token_id < num_tokens; ++token_id) {
+      if (token_id < token_begin_index_ || token_id >= token_end_index_) {
+        continue;
+      }
 
-    const Token& token = n_wt_->token(token_id);
-    assert(p_wt_->token(token_id) == token);
-    const std::vector<double>& n_t_for_class_id = n_t[token.class_id];
+      const std::vector<double>& n_t_for_class_id = n_t[n_wt_->class_id(token_id)];
 
-    std::vector<float> helper = std::vector<float>(num_topics, 0.0f);
-    std::vector<float> helper_n_wt = std::vector<float>(num_topics, 0.0f);
+      std::vector<float> helper = std::vector<float>(num_topics, 0.0f);
+      std::vector<float> helper_n_wt = std::vector<float>(num_topics, 0.0f);
 
-    n_wt_->get_set(token_id, &helper_n_wt, zeros);
-    for (int topic_index = 0; topic_index < num_topics; ++topic_index) {
-      float value = 0.0f;
-      if (n_t_for_class_id[topic_index] > 0) {
-        value = std::max<double>(helper_n_wt[topic_index], 0.0) / n_t_for_class_id[topic_index];
-        if (value < kEps) {
-          value = 0.0f;
+      n_wt_->get_set(token_id, &helper_n_wt, zeros);
+      for (int topic_index = 0; topic_index < num_topics; ++topic_index) {
+        float value = 0.0f;
+        if (n_t_for_class_id[topic_index] > 0) {
+          value = std::max<double>(helper_n_wt[topic_index], 0.0) / n_t_for_class_id[topic_index];
+          if (value < kEps) {
+            value = 0.0f;
+          }
         }
+        helper[topic_index] = value;
       }
-      helper[topic_index] = value;
+      p_wt_->set(token_id, helper);
     }
-    p_wt_->set(token_id, helper);
   }
 
+  // master reads metrics of all threads after the last FINISH_NORMALIZATION
+  publish_metrics();
+
   if (!check_non_terminated_and_update(FINISH_NORMALIZATION)) {
     return false;
   }
@@ -156,22 +176,47 @@ bool ExecutorThread::normalize_nwt() {
   return true;
 }
 
-void ExecutorThread::process_e_step(const artm::Batch& batch, Blas* blas, double* perplexity_value) {
-  std::shared_ptr<CsrMatrix<float>> sparse_ndw;
-  sparse_ndw = ProcessorHelpers::initialize_sparse_ndw(batch);
+void ExecutorThread::publish_metrics() {
+  metrics_.gauge("executor.maxrss_kb").set(Helpers::get_peak_memory_kb());
+
+  const std::string data = MetricsRegistry::serialize(metrics_.snapshot());
+  metrics_.reset();
+  redis_client_->set_raw_value(metrics_key_, data);
+}
 
-  std::shared_ptr<LocalThetaMatrix<float>> theta_matrix;
-  theta_matrix = ProcessorHelpers::initialize_theta(p_wt_->topic_size(), batch);
+const ExecutorThread::BatchData& ExecutorThread::get_batch_data(const std::string& batch_name,
+                                                                const artm::Batch& batch) {
+  auto iter = batches_.find(batch_name);
+  if (iter == batches_.end()) {
+    auto batch_data = std::make_shared<BatchData>();
+    ProcessorHelpers::find_batch_token_ids(batch, *p_wt_->token_collection(), &batch_data->token_ids);
+    ProcessorHelpers::initialize_sparse_ndw(batch, &batch_data->n_dw);
+    // large batches are transposed by the threads of the pool on the first iteration
+    ProcessorHelpers::transpose_sparse_ndw(batch_data->n_dw, &batch_data->n_wd, &e_step_workspace_, e_step_pool_.get());
+    iter = batches_.emplace(batch_name, batch_data).first;
+  }
+  return *iter->second;
+}
 
-  std::shared_ptr<NwtWriteAdapter> nwt_writer = std::make_shared<NwtWriteAdapter>(n_wt_);
+void ExecutorThread::process_e_step(const std::string& batch_name, const artm::Batch& batch,
+                                    double* perplexity_value) {
+  const BatchData& batch_data = get_batch_data(batch_name, batch);
+  ProcessorHelpers::initialize_theta(p_wt_->topic_size(), batch, &e_step_workspace_.theta);
 
-  ProcessorHelpers::infer_theta_and_update_nwt_sparse(batch, *sparse_ndw, *p_wt_, theta_matrix.get(),
-                                                      nwt_writer.get(), blas, num_inner_iters_, perplexity_value);
+  NwtWriteAdapter nwt_writer(n_wt_);
+  ProcessorHelpers::infer_theta_and_update_nwt_sparse(batch, batch_data.n_dw, &batch_data.n_wd, batch_data.token_ids,
+                                                      *p_wt_, &e_step_workspace_.theta, &nwt_writer,
+                                                      num_inner_iters_, perplexity_value, &e_step_workspace_,
+                                                      e_step_pool_.get());
 }
 
 void ExecutorThread::thread_function() {
   LOG(INFO) << "Executor thread " << command_key_ << ": has started";
 
+  // redis commands of the thread are counted in its own registry
+  MetricsRegistry::set_current(&metrics_);
+  Tracer::set_thread_name(command_key_);
+
   try {
     LOG(INFO) << "Executor thread " << command_key_ << ": start connecting to master";
 
@@ -221,7 +266,6 @@ void ExecutorThread::thread_function() {
       LOG(INFO) << "Executor thread " << command_key_ << ": finish normalization";
     }
 
-    Blas* blas = Blas::builtin();
     while (true) {
       LOG(INFO) << "Executor thread " << command_key_ << ": start new iteration";
 
@@ -240,8 +284,16 @@ void ExecutorThread::thread_function() {
           const std::string batch_name = entry.path().string();
           LOG(INFO) << "Executor thread " << command_key_ << ": start processing batch " << batch_name;
 
-          Helpers::load_batch(batch_name, &batch);
-          process_e_step(batch, blas, &perplexity_value);
+          {
+            TraceSpan span("load_batch");
+            ScopedLatency latency(&metrics_.histogram("executor.load_batch_us"));
+            Helpers::load_batch(batch_name, &batch);
+          }
+          {
+            TraceSpan span("process_e_step");
+            ScopedLatency latency(&metrics_.histogram("executor.e_step_us"));
+            process_e_step(batch_name, batch, &perplexity_value);
+          }
 
           LOG(INFO) << "Executor thread " << command_key_ << ": finish processing batch " << batch_name;
         }
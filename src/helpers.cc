@@ -1,8 +1,10 @@
+#include <cmath>
 #include <cstdlib>
 
 #include <sys/time.h>
 #include <sys/resource.h>
 
+#include <algorithm>
 #include <fstream>  // NOLINT
 #include <sstream>
 
@@ -27,6 +29,18 @@ long Helpers::get_peak_memory_kb() {
   return 0;
 }
 
+std::vector<std::pair<int, int>> Helpers::split_indices(int num_parts, int begin_index, int end_index) {
+  int step = std::ceil((end_index - begin_index) / static_cast<double>(num_parts));
+
+  std::vector<std::pair<int, int>> retval;
+  for (int part_id = 0; part_id < num_parts; ++part_id) {
+    retval.push_back(std::make_pair(begin_index + step * part_id,
+                                    std::min(begin_index + step * (part_id + 1), end_index)));
+  }
+
+  return retval;
+}
+
 std::vector<float> Helpers::generate_random_vector(int size, size_t seed) {
   std::vector<float> retval;
   retval.reserve(size);
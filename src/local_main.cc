@@ -0,0 +1,219 @@
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <vector>
+#include <string>
+#include <utility>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include "glog/logging.h"
+
+#include "executor_parameters.h"
+#include "executor_thread.h"
+#include "helpers.h"
+#include "master.h"
+#include "mock_redis.h"
+#include "protocol.h"
+#include "redis_client.h"
+#include "redis_phi_matrix.h"
+#include "task_pool.h"
+#include "token.h"
+#include "trace.h"
+#include "vocab_loader.h"
+
+namespace bf = boost::filesystem;
+namespace po = boost::program_options;
+
+// Master and one executor run in this process and exchange all data via MockRedis,
+// so compute hot spots can be profiled without network noise and slow networks can be simulated.
+// Options of executors are the ones of ExecutorParameters, phi is always stored in (mock) redis.
+
+struct Parameters : ExecutorParameters {
+  int num_outer_iters;
+  int redis_latency_us;
+  double redis_bandwidth;
+  std::string trace_file;
+};
+
+void log_parameters(const Parameters& parameters) {
+  LOG(INFO) << parameters.to_string()
+            << "num-outer-iter: "       << parameters.num_outer_iters      << "; "
+            << "redis-latency-us: "     << parameters.redis_latency_us     << "; "
+            << "redis-bandwidth: "      << parameters.redis_bandwidth      << "; "
+            << "trace-file: "           << parameters.trace_file;
+}
+
+void check_parameters(const Parameters& parameters) {
+  parameters.check();
+
+  if (parameters.num_outer_iters <= 0) {
+    throw std::runtime_error("num_outer_iters should be a positive integer");
+  }
+
+  if (parameters.redis_latency_us < 0) {
+    throw std::runtime_error("redis_latency_us should be a non-negative integer");
+  }
+
+  if (parameters.redis_bandwidth < 0.0) {
+    throw std::runtime_error("redis_bandwidth should be non-negative");
+  }
+}
+
+bool parse_and_print_parameters(int argc, char* argv[], Parameters* parameters) {
+  po::options_description all_options("Options");
+  all_options.add_options()
+    ("help", "Show help")
+    ;
+  parameters->add_options(&all_options);
+  all_options.add_options()
+    ("num-outer-iter",       po::value(&parameters->num_outer_iters)->default_value(1),       "Number of collection passes")  // NOLINT
+    ("redis-latency-us",     po::value(&parameters->redis_latency_us)->default_value(0),      "Injected latency of each redis command, microseconds")  // NOLINT
+    ("redis-bandwidth",      po::value(&parameters->redis_bandwidth)->default_value(0.0),     "Injected bandwidth of redis, MB/s, 0 - unlimited")  // NOLINT
+    ("trace-file",           po::value(&parameters->trace_file)->default_value(""),           "Path to Chrome trace of the process, empty - no tracing")  // NOLINT
+    ;
+
+  po::variables_map variables_map;
+  store(po::command_line_parser(argc, argv).options(all_options).run(), variables_map);
+  notify(variables_map);
+
+  bool show_help = (variables_map.count("help") > 0);
+  if (show_help) {
+    std::cerr << all_options;
+    return true;
+  }
+
+  return false;
+}
+
+int main(int argc, char* argv[]) {
+  Parameters parameters;
+  bool is_help_call = parse_and_print_parameters(argc, argv, &parameters);
+  if (is_help_call) {
+    return 0;
+  }
+
+  FLAGS_minloglevel = 0;
+  FLAGS_log_dir = ".";
+
+  std::string log_file = std::string("cluster-bigartm-local");
+  google::InitGoogleLogging(log_file.c_str());
+  log_parameters(parameters);
+  check_parameters(parameters);
+
+  auto redis_client = std::make_shared<RedisClient>(
+      std::make_shared<MockRedis>(parameters.redis_latency_us, parameters.redis_bandwidth));
+
+  if (!parameters.trace_file.empty()) {
+    Tracer::enable(1 << 16);
+    Tracer::synchronize(*redis_client);
+    Tracer::set_thread_name("master");
+  }
+
+  std::vector<std::string> command_keys = generate_command_keys(0, parameters.num_threads);
+  std::vector<std::string> data_keys = generate_data_keys(0, parameters.num_threads);
+  std::vector<std::string> metrics_keys = generate_metrics_keys(0, parameters.num_threads);
+
+  // master reads flags of threads right away, they should exist before threads have started
+  for (const auto& key : command_keys) {
+    redis_client->set_value(key, START_GLOBAL_START);
+  }
+
+  std::vector<std::shared_ptr<ExecutorThread>> threads;
+  try {
+    std::vector<std::string> topics;
+    for (int i = 0; i < parameters.num_topics; ++i) {
+      topics.push_back("topic_" + std::to_string(i));
+    }
+
+    PhiMatrixCacheMode pwt_mode = PhiMatrixCacheMode::NONE;
+    PhiMatrixCacheMode nwt_mode = PhiMatrixCacheMode::NONE;
+
+    if (parameters.caching_mode == CACHING_MODE_PWT) {
+      pwt_mode = PhiMatrixCacheMode::READ;
+    } else if (parameters.caching_mode == CACHING_MODE_NWT) {
+      nwt_mode = PhiMatrixCacheMode::WRITE;
+    } else if (parameters.caching_mode == CACHING_MODE_ALL) {
+      pwt_mode = PhiMatrixCacheMode::READ;
+      nwt_mode = PhiMatrixCacheMode::WRITE;
+    }
+
+    std::shared_ptr<const TokenCollection> vocab = VocabLoader::load(parameters.vocab_path, parameters.num_threads);
+
+    RedisKeyLayout key_layout(RedisKeyLayout::parse_mode(parameters.key_layout),
+                              parameters.key_block_size,
+                              vocab->token_size(),
+                              parameters.rows_per_value);
+
+    // n_wt is accumulated in float32
+    auto p_wt_store = std::make_shared<RedisPhiStore>(ModelName("pwt"), topics.size(), key_layout,
+                                                      ValueEncoder::parse(parameters.pwt_encoding),
+                                                      RowCodec::parse_format(parameters.pwt_row_format));
+    auto n_wt_store = std::make_shared<RedisPhiStore>(ModelName("nwt"), topics.size(), key_layout,
+                                                      ValueEncoding::FLOAT32, RowFormat::DENSE,
+                                                      parameters.nwt_compressed_flush == 1);
+
+    auto p_wt = std::make_shared<RedisPhiMatrix>(ModelName("pwt"), topics, vocab, pwt_mode, p_wt_store);
+    auto n_wt = std::make_shared<RedisPhiMatrix>(ModelName("nwt"), topics, vocab, nwt_mode, n_wt_store);
+
+    auto zero_vector = std::vector<float>(p_wt->topic_size(), 0.0f);
+    for (int token_id = 0; token_id < vocab->token_size(); ++token_id) {
+      p_wt->set(redis_client, token_id, zero_vector);
+      n_wt->set(redis_client, token_id, Helpers::generate_random_vector(n_wt->topic_size(), vocab->token(token_id)));
+    }
+
+    auto p_wt_adapter = std::make_shared<RedisPhiMatrixAdapter>(p_wt, redis_client);
+    auto n_wt_adapter = std::make_shared<RedisPhiMatrixAdapter>(n_wt, redis_client);
+
+    // threads count batches the same way, by their position in the directory
+    const int num_batches = std::distance(bf::directory_iterator(parameters.batches_dir_path),
+                                          bf::directory_iterator());
+
+    LOG(INFO) << "Local: " << vocab->token_size() << " tokens, " << num_batches << " batches";
+    std::cout << "Local: " << vocab->token_size() << " tokens, " << num_batches << " batches" << std::endl;
+
+    std::vector<std::pair<int, int>> token_indices = Helpers::split_indices(parameters.num_threads, 0,
+                                                                            vocab->token_size());
+    std::vector<std::pair<int, int>> batch_indices = Helpers::split_indices(parameters.num_threads, 0, num_batches);
+    std::shared_ptr<TaskPool> e_step_pool = parameters.create_e_step_pool();
+
+    for (int thread_id = 0; thread_id < parameters.num_threads; ++thread_id) {
+      threads.push_back(std::shared_ptr<ExecutorThread>(
+        new ExecutorThread(command_keys[thread_id],
+                           data_keys[thread_id],
+                           metrics_keys[thread_id],
+                           redis_client,
+                           false,
+                           parameters.batches_dir_path,
+                           token_indices[thread_id].first,
+                           token_indices[thread_id].second,
+                           batch_indices[thread_id].first,
+                           batch_indices[thread_id].second,
+                           parameters.num_inner_iters,
+                           p_wt_adapter,
+                           n_wt_adapter,
+                           e_step_pool)
+      ));
+    }
+
+    Master master(redis_client, command_keys, data_keys, metrics_keys, parameters.num_topics);
+    master.fit(parameters.num_outer_iters, false, 5000000);
+
+    // threads confirm termination when they are destroyed, so master doesn't wait for them
+    threads.clear();
+  } catch (const std::exception& error) {
+    LOG(FATAL) << "Error in local fitting: " << error.what();
+  }
+
+  LOG(INFO) << "Model fitting is finished!";
+  std::cout << "Model fitting is finished!" << std::endl;
+
+  LOG(INFO) << "Final maxrss= " << Helpers::get_peak_memory_kb() << " KB";
+
+  if (!parameters.trace_file.empty()) {
+    Tracer::write(parameters.trace_file, 0, "local", *redis_client);
+  }
+
+  return 0;
+}
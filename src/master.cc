@@ -0,0 +1,290 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+#include "glog/logging.h"
+
+#include "helpers.h"
+#include "master.h"
+#include "metrics.h"
+#include "protocol.h"
+#include "trace.h"
+
+volatile sig_atomic_t Master::interrupted_ = 0;
+
+void Master::fit(int num_outer_iters, bool continue_fitting, int start_timeout) {
+  try {
+    LOG(INFO) << "Master: start connecting to processors";
+    std::cout << "Master: start connecting to processors" << std::endl;
+
+    bool ok = check_finished_or_terminated(START_GLOBAL_START, FINISH_GLOBAL_START, start_timeout);
+    if (!ok) { throw std::runtime_error("Master: step 0, got termination status"); }
+
+    LOG(INFO) << "Master: finish connecting to processors";
+    std::cout << "Master: finish connecting to processors" << std::endl;
+
+    LOG(INFO) << "Master: start preparation";
+    std::cout << "Master: start preparation" << std::endl;
+
+    ok = check_non_terminated_and_update(START_PREPARATION);
+    if (!ok) { throw std::runtime_error("Master: step 1 start, got termination status"); }
+
+    ok = check_finished_or_terminated(START_PREPARATION, FINISH_PREPARATION);
+    if (!ok) { throw std::runtime_error("Master: step 1 finish, got termination status"); }
+
+    LOG(INFO) << "Master: finish preparation";
+    std::cout << "Master: finish preparation" << std::endl;
+
+    double n = 0.0;
+    for (const auto& key : data_keys_) {
+      n += std::stod(redis_client_->get_value(key));
+    }
+
+    LOG(INFO) << "Master: all executors have started! Total number of token slots in collection: " << n;
+    std::cout << "Master: all executors have started! Total number of token slots in collection: " << n << std::endl;
+
+    if (!continue_fitting) {
+      if (!normalize_nwt()) {
+        throw std::runtime_error("Step 2, got termination status");
+      }
+    }
+
+    // metrics of preparation and initial normalization are not reported
+    MetricsRegistry::global().reset();
+
+    // EM-iterations
+    for (int iteration = 0; iteration < num_outer_iters; ++iteration) {
+      LOG(INFO) << "Master: start iteration " << iteration;
+      std::cout << "Master: start iteration " << iteration << std::endl;
+
+      {
+        ScopedLatency latency(&MetricsRegistry::global().histogram("master.e_step_us"));
+
+        ok = check_non_terminated_and_update(START_ITERATION);
+        if (!ok) { throw std::runtime_error("Step 3 start, got termination status"); }
+
+        ok = check_finished_or_terminated(START_ITERATION, FINISH_ITERATION);
+        if (!ok) { throw std::runtime_error("Step 3 intermediate, got termination status"); }
+      }
+
+      double perplexity_value = 0.0;
+      for (const auto& key : data_keys_) {
+        perplexity_value += std::stod(redis_client_->get_value(key));
+      }
+
+      LOG(INFO) << "Master: finish e-step, start m-step";
+      std::cout << "Master: finish e-step, start m-step" << std::endl;
+
+      {
+        ScopedLatency latency(&MetricsRegistry::global().histogram("master.m_step_us"));
+        if (!normalize_nwt()) {
+          throw std::runtime_error("Step 3 finish, got termination status");
+        }
+      }
+
+      perplexity_value = exp(-(1.0f / n) * perplexity_value);
+
+      LOG(INFO) << "Iteration: " << iteration << ", perplexity: " << perplexity_value;
+      std::cout << "Iteration: " << iteration << ", perplexity: " << perplexity_value << std::endl;
+
+      LOG(INFO) << "Iteration: " << iteration << ", maxrss: " << Helpers::get_peak_memory_kb() << " KB";
+
+      print_iteration_metrics(iteration);
+    }
+
+    // finalization (correct in any way)
+    for (const auto& key : command_keys_) {
+      redis_client_->set_value(key, START_TERMINATION);
+    }
+
+  } catch (...) {
+    for (const auto& key : command_keys_) {
+      redis_client_->set_value(key, START_TERMINATION);
+    }
+    throw;
+  }
+}
+
+void Master::wait_for_termination() {
+  check_finished_or_terminated(START_TERMINATION, FINISH_TERMINATION);
+}
+
+bool Master::check_finished_or_terminated(const std::string& old_flag, const std::string& new_flag, int timeout) {
+  TraceSpan span("check_finished_or_terminated", flag_name(new_flag));
+  int time_passed = 0;
+  bool terminated = false;
+  while (true) {
+    if (interrupted_) {
+      LOG(ERROR) << "SIGINT has been caught, start terminating" << std::endl;
+      return false;
+    }
+
+    int executors_finished = 0;
+    for (const auto& key : command_keys_) {
+      auto reply = redis_client_->get_value(key);
+      if (reply == old_flag) {
+        break;
+      }
+
+      if (reply == new_flag) {
+        ++executors_finished;
+        continue;
+      }
+
+      if (reply == FINISH_TERMINATION) {
+        terminated = true;
+        break;
+      }
+    }
+
+    if (executors_finished == command_keys_.size()) {
+      return true;
+    }
+
+    if ((timeout > 0 && time_passed > timeout) || terminated) {
+      break;
+    }
+
+    usleep(2000);
+    time_passed += 2000;
+  }
+  return false;
+}
+
+// this function firstly check the availability of executor and then send him new command,
+// it's not fully safe, as if the executor fails in between get and set, it will cause
+// endless loop during the next syncronozation
+bool Master::check_non_terminated_and_update(const std::string& flag) {
+  if (interrupted_) {
+    LOG(ERROR) << "SIGINT has been caught, start terminating" << std::endl;
+    return false;
+  }
+
+  for (const auto& key : command_keys_) {
+    auto reply = redis_client_->get_value(key);
+    if (reply == FINISH_TERMINATION) {
+      return false;
+    }
+  }
+
+  for (const auto& key : command_keys_) {
+    redis_client_->set_value(key, flag);
+  }
+
+  return true;
+}
+
+// protocol:
+// 1) set everyone START_NORMALIZATION flag
+// 2) wait for everyone to set FINISH_NORMALIZATION flag (executors should dump cached nwt updates if they used cache)
+// 3) set everyone START_NORMALIZATION flag
+// 4) wait for everyone to set FINISH_NORMALIZATION flag
+// 5) read results from data slots
+// 6) merge results and put final n_t into data slots
+// 7) set everyone START_NORMALIZATION flag
+// 8) wait for everyone to set FINISH_NORMALIZATION flag
+bool Master::normalize_nwt() {
+  TraceSpan span("normalize_nwt");
+  if (!check_non_terminated_and_update(START_NORMALIZATION)) {
+    return false;
+  }
+
+  if (!check_finished_or_terminated(START_NORMALIZATION, FINISH_NORMALIZATION)) {
+    return false;
+  }
+
+  if (!check_non_terminated_and_update(START_NORMALIZATION)) {
+    return false;
+  }
+
+  if (!check_finished_or_terminated(START_NORMALIZATION, FINISH_NORMALIZATION)) {
+    return false;
+  }
+
+  Normalizers n_t;
+  Normalizers helper;
+  for (const auto& key : data_keys_) {
+    helper = redis_client_->get_hashmap(key, num_topics_);
+    for (const auto& kv : helper) {
+      auto iter = n_t.find(kv.first);
+      if (iter == n_t.end()) {
+        n_t.emplace(kv);
+      } else {
+        for (int i = 0; i < kv.second.size(); ++i) {
+          iter->second[i] += kv.second[i];
+        }
+      }
+    }
+    helper.clear();
+  }
+
+  // ToDo(MelLain): maybe it'll be better to keep only one version of n_t for
+  //                all executors, need to be checked with large number of topics
+  for (const auto& key : data_keys_) {
+    redis_client_->set_hashmap(key, n_t);
+  }
+
+  if (!check_non_terminated_and_update(START_NORMALIZATION)) {
+    return false;
+  }
+
+  if (!check_finished_or_terminated(START_NORMALIZATION, FINISH_NORMALIZATION)) {
+    return false;
+  }
+
+  return true;
+}
+
+// merges metrics published by executor threads during the iteration with the metrics of master
+// and prints them: count and total are summed over threads, max_thread is the largest total of one
+// thread (the straggler), max and p99 are the largest values of threads; redis commands of master
+// (mostly polling of flags, they grow with wall time) are reported as master.redis.*, so redis.*
+// is the traffic of executors only
+void Master::print_iteration_metrics(int iteration) {
+  struct AggregatedMetric {
+    int64_t count;
+    double total;
+    double max_thread;
+    double max;
+    double p99;
+  };
+
+  std::map<std::string, AggregatedMetric> aggregated;
+  auto merge = [&aggregated](const std::vector<MetricSnapshot>& metrics, const std::string& redis_prefix) {
+    for (const auto& metric : metrics) {
+      const std::string name = metric.name.compare(0, 6, "redis.") == 0 ? redis_prefix + metric.name : metric.name;
+      auto iter = aggregated.find(name);
+      if (iter == aggregated.end()) {
+        aggregated.emplace(name, AggregatedMetric({ metric.count, metric.sum, metric.sum,
+                                                    metric.max, metric.p99 }));
+      } else {
+        iter->second.count += metric.count;
+        iter->second.total += metric.sum;
+        iter->second.max_thread = std::max(iter->second.max_thread, metric.sum);
+        iter->second.max = std::max(iter->second.max, metric.max);
+        iter->second.p99 = std::max(iter->second.p99, metric.p99);
+      }
+    }
+  };
+
+  for (const auto& key : metrics_keys_) {
+    merge(MetricsRegistry::parse(redis_client_->get_raw_value(key)), "");
+  }
+  merge(MetricsRegistry::global().snapshot(), "master.");
+  MetricsRegistry::global().reset();
+
+  for (const auto& kv : aggregated) {
+    std::stringstream stream;
+    stream << "Iteration: " << iteration << ", " << kv.first << ": count= " << kv.second.count
+           << ", total= " << kv.second.total << ", max_thread= " << kv.second.max_thread
+           << ", max= " << kv.second.max << ", p99= " << kv.second.p99;
+
+    LOG(INFO) << stream.str();
+    std::cout << stream.str() << std::endl;
+  }
+}
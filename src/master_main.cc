@@ -2,6 +2,7 @@
 #include <unistd.h>
 #include <signal.h>
 
+#include <algorithm>
 #include <iterator>
 #include <memory>
 #include <string>
@@ -18,15 +19,17 @@
 #include "protocol.h"
 #include "redis_client.h"
 #include "redis_phi_matrix.h"
+#include "shm_phi_store.h"
 #include "token.h"
+#include "trace.h"
 #include "helpers.h"
+#include "master.h"
+#include "vocab_loader.h"
 
 namespace po = boost::program_options;
 
-volatile sig_atomic_t signal_flag = 0;
-
 void signal_handler(int sig) {
-  signal_flag = 1;
+  Master::interrupt();
 }
 
 struct Parameters {
@@ -40,6 +43,14 @@ struct Parameters {
   std::string redis_port;
   int show_top_tokens;
   int continue_fitting;
+  std::string key_layout;
+  int key_block_size;
+  int rows_per_value;
+  std::string pwt_encoding;
+  std::string pwt_row_format;
+  std::string phi_store;
+  std::string shm_name;
+  std::string trace_file;
 };
 
 void log_parameters(const Parameters& parameters) {
@@ -52,7 +63,15 @@ void log_parameters(const Parameters& parameters) {
             << "redis-ip: "             << parameters.redis_ip         << "; "
             << "redis-port: "           << parameters.redis_port       << "; "
             << "show-top-tokens: "      << parameters.show_top_tokens  << "; "
-            << "continue-fitting: "     << parameters.continue_fitting;
+            << "continue-fitting: "     << parameters.continue_fitting << "; "
+            << "key-layout: "           << parameters.key_layout       << "; "
+            << "key-block-size: "       << parameters.key_block_size   << "; "
+            << "rows-per-value: "       << parameters.rows_per_value   << "; "
+            << "pwt-encoding: "         << parameters.pwt_encoding     << "; "
+            << "pwt-row-format: "       << parameters.pwt_row_format   << "; "
+            << "phi-store: "            << parameters.phi_store        << "; "
+            << "shm-name: "             << parameters.shm_name         << "; "
+            << "trace-file: "           << parameters.trace_file;
 }
 
 void check_parameters(const Parameters& parameters) {
@@ -95,6 +114,43 @@ void check_parameters(const Parameters& parameters) {
   if (parameters.show_top_tokens != 0 && parameters.show_top_tokens != 1) {
     throw std::runtime_error("show_top_tokens should be equal to 0 or 1");
   }
+
+  if (parameters.key_layout != KEY_LAYOUT_TEXT &&
+      parameters.key_layout != KEY_LAYOUT_BLOCK &&
+      parameters.key_layout != KEY_LAYOUT_SLOT)
+  {
+    throw std::runtime_error("key_layout should be in text|block|slot");
+  }
+
+  if (parameters.key_block_size <= 0) {
+    throw std::runtime_error("key_block_size should be a positive integer");
+  }
+
+  if (parameters.rows_per_value <= 0) {
+    throw std::runtime_error("rows_per_value should be a positive integer");
+  }
+
+  if (parameters.pwt_encoding != VALUE_ENCODING_FP32 &&
+      parameters.pwt_encoding != VALUE_ENCODING_FP16 &&
+      parameters.pwt_encoding != VALUE_ENCODING_BF16)
+  {
+    throw std::runtime_error("pwt_encoding should be in fp32|fp16|bf16");
+  }
+
+  if (parameters.pwt_row_format != ROW_FORMAT_DENSE && parameters.pwt_row_format != ROW_FORMAT_ADAPTIVE) {
+    throw std::runtime_error("pwt_row_format should be in dense|adaptive");
+  }
+
+  if (parameters.pwt_row_format == ROW_FORMAT_ADAPTIVE && parameters.rows_per_value > 1) {
+    throw std::runtime_error("adaptive pwt_row_format can't be used with rows_per_value > 1");
+  }
+
+  if (parameters.phi_store != PHI_STORE_REDIS &&
+      parameters.phi_store != PHI_STORE_SHM &&
+      parameters.phi_store != PHI_STORE_PARTITIONED)
+  {
+    throw std::runtime_error("phi_store should be in redis|shm|partitioned");
+  }
 }
 
 bool parse_and_print_parameters(int argc, char* argv[], Parameters* parameters) {
@@ -111,6 +167,14 @@ bool parse_and_print_parameters(int argc, char* argv[], Parameters* parameters)
     ("redis-port",           po::value(&parameters->redis_port)->default_value(""),          "Port of redis instance")  // NOLINT
     ("show-top-tokens",      po::value(&parameters->show_top_tokens)->default_value(0),      "1 - print top tokens, 0 - not")  // NOLINT
     ("continue-fitting",     po::value(&parameters->continue_fitting)->default_value(0),     "1 - continue fitting redis model, 0 - restart")  // NOLINT
+    ("key-layout",           po::value(&parameters->key_layout)->default_value("text"),      "Layout of redis keys: text|block|slot")  // NOLINT
+    ("key-block-size",       po::value(&parameters->key_block_size)->default_value(1),       "Number of tokens sharing slot in block layout")  // NOLINT
+    ("rows-per-value",       po::value(&parameters->rows_per_value)->default_value(1),       "Number of token rows packed into redis value")  // NOLINT
+    ("pwt-encoding",         po::value(&parameters->pwt_encoding)->default_value("fp32"),    "Encoding of p_wt values: fp32|fp16|bf16")  // NOLINT
+    ("pwt-row-format",       po::value(&parameters->pwt_row_format)->default_value("dense"), "Format of p_wt rows: dense|adaptive")  // NOLINT
+    ("phi-store",            po::value(&parameters->phi_store)->default_value("redis"),      "Storage of phi matrices: redis|shm|partitioned")  // NOLINT
+    ("shm-name",             po::value(&parameters->shm_name)->default_value("cluster-bigartm"), "Prefix of shared memory segments of phi")  // NOLINT
+    ("trace-file",           po::value(&parameters->trace_file)->default_value(""),          "Path to Chrome trace of master, empty - no tracing")  // NOLINT
     ;
 
   po::variables_map variables_map;
@@ -133,169 +197,46 @@ bool parse_and_print_parameters(int argc, char* argv[], Parameters* parameters)
   std::cout << "redis-port:           " << parameters->redis_port           << std::endl;
   std::cout << "show-top-tokens:      " << parameters->show_top_tokens      << std::endl;
   std::cout << "continue-fitting:     " << parameters->continue_fitting     << std::endl;
+  std::cout << "key-layout:           " << parameters->key_layout           << std::endl;
+  std::cout << "key-block-size:       " << parameters->key_block_size       << std::endl;
+  std::cout << "rows-per-value:       " << parameters->rows_per_value       << std::endl;
+  std::cout << "pwt-encoding:         " << parameters->pwt_encoding         << std::endl;
+  std::cout << "pwt-row-format:       " << parameters->pwt_row_format       << std::endl;
+  std::cout << "phi-store:            " << parameters->phi_store            << std::endl;
+  std::cout << "shm-name:             " << parameters->shm_name             << std::endl;
+  std::cout << "trace-file:           " << parameters->trace_file           << std::endl;
 
   return false;
 }
 
-bool check_finished_or_terminated(std::shared_ptr<RedisClient> redis_client,
-                                  const std::vector<std::string>& command_keys,
-                                  const std::string& old_flag,
-                                  const std::string& new_flag,
-                                  int timeout = -1)
-{
-  int time_passed = 0;
-  bool terminated = false;
-  while (true) {
-    if (signal_flag) {
-      LOG(ERROR) << "SIGINT has been caught, start terminating" << std::endl;
-      return false;
-    }
-
-    int executors_finished = 0;
-    for (const auto& key : command_keys) {
-      auto reply = redis_client->get_value(key);
-      if (reply == old_flag) {
-        break;
-      }
-
-      if (reply == new_flag) {
-        ++executors_finished;
-        continue;
-      }
-
-      if (reply == FINISH_TERMINATION) {
-        terminated = true;
-        break;
-      }
-    }
-
-    if (executors_finished == command_keys.size()) {
-      return true;
-    }
-
-    if ((timeout > 0 && time_passed > timeout) || terminated) {
-      break;
-    }
-
-    usleep(2000);
-    time_passed += 2000;
-  }
-  return false;
-}
-
-// this function firstly check the availability of executor and then send him new command,
-// it's not fully safe, as if the executor fails in between get and set, it will cause
-// endless loop during the next syncronozation
-bool check_non_terminated_and_update(std::shared_ptr<RedisClient> redis_client,
-                                     const std::vector<std::string>& command_keys,
-                                     const std::string& flag)
-{
-  if (signal_flag) {
-    LOG(ERROR) << "SIGINT has been caught, start terminating" << std::endl;
-    return false;
-  }
-
-  for (const auto& key : command_keys) {
-    auto reply = redis_client->get_value(key);
-    if (reply == FINISH_TERMINATION) {
-      return false;
-    }
-  }
-
-  for (const auto& key : command_keys) {
-    redis_client->set_value(key, flag);
-  }
-
-  return true;
-}
-
-// protocol:
-// 1) set everyone START_NORMALIZATION flag
-// 2) wait for everyone to set FINISH_NORMALIZATION flag (executors should dump cached nwt updates if they used cache)
-// 3) set everyone START_NORMALIZATION flag
-// 4) wait for everyone to set FINISH_NORMALIZATION flag
-// 5) read results from data slots
-// 6) merge results and put final n_t into data slots
-// 7) set everyone START_NORMALIZATION flag
-// 8) wait for everyone to set FINISH_NORMALIZATION flag
-bool normalize_nwt(std::shared_ptr<RedisClient> redis_client,
-                   const std::vector<std::string>& command_keys,
-                   const std::vector<std::string>& data_keys,
-                   int num_topics)
-{
-  if (!check_non_terminated_and_update(redis_client, command_keys, START_NORMALIZATION)) {
-    return false;
-  }
-
-  if (!check_finished_or_terminated(redis_client, command_keys, START_NORMALIZATION, FINISH_NORMALIZATION)) {
-    return false;
-  }
-
-  if (!check_non_terminated_and_update(redis_client, command_keys, START_NORMALIZATION)) {
-    return false;
-  }
-
-  if (!check_finished_or_terminated(redis_client, command_keys, START_NORMALIZATION, FINISH_NORMALIZATION)) {
-    return false;
-  }
-
-  Normalizers n_t;
-  Normalizers helper;
-  for (const auto& key : data_keys) {
-    helper = redis_client->get_hashmap(key, num_topics);
-    for (const auto& kv : helper) {
-      auto iter = n_t.find(kv.first);
-      if (iter == n_t.end()) {
-        n_t.emplace(kv);
-      } else {
-        for (int i = 0; i < kv.second.size(); ++i) {
-          iter->second[i] += kv.second[i];
-        }
-      }
-    }
-    helper.clear();
-  }
-
-  // ToDo(MelLain): maybe it'll be better to keep only one version of n_t for
-  //                all executors, need to be checked with large number of topics
-  for (const auto& key : data_keys) {
-    redis_client->set_hashmap(key, n_t);
-  }
-
-  if (!check_non_terminated_and_update(redis_client, command_keys, START_NORMALIZATION)) {
-    return false;
-  }
-
-  if (!check_finished_or_terminated(redis_client, command_keys, START_NORMALIZATION, FINISH_NORMALIZATION)) {
-    return false;
-  }
-
-  return true;
-}
-
 // ToDo(MelLain): rewrite this function, as it is very inefficient and hacked now
 void print_top_tokens(std::shared_ptr<RedisClient> redis_client,
-                      const std::string& vocab_path,
-                      int num_topics,
+                      const Parameters& parameters,
                       int num_tokens = 10)
 {
   std::vector<std::string> topics;
-  for (int i = 0; i < num_topics; ++i) {
+  for (int i = 0; i < parameters.num_topics; ++i) {
     topics.push_back("topic_" + std::to_string(i));
   }
 
-  auto p_wt = std::shared_ptr<RedisPhiMatrixAdapter>(
-      new RedisPhiMatrixAdapter(redis_client, ModelName("pwt"), topics));
-
-  auto zero_vector = std::vector<float>(num_topics, 0.0f);
-
-  std::ifstream fin;
-  std::string line;
-  fin.open(vocab_path);
-  while (std::getline(fin, line)) {
-    p_wt->add_token(Token(DefaultClass, line), false, zero_vector);
+  auto vocab = VocabLoader::load(parameters.vocab_path);
+  RedisKeyLayout key_layout(RedisKeyLayout::parse_mode(parameters.key_layout),
+                            parameters.key_block_size,
+                            vocab->token_size(),
+                            parameters.rows_per_value);
+
+  std::shared_ptr<PhiStore> store;
+  if (parameters.phi_store == PHI_STORE_SHM) {
+    store = std::make_shared<ShmPhiStore>(parameters.shm_name + "-pwt", vocab->token_size(), topics.size());
+  } else {
+    store = std::make_shared<RedisPhiStore>(ModelName("pwt"), topics.size(), key_layout,
+                                            ValueEncoder::parse(parameters.pwt_encoding),
+                                            RowCodec::parse_format(parameters.pwt_row_format));
   }
-  fin.close();
+
+  auto p_wt = std::make_shared<RedisPhiMatrixAdapter>(
+      std::make_shared<RedisPhiMatrix>(ModelName("pwt"), topics, vocab, PhiMatrixCacheMode::NONE, store),
+      redis_client);
 
   for (int i = 0; i < p_wt->topic_size(); ++i) {
     std::vector<std::pair<Token, float>> pairs;
@@ -344,108 +285,45 @@ int main(int argc, char* argv[]) {
   LOG(INFO) << "Master: finish connecting to redis";
   std::cout << "Master: finish connecting to redis" << std::endl;
 
+  // zero of the merged timeline, executors read it when they write their traces at exit
+  if (!parameters.trace_file.empty()) {
+    Tracer::enable(1 << 16);
+    Tracer::synchronize(*redis_client);
+    Tracer::publish_epoch(*redis_client);
+    Tracer::set_thread_name("master");
+  }
+
   LOG(INFO) << "Master: start creating ids";
   std::cout << "Master: start creating ids" << std::endl;
   
   std::vector<std::string> executor_command_keys;
   std::vector<std::string> executor_data_keys;
+  std::vector<std::string> executor_metrics_keys;
   for (int executor_id = 0; executor_id < parameters.num_executors; ++executor_id) {
     auto executor_keys = generate_command_keys(executor_id, parameters.num_executor_threads);
     executor_command_keys.insert(executor_command_keys.end(), executor_keys.begin(), executor_keys.end());
 
     executor_keys = generate_data_keys(executor_id, parameters.num_executor_threads);
     executor_data_keys.insert(executor_data_keys.end(), executor_keys.begin(), executor_keys.end());
+
+    executor_keys = generate_metrics_keys(executor_id, parameters.num_executor_threads);
+    executor_metrics_keys.insert(executor_metrics_keys.end(), executor_keys.begin(), executor_keys.end());
   }
 
   LOG(INFO) << "Master: finish creating ids";
   std::cout << "Master: finish creating ids" << std::endl;
 
-  try {
-    // we give 5.0 sec to all executors to start, if even one of them
-    // didn't response, it means that the start failed
-    LOG(INFO) << "Master: start connecting to processors";
-    std::cout << "Master: start connecting to processors" << std::endl;
-
-    bool ok = check_finished_or_terminated(redis_client, executor_command_keys,
-                                           START_GLOBAL_START, FINISH_GLOBAL_START, 5000000);
-    if (!ok) { throw std::runtime_error("Master: step 0, got termination status"); }
-
-    LOG(INFO) << "Master: finish connecting to processors";
-    std::cout << "Master: finish connecting to processors" << std::endl;
-
-    LOG(INFO) << "Master: start preparation";
-    std::cout << "Master: start preparation" << std::endl;
-
-    ok = check_non_terminated_and_update(redis_client, executor_command_keys, START_PREPARATION);
-    if (!ok) { throw std::runtime_error("Master: step 1 start, got termination status"); }
-
-    ok = check_finished_or_terminated(redis_client, executor_command_keys,
-                                      START_PREPARATION, FINISH_PREPARATION);
-    if (!ok) { throw std::runtime_error("Master: step 1 finish, got termination status"); }
-
-    LOG(INFO) << "Master: finish preparation";
-    std::cout << "Master: finish preparation" << std::endl;
-
-    double n = 0.0;
-    for (const auto& key : executor_data_keys) {
-      n += std::stod(redis_client->get_value(key));
-    }
-
-    LOG(INFO) << "Master: all executors have started! Total number of token slots in collection: " << n;
-    std::cout << "Master: all executors have started! Total number of token slots in collection: " << n << std::endl;
-
-    if (!parameters.continue_fitting) {
-      if (!normalize_nwt(redis_client, executor_command_keys, executor_data_keys, parameters.num_topics)) {
-        throw std::runtime_error("Step 2, got termination status");
-      }
-    }
-
-    // EM-iterations
-    for (int iteration = 0; iteration < parameters.num_outer_iters; ++iteration) {
-      LOG(INFO) << "Master: start iteration " << iteration;
-      std::cout << "Master: start iteration " << iteration << std::endl;
-
-      ok = check_non_terminated_and_update(redis_client, executor_command_keys, START_ITERATION);
-      if (!ok) { throw std::runtime_error("Step 3 start, got termination status"); }
-
-      ok = check_finished_or_terminated(redis_client, executor_command_keys, START_ITERATION, FINISH_ITERATION);
-      if (!ok) { throw std::runtime_error("Step 3 intermediate, got termination status"); }
-
-      double perplexity_value = 0.0;
-      for (const auto& key : executor_data_keys) {
-        perplexity_value += std::stod(redis_client->get_value(key));
-      }
-
-      LOG(INFO) << "Master: finish e-step, start m-step";
-      std::cout << "Master: finish e-step, start m-step" << std::endl;
-
-      if (!normalize_nwt(redis_client, executor_command_keys, executor_data_keys, parameters.num_topics)) {
-        throw std::runtime_error("Step 3 finish, got termination status");
-      }
-
-      perplexity_value = exp(-(1.0f / n) * perplexity_value);
-      
-      LOG(INFO) << "Iteration: " << iteration << ", perplexity: " << perplexity_value;
-      std::cout << "Iteration: " << iteration << ", perplexity: " << perplexity_value << std::endl;
-
-      LOG(INFO) << "Iteration: " << iteration << ", maxrss: " << Helpers::get_peak_memory_kb() << " KB";
-    }
-
-    // finalization (correct in any way)
-    for (const auto& key : executor_command_keys) {
-      redis_client->set_value(key, START_TERMINATION);
-    }
-
-  } catch (...) {
-    for (const auto& key : executor_command_keys) {
-      redis_client->set_value(key, START_TERMINATION);
-    }
-    throw;
-  }
-  check_finished_or_terminated(redis_client, executor_command_keys, START_TERMINATION, FINISH_TERMINATION);
-
-  if (parameters.show_top_tokens) {
-    print_top_tokens(redis_client, parameters.vocab_path, parameters.num_topics);
+  // we give 5.0 sec to all executors to start, if even one of them
+  // didn't response, it means that the start failed
+  Master master(redis_client, executor_command_keys, executor_data_keys, executor_metrics_keys,
+                parameters.num_topics);
+  master.fit(parameters.num_outer_iters, parameters.continue_fitting == 1, 5000000);
+  master.wait_for_termination();
+
+  if (parameters.show_top_tokens && parameters.phi_store == PHI_STORE_PARTITIONED) {
+    LOG(WARNING) << "Top tokens can't be shown: partitioned phi matrices are lost with executors";
+  } else if (parameters.show_top_tokens) {
+    print_top_tokens(redis_client, parameters);
   }
 
   LOG(INFO) << "Model fitting is finished!";
@@ -453,5 +331,9 @@ int main(int argc, char* argv[]) {
 
   LOG(INFO) << "Final maxrss= " << Helpers::get_peak_memory_kb() << " KB";
 
+  if (!parameters.trace_file.empty()) {
+    Tracer::write(parameters.trace_file, 0, "master", *redis_client);
+  }
+
   return 0;
 }
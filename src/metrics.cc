@@ -0,0 +1,170 @@
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+#include "metrics.h"
+
+namespace {
+  thread_local MetricsRegistry* current_registry = nullptr;
+
+  template <typename T>
+  T& find_or_create(std::map<std::string, std::unique_ptr<T>>* metrics, const std::string& name) {
+    auto& metric = (*metrics)[name];
+    if (metric == nullptr) {
+      metric.reset(new T());
+    }
+    return *metric;
+  }
+}
+
+const int LatencyHistogram::kSubBucketBits;
+const int LatencyHistogram::kSubBuckets;
+const int LatencyHistogram::kNumBuckets;
+
+LatencyHistogram::LatencyHistogram() {
+  reset();
+}
+
+int LatencyHistogram::bucket_index(uint64_t value) {
+  if (value < static_cast<uint64_t>(kSubBuckets)) {
+    return static_cast<int>(value);
+  }
+
+  // the highest kSubBucketBits + 1 bits of the value, the first of them is always set
+  const int exponent = 63 - __builtin_clzll(value);
+  const int shift = exponent - kSubBucketBits;
+  const int sub_bucket = static_cast<int>(value >> shift) - kSubBuckets;
+  return kSubBuckets + shift * kSubBuckets + sub_bucket;
+}
+
+int64_t LatencyHistogram::bucket_value(int index) {
+  if (index < kSubBuckets) {
+    return index;
+  }
+
+  const int shift = (index - kSubBuckets) / kSubBuckets;
+  const int64_t sub_bucket = (index - kSubBuckets) % kSubBuckets;
+  const int64_t lower_bound = (kSubBuckets + sub_bucket) << shift;
+  return lower_bound + ((int64_t(1) << shift) >> 1);
+}
+
+void LatencyHistogram::record(int64_t value) {
+  value = std::max<int64_t>(value, 0);
+  buckets_[bucket_index(static_cast<uint64_t>(value))].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+
+  int64_t old_max = max_.load(std::memory_order_relaxed);
+  while (old_max < value && !max_.compare_exchange_weak(old_max, value, std::memory_order_relaxed)) { }
+}
+
+int64_t LatencyHistogram::percentile(double q) const {
+  const int64_t total = count();
+  if (total == 0) {
+    return 0;
+  }
+
+  const int64_t rank = std::max<int64_t>(1, static_cast<int64_t>(q * total + 0.5));
+  int64_t seen = 0;
+  for (int index = 0; index < kNumBuckets; ++index) {
+    seen += buckets_[index].load(std::memory_order_relaxed);
+    if (seen >= rank) {
+      return std::min(bucket_value(index), max());
+    }
+  }
+  return max();
+}
+
+void LatencyHistogram::reset() {
+  for (auto& bucket : buckets_) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  count_.store(0, std::memory_order_relaxed);
+  sum_.store(0, std::memory_order_relaxed);
+  max_.store(0, std::memory_order_relaxed);
+}
+
+Counter& MetricsRegistry::counter(const std::string& name) {
+  boost::lock_guard<boost::mutex> guard(lock_);
+  return find_or_create(&counters_, name);
+}
+
+Gauge& MetricsRegistry::gauge(const std::string& name) {
+  boost::lock_guard<boost::mutex> guard(lock_);
+  return find_or_create(&gauges_, name);
+}
+
+LatencyHistogram& MetricsRegistry::histogram(const std::string& name) {
+  boost::lock_guard<boost::mutex> guard(lock_);
+  return find_or_create(&histograms_, name);
+}
+
+std::vector<MetricSnapshot> MetricsRegistry::snapshot() const {
+  boost::lock_guard<boost::mutex> guard(lock_);
+
+  std::vector<MetricSnapshot> retval;
+  for (const auto& kv : counters_) {
+    const int64_t value = kv.second->value();
+    retval.push_back({ kv.first, value, static_cast<double>(value), static_cast<double>(value), 0.0, 0.0 });
+  }
+  for (const auto& kv : gauges_) {
+    const double value = kv.second->value();
+    retval.push_back({ kv.first, 1, value, value, 0.0, 0.0 });
+  }
+  for (const auto& kv : histograms_) {
+    const LatencyHistogram& histogram = *kv.second;
+    retval.push_back({ kv.first, histogram.count(), static_cast<double>(histogram.sum()),
+                       static_cast<double>(histogram.max()), static_cast<double>(histogram.percentile(0.5)),
+                       static_cast<double>(histogram.percentile(0.99)) });
+  }
+
+  std::sort(retval.begin(), retval.end(),
+            [](const MetricSnapshot& a, const MetricSnapshot& b) { return a.name < b.name; });
+  return retval;
+}
+
+void MetricsRegistry::reset() {
+  boost::lock_guard<boost::mutex> guard(lock_);
+  for (auto& kv : counters_) {
+    kv.second->reset();
+  }
+  for (auto& kv : gauges_) {
+    kv.second->reset();
+  }
+  for (auto& kv : histograms_) {
+    kv.second->reset();
+  }
+}
+
+std::string MetricsRegistry::serialize(const std::vector<MetricSnapshot>& metrics) {
+  std::stringstream stream;
+  stream << std::setprecision(15);
+  for (const auto& metric : metrics) {
+    stream << metric.name << " " << metric.count << " " << metric.sum << " "
+           << metric.max << " " << metric.p50 << " " << metric.p99 << "\n";
+  }
+  return stream.str();
+}
+
+std::vector<MetricSnapshot> MetricsRegistry::parse(const std::string& data) {
+  std::vector<MetricSnapshot> retval;
+  std::stringstream stream(data);
+  MetricSnapshot metric;
+  while (stream >> metric.name >> metric.count >> metric.sum >> metric.max >> metric.p50 >> metric.p99) {
+    retval.push_back(metric);
+  }
+  return retval;
+}
+
+MetricsRegistry& MetricsRegistry::global() {
+  static MetricsRegistry registry;
+  return registry;
+}
+
+MetricsRegistry& MetricsRegistry::current() {
+  return current_registry != nullptr ? *current_registry : global();
+}
+
+void MetricsRegistry::set_current(MetricsRegistry* registry) {
+  current_registry = registry;
+}
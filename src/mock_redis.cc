@@ -0,0 +1,433 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+
+#include "boost/thread/locks.hpp"
+
+#include "mock_redis.h"
+#include "redis_client.h"
+#include "row_codec.h"
+
+namespace {
+  // replies are allocated by malloc as in hiredis, freeReplyObject frees them
+  redisReply* create_reply(int type) {
+    auto reply = static_cast<redisReply*>(calloc(1, sizeof(redisReply)));
+    reply->type = type;
+    return reply;
+  }
+
+  // str is zero terminated as in hiredis, some callers rely on it
+  redisReply* create_string_reply(int type, const std::string& value) {
+    auto reply = create_reply(type);
+    reply->str = static_cast<char*>(malloc(value.size() + 1));
+    memcpy(reply->str, value.data(), value.size());
+    reply->str[value.size()] = '\0';
+    reply->len = value.size();
+    return reply;
+  }
+
+  redisReply* string_reply(const std::string& value) {
+    return create_string_reply(REDIS_REPLY_STRING, value);
+  }
+
+  redisReply* status_reply(const std::string& status) {
+    return create_string_reply(REDIS_REPLY_STATUS, status);
+  }
+
+  redisReply* error_reply(const std::string& error) {
+    return create_string_reply(REDIS_REPLY_ERROR, error);
+  }
+
+  redisReply* integer_reply(long long value) {
+    auto reply = create_reply(REDIS_REPLY_INTEGER);
+    reply->integer = value;
+    return reply;
+  }
+
+  redisReply* nil_reply() {
+    return create_reply(REDIS_REPLY_NIL);
+  }
+
+  redisReply* array_reply(const std::vector<redisReply*>& elements) {
+    auto reply = create_reply(REDIS_REPLY_ARRAY);
+    if (!elements.empty()) {
+      reply->element = static_cast<redisReply**>(calloc(elements.size(), sizeof(redisReply*)));
+      std::copy(elements.begin(), elements.end(), reply->element);
+      reply->elements = elements.size();
+    }
+    return reply;
+  }
+
+  redisReply* wrong_type_reply() {
+    return error_reply("WRONGTYPE Operation against a key holding the wrong kind of value");
+  }
+
+  size_t payload_size(const redisReply* reply) {
+    if (reply->type == REDIS_REPLY_INTEGER) {
+      return sizeof(reply->integer);
+    }
+    if (reply->type == REDIS_REPLY_ARRAY) {
+      size_t retval = 0;
+      for (size_t i = 0; i < reply->elements; ++i) {
+        retval += payload_size(reply->element[i]);
+      }
+      return retval;
+    }
+    return reply->len;
+  }
+
+  // it isn't sha1 of the script, clients use the digest only to refer to the loaded script
+  std::string script_digest(const std::string& script) {
+    std::stringstream stream;
+    stream << std::hex << std::hash<std::string>()(script);
+    return stream.str();
+  }
+
+  std::string to_upper(const std::string& value) {
+    std::string retval(value);
+    std::transform(retval.begin(), retval.end(), retval.begin(), [](char c) { return std::toupper(c); });
+    return retval;
+  }
+}
+
+std::vector<std::string> MockRedis::format_command(const char* format, va_list ap) {
+  va_list args;
+  va_copy(args, ap);
+
+  std::vector<std::string> retval;
+  bool is_word = false;
+  for (const char* c = format; *c != '\0'; ++c) {
+    if (*c == ' ') {
+      is_word = false;
+      continue;
+    }
+
+    if (!is_word) {
+      retval.emplace_back();
+      is_word = true;
+    }
+
+    std::string& word = retval.back();
+    if (*c != '%') {
+      word.push_back(*c);
+      continue;
+    }
+
+    ++c;
+    if (*c == 'b') {
+      const char* data = va_arg(args, const char*);
+      word.append(data, va_arg(args, size_t));
+    } else if (*c == 's') {
+      word.append(va_arg(args, const char*));
+    } else if (*c == 'd') {
+      word.append(std::to_string(va_arg(args, int)));
+    } else if (*c == '%') {
+      word.push_back('%');
+    } else {
+      va_end(args);
+      throw std::runtime_error(std::string("MockRedis: unsupported format of command: ") + format);
+    }
+  }
+
+  va_end(args);
+  return retval;
+}
+
+redisReply* MockRedis::command(const std::vector<std::string>& argv) {
+  redisReply* reply = nullptr;
+  {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    try {
+      reply = execute(argv);
+    } catch (const std::exception& error) {
+      // e.g. non-integer offsets
+      reply = error_reply(std::string("ERR ") + error.what());
+    }
+  }
+
+  if (latency_us_ > 0 || bandwidth_mb_per_second_ > 0.0) {
+    size_t num_bytes = payload_size(reply);
+    for (const auto& arg : argv) {
+      num_bytes += arg.size();
+    }
+
+    // 1 MB/s is 1 byte per microsecond
+    double delay_us = latency_us_;
+    if (bandwidth_mb_per_second_ > 0.0) {
+      delay_us += num_bytes / bandwidth_mb_per_second_;
+    }
+    usleep(static_cast<useconds_t>(delay_us));
+  }
+
+  return reply;
+}
+
+redisReply* MockRedis::execute(const std::vector<std::string>& argv) {
+  if (argv.empty()) {
+    return error_reply("ERR empty command");
+  }
+
+  const std::string name = to_upper(argv[0]);
+  const size_t argc = argv.size();
+
+  auto transaction = transactions_.find(std::this_thread::get_id());
+  if (transaction != transactions_.end()) {
+    if (name == "EXEC") {
+      std::vector<std::vector<std::string>> commands;
+      commands.swap(transaction->second);
+      transactions_.erase(transaction);
+
+      // the lock is held during the whole transaction, so it's atomic
+      std::vector<redisReply*> replies;
+      for (const auto& command : commands) {
+        replies.push_back(execute(command));
+      }
+      return array_reply(replies);
+    }
+
+    if (name == "DISCARD") {
+      transactions_.erase(transaction);
+      return status_reply("OK");
+    }
+
+    if (name == "MULTI") {
+      return error_reply("ERR MULTI calls can not be nested");
+    }
+
+    transaction->second.push_back(argv);
+    return status_reply("QUEUED");
+  }
+
+  if (name == "MULTI" && argc == 1) {
+    transactions_[std::this_thread::get_id()];
+    return status_reply("OK");
+  }
+
+  if ((name == "EXEC" || name == "DISCARD") && argc == 1) {
+    return error_reply("ERR " + name + " without MULTI");
+  }
+
+  if (name == "GET" && argc == 2) {
+    if (hashes_.count(argv[1]) > 0) {
+      return wrong_type_reply();
+    }
+
+    auto iter = strings_.find(argv[1]);
+    return iter != strings_.end() ? string_reply(iter->second) : nil_reply();
+  }
+
+  if (name == "SET" && argc == 3) {
+    string_value(argv[1]) = argv[2];
+    return status_reply("OK");
+  }
+
+  if (name == "GETSET" && argc == 3) {
+    if (hashes_.count(argv[1]) > 0) {
+      return wrong_type_reply();
+    }
+
+    auto iter = strings_.find(argv[1]);
+    redisReply* reply = iter != strings_.end() ? string_reply(iter->second) : nil_reply();
+    strings_[argv[1]] = argv[2];
+    return reply;
+  }
+
+  if (name == "GETRANGE" && argc == 4) {
+    if (hashes_.count(argv[1]) > 0) {
+      return wrong_type_reply();
+    }
+
+    auto iter = strings_.find(argv[1]);
+    const long long size = iter != strings_.end() ? iter->second.size() : 0;
+
+    // negative indices are counted from the end, as in redis
+    long long begin = std::stoll(argv[2]);
+    long long end = std::stoll(argv[3]);
+    begin = std::max(0LL, begin < 0 ? begin + size : begin);
+    end = std::min(size - 1, std::max(0LL, end < 0 ? end + size : end));
+    if (size == 0 || begin > end) {
+      return string_reply("");
+    }
+    return string_reply(iter->second.substr(begin, end - begin + 1));
+  }
+
+  if (name == "SETRANGE" && argc == 4) {
+    if (hashes_.count(argv[1]) > 0) {
+      return wrong_type_reply();
+    }
+
+    const long long offset = std::stoll(argv[2]);
+    if (offset < 0) {
+      return error_reply("ERR offset is out of range");
+    }
+
+    const std::string& data = argv[3];
+    if (data.empty()) {
+      auto iter = strings_.find(argv[1]);
+      return integer_reply(iter != strings_.end() ? iter->second.size() : 0);
+    }
+
+    std::string& value = strings_[argv[1]];
+    if (value.size() < offset + data.size()) {
+      value.resize(offset + data.size(), '\0');
+    }
+    value.replace(offset, data.size(), data);
+    return integer_reply(value.size());
+  }
+
+  if ((name == "EXISTS" || name == "DEL") && argc >= 2) {
+    long long num_keys = 0;
+    for (size_t i = 1; i < argc; ++i) {
+      if (name == "EXISTS") {
+        num_keys += strings_.count(argv[i]) + hashes_.count(argv[i]);
+      } else {
+        num_keys += strings_.erase(argv[i]) + hashes_.erase(argv[i]);
+      }
+    }
+    return integer_reply(num_keys);
+  }
+
+  if (name == "HSET" && argc >= 4 && argc % 2 == 0) {
+    if (strings_.count(argv[1]) > 0) {
+      return wrong_type_reply();
+    }
+
+    Hash& hash = hashes_[argv[1]];
+    long long num_added = 0;
+    for (size_t i = 2; i < argc; i += 2) {
+      num_added += hash.count(argv[i]) == 0;
+      hash[argv[i]] = argv[i + 1];
+    }
+    return integer_reply(num_added);
+  }
+
+  if (name == "HGET" && argc == 3) {
+    if (strings_.count(argv[1]) > 0) {
+      return wrong_type_reply();
+    }
+
+    auto hash = hashes_.find(argv[1]);
+    if (hash == hashes_.end()) {
+      return nil_reply();
+    }
+    auto iter = hash->second.find(argv[2]);
+    return iter != hash->second.end() ? string_reply(iter->second) : nil_reply();
+  }
+
+  if (name == "HKEYS" && argc == 2) {
+    if (strings_.count(argv[1]) > 0) {
+      return wrong_type_reply();
+    }
+
+    std::vector<redisReply*> fields;
+    auto hash = hashes_.find(argv[1]);
+    if (hash != hashes_.end()) {
+      for (const auto& kv : hash->second) {
+        fields.push_back(string_reply(kv.first));
+      }
+    }
+    return array_reply(fields);
+  }
+
+  if (name == "TIME" && argc == 1) {
+    const auto now = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+    return array_reply({ string_reply(std::to_string(now / 1000000)), string_reply(std::to_string(now % 1000000)) });
+  }
+
+  if (name == "SCRIPT" && argc == 3 && to_upper(argv[1]) == "LOAD") {
+    const std::string digest = script_digest(argv[2]);
+    scripts_[digest] = argv[2];
+    return string_reply(digest);
+  }
+
+  if ((name == "EVAL" || name == "EVALSHA") && argc >= 3) {
+    const long long num_keys = std::stoll(argv[2]);
+    if (num_keys < 0 || static_cast<long long>(argc) < 3 + num_keys) {
+      return error_reply("ERR Number of keys can't be greater than number of args");
+    }
+
+    std::string script = argv[1];
+    if (name == "EVALSHA") {
+      auto iter = scripts_.find(argv[1]);
+      if (iter == scripts_.end()) {
+        return error_reply("NOSCRIPT No matching script. Please use EVAL.");
+      }
+      script = iter->second;
+    } else {
+      scripts_[script_digest(script)] = script;
+    }
+
+    return run_script(script,
+                      std::vector<std::string>(argv.begin() + 3, argv.begin() + 3 + num_keys),
+                      std::vector<std::string>(argv.begin() + 3 + num_keys, argv.end()));
+  }
+
+  return error_reply("ERR unknown command or wrong number of arguments for '" + argv[0] + "'");
+}
+
+redisReply* MockRedis::run_script(const std::string& script, const std::vector<std::string>& keys,
+                                  const std::vector<std::string>& args)
+{
+  if (script == RedisClient::get_set_range_script() && keys.size() == 1 && args.size() == 2) {
+    const size_t offset = std::stoul(args[0]);
+    const std::string& data = args[1];
+
+    std::string& value = string_value(keys[0]);
+    const std::string old = offset < value.size() ? value.substr(offset, data.size()) : std::string();
+    if (value.size() < offset + data.size()) {
+      value.resize(offset + data.size(), '\0');
+    }
+    value.replace(offset, data.size(), data);
+    return string_reply(old);
+  }
+
+  if (script == RedisClient::increase_range_script() && keys.size() == 1 && args.size() == 2) {
+    increase_range(keys[0], std::stoul(args[0]), args[1].data(), args[1].size());
+    return integer_reply(1);
+  }
+
+  if (script == RedisClient::increase_rows_script() && args.size() == 1 + 2 * keys.size()) {
+    // sparse rows are decoded into dense ones, zeros don't change the sums
+    const int num_values = std::stoi(args[0]);
+    std::vector<float> increments(num_values);
+    for (size_t i = 0; i < keys.size(); ++i) {
+      const std::string& row = args[2 + 2 * i];
+      RowCodec::decode(row.data(), row.size(), num_values, ValueEncoding::FLOAT32, increments.data());
+      increase_range(keys[i], std::stoul(args[1 + 2 * i]),
+                     reinterpret_cast<const char*>(increments.data()), increments.size() * sizeof(float));
+    }
+    return integer_reply(keys.size());
+  }
+
+  return error_reply("ERR MockRedis doesn't support the script");
+}
+
+void MockRedis::increase_range(const std::string& key, size_t byte_offset, const char* increments, size_t size) {
+  std::string& value = string_value(key);
+  if (value.size() < byte_offset + size) {
+    value.resize(byte_offset + size, '\0');
+  }
+
+  // bytes of strings may be unaligned
+  for (size_t i = 0; i + sizeof(float) <= size; i += sizeof(float)) {
+    float old_value = 0.0f;
+    float increment = 0.0f;
+    memcpy(&old_value, &value[byte_offset + i], sizeof(float));
+    memcpy(&increment, increments + i, sizeof(float));
+    old_value += increment;
+    memcpy(&value[byte_offset + i], &old_value, sizeof(float));
+  }
+}
+
+std::string& MockRedis::string_value(const std::string& key) {
+  hashes_.erase(key);
+  return strings_[key];
+}
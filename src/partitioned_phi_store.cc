@@ -0,0 +1,213 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#include "boost/thread/locks.hpp"
+#include "boost/thread/mutex.hpp"
+
+#include "glog/logging.h"
+
+#include "partitioned_phi_store.h"
+
+namespace ba = boost::asio;
+using ba::ip::tcp;
+
+namespace {
+  // servers are published before the global start, wait for them at most 60 seconds
+  const int kMaxWaitIterations = 30000;
+  const int kWaitIntervalUs = 2000;
+}
+
+class PartitionedPhiStore::ConnectionPool : boost::noncopyable {
+ public:
+  explicit ConnectionPool(const PhiPartition& partition)
+      : io_context_()
+      , endpoint_(ba::ip::make_address(partition.host), static_cast<unsigned short>(partition.port)) { }
+
+  std::unique_ptr<tcp::socket> acquire() {
+    {
+      boost::lock_guard<boost::mutex> guard(lock_);
+      if (!idle_.empty()) {
+        auto retval = std::move(idle_.back());
+        idle_.pop_back();
+        return retval;
+      }
+    }
+
+    std::unique_ptr<tcp::socket> retval(new tcp::socket(io_context_));
+    retval->connect(endpoint_);
+    retval->set_option(tcp::no_delay(true));
+    return retval;
+  }
+
+  void release(std::unique_ptr<tcp::socket> socket) {
+    boost::lock_guard<boost::mutex> guard(lock_);
+    idle_.push_back(std::move(socket));
+  }
+
+ private:
+  ba::io_context io_context_;
+  tcp::endpoint endpoint_;
+  boost::mutex lock_;
+  std::vector<std::unique_ptr<tcp::socket>> idle_;
+};
+
+PartitionedPhiStore::PartitionedPhiStore(const ModelName& model_name, int token_size, int topic_size,
+                                         std::shared_ptr<PhiServer> local_server)
+    : model_name_(model_name)
+    , token_size_(token_size)
+    , topic_size_(topic_size)
+    , local_server_(local_server)
+    , local_store_(local_server->local_store(model_name)) { }
+
+PartitionedPhiStore::~PartitionedPhiStore() { }
+
+void PartitionedPhiStore::publish_partition(std::shared_ptr<RedisClient> redis_client, int executor_id,
+                                            const PhiPartition& partition)
+{
+  std::stringstream value;
+  value << partition.host << " " << partition.port << " "
+        << partition.token_begin_index << " " << partition.token_end_index;
+  redis_client->set_value(generate_server_key(executor_id), value.str());
+}
+
+std::vector<PhiPartition> PartitionedPhiStore::discover_partitions(std::shared_ptr<RedisClient> redis_client,
+                                                                   int token_size)
+{
+  std::vector<PhiPartition> retval;
+  int covered = 0;
+  for (int executor_id = 0; covered < token_size; ++executor_id) {
+    const std::string key = generate_server_key(executor_id);
+
+    std::string value = redis_client->get_raw_value(key);
+    for (int iteration = 0; value.empty() && iteration < kMaxWaitIterations; ++iteration) {
+      usleep(kWaitIntervalUs);
+      value = redis_client->get_raw_value(key);
+    }
+    if (value.empty()) {
+      throw std::runtime_error("Phi server of executor " + std::to_string(executor_id) + " isn't published");
+    }
+
+    PhiPartition partition;
+    std::stringstream stream(value);
+    stream >> partition.host >> partition.port >> partition.token_begin_index >> partition.token_end_index;
+    if (stream.fail() || partition.token_begin_index != covered) {
+      throw std::runtime_error("Bad partition of executor " + std::to_string(executor_id) + ": " + value);
+    }
+
+    LOG(INFO) << "Phi server of executor " << executor_id << ": " << value;
+    covered = partition.token_end_index;
+    retval.push_back(partition);
+  }
+  return retval;
+}
+
+int PartitionedPhiStore::partition_of(std::shared_ptr<RedisClient> redis_client, int token_id) const {
+  std::call_once(discover_flag_, [this, redis_client]() {
+    partitions_ = discover_partitions(redis_client, token_size_);
+    for (const auto& partition : partitions_) {
+      pools_.emplace_back(new ConnectionPool(partition));
+    }
+  });
+
+  auto iter = std::upper_bound(partitions_.begin(), partitions_.end(), token_id,
+                               [](int id, const PhiPartition& partition) {
+                                 return id < partition.token_begin_index;
+                               });
+  return static_cast<int>(iter - partitions_.begin()) - 1;
+}
+
+bool PartitionedPhiStore::request(std::shared_ptr<RedisClient> redis_client, PhiProtocol::Operation operation,
+                                  int token_id, int num_tokens, const std::vector<float>* row,
+                                  float* response, size_t response_size) const
+{
+  PhiProtocol::RequestHeader header;
+  header.operation = operation;
+  header.model_name_size = static_cast<uint8_t>(model_name_.size());
+  header.reserved = 0;
+  header.token_id = static_cast<uint32_t>(token_id);
+  header.num_tokens = static_cast<uint32_t>(num_tokens);
+
+  std::vector<ba::const_buffer> buffers = {
+    ba::buffer(&header, sizeof(header)),
+    ba::buffer(model_name_.data(), model_name_.size())
+  };
+  if (row != nullptr) {
+    buffers.push_back(ba::buffer(row->data(), topic_size_ * sizeof(float)));
+  }
+
+  auto& pool = *pools_[partition_of(redis_client, token_id)];
+  auto socket = pool.acquire();
+  ba::write(*socket, buffers);
+
+  uint32_t status = PhiProtocol::ERROR;
+  ba::read(*socket, ba::buffer(&status, sizeof(status)));
+  if (status == PhiProtocol::OK && response_size > 0) {
+    ba::read(*socket, ba::buffer(response, response_size * sizeof(float)));
+  }
+
+  // on exception the socket is closed, so the connection is never reused in a broken state
+  pool.release(std::move(socket));
+  return status == PhiProtocol::OK;
+}
+
+void PartitionedPhiStore::read_row(std::shared_ptr<RedisClient> redis_client, int token_id, float* buffer) const {
+  read_rows(redis_client, token_id, token_id + 1, buffer);
+}
+
+void PartitionedPhiStore::read_rows(std::shared_ptr<RedisClient> redis_client, int token_begin_index,
+                                    int token_end_index, float* buffer) const
+{
+  // one request per partition of the range
+  int token_id = token_begin_index;
+  while (token_id < token_end_index) {
+    float* rows = buffer + (token_id - token_begin_index) * topic_size_;
+
+    if (is_local(token_id)) {
+      const int end = std::min(token_end_index, local_server_->token_end_index());
+      local_store_->read_rows(redis_client, local_id(token_id), local_id(end), rows);
+      token_id = end;
+      continue;
+    }
+
+    const int end = std::min(token_end_index, partitions_[partition_of(redis_client, token_id)].token_end_index);
+
+    if (!request(redis_client, PhiProtocol::READ_ROWS, token_id, end - token_id, nullptr, rows,
+                 (end - token_id) * topic_size_))
+    {
+      throw std::runtime_error("Unable to read rows of " + model_name_ + " from token " + std::to_string(token_id));
+    }
+    token_id = end;
+  }
+}
+
+void PartitionedPhiStore::write_row(std::shared_ptr<RedisClient> redis_client, int token_id,
+                                    const std::vector<float>& values)
+{
+  if (is_local(token_id)) {
+    local_store_->write_row(redis_client, local_id(token_id), values);
+  } else if (!request(redis_client, PhiProtocol::WRITE_ROW, token_id, 1, &values, nullptr, 0)) {
+    throw std::runtime_error("Unable to write row " + std::to_string(token_id) + " of " + model_name_);
+  }
+}
+
+void PartitionedPhiStore::exchange_row(std::shared_ptr<RedisClient> redis_client, int token_id,
+                                       const std::vector<float>& values, float* old_values)
+{
+  if (is_local(token_id)) {
+    local_store_->exchange_row(redis_client, local_id(token_id), values, old_values);
+  } else if (!request(redis_client, PhiProtocol::EXCHANGE_ROW, token_id, 1, &values, old_values, topic_size_)) {
+    throw std::runtime_error("Unable to exchange row " + std::to_string(token_id) + " of " + model_name_);
+  }
+}
+
+bool PartitionedPhiStore::add_to_row(std::shared_ptr<RedisClient> redis_client, int token_id,
+                                     const std::vector<float>& increment)
+{
+  if (is_local(token_id)) {
+    return local_store_->add_to_row(redis_client, local_id(token_id), increment);
+  }
+  return request(redis_client, PhiProtocol::ADD_ROW, token_id, 1, &increment, nullptr, 0);
+}
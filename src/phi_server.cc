@@ -0,0 +1,142 @@
+#include <sys/socket.h>
+
+#include <cstdint>
+#include <stdexcept>
+
+#include "boost/thread/locks.hpp"
+
+#include "glog/logging.h"
+
+#include "phi_server.h"
+
+namespace ba = boost::asio;
+using ba::ip::tcp;
+
+PhiServer::PhiServer(const std::string& host, int port, int token_begin_index, int token_end_index)
+    : host_(host)
+    , port_(port)
+    , token_begin_index_(token_begin_index)
+    , token_end_index_(token_end_index)
+    , io_context_()
+    , acceptor_(io_context_)
+{
+  tcp::endpoint endpoint(ba::ip::make_address(host), static_cast<unsigned short>(port));
+  acceptor_.open(endpoint.protocol());
+  acceptor_.set_option(tcp::acceptor::reuse_address(true));
+  acceptor_.bind(endpoint);
+  acceptor_.listen();
+
+  port_ = acceptor_.local_endpoint().port();
+}
+
+PhiServer::~PhiServer() {
+  // blocking accept can't be cancelled, shutdown of the socket wakes it up
+  ::shutdown(acceptor_.native_handle(), SHUT_RDWR);
+  if (accept_thread_.joinable()) {
+    accept_thread_.join();
+  }
+
+  // serve threads are blocked in reads of the next request, shutdown wakes them up with an error
+  {
+    boost::lock_guard<boost::mutex> guard(connections_mutex_);
+    for (const auto& socket : connections_) {
+      ::shutdown(socket->native_handle(), SHUT_RDWR);
+    }
+  }
+  serve_threads_.join_all();
+}
+
+void PhiServer::add_model(const ModelName& model_name, int topic_size) {
+  stores_[model_name] = std::make_shared<ShmPhiStore>("", token_end_index_ - token_begin_index_, topic_size);
+}
+
+std::shared_ptr<ShmPhiStore> PhiServer::local_store(const ModelName& model_name) const {
+  auto iter = stores_.find(model_name);
+  if (iter == stores_.end()) {
+    throw std::runtime_error("Phi server has no model " + model_name);
+  }
+  return iter->second;
+}
+
+void PhiServer::start() {
+  boost::thread t(&PhiServer::accept_loop, this);
+  accept_thread_.swap(t);
+}
+
+void PhiServer::accept_loop() {
+  while (true) {
+    auto socket = std::make_shared<tcp::socket>(io_context_);
+    boost::system::error_code error;
+    acceptor_.accept(*socket, error);
+    if (error) {
+      LOG(INFO) << "Phi server " << host_ << ":" << port_ << ": stop accepting connections, " << error.message();
+      break;
+    }
+
+    socket->set_option(tcp::no_delay(true));
+    // connections live until peers close them or the server is destroyed
+    boost::lock_guard<boost::mutex> guard(connections_mutex_);
+    connections_.push_back(socket);
+    serve_threads_.create_thread([this, socket]() { serve(socket); });
+  }
+}
+
+void PhiServer::serve(std::shared_ptr<tcp::socket> socket) {
+  std::vector<float> row;
+  std::vector<float> result;
+
+  try {
+    while (true) {
+      PhiProtocol::RequestHeader header;
+      ba::read(*socket, ba::buffer(&header, sizeof(header)));
+
+      ModelName model_name(header.model_name_size, '\0');
+      ba::read(*socket, ba::buffer(&model_name[0], model_name.size()));
+
+      auto store = local_store(model_name);
+      const int topic_size = store->topic_size();
+      // numbers of the header are checked in 64 bits, so large values can't wrap around
+      const int64_t slice_size = token_end_index_ - token_begin_index_;
+      const int64_t first_local_id = static_cast<int64_t>(header.token_id) - token_begin_index_;
+      const int64_t num_tokens = header.num_tokens;
+      const bool is_in_slice = first_local_id >= 0 && first_local_id + num_tokens <= slice_size;
+      const int local_id = static_cast<int>(first_local_id);
+
+      if (header.operation != PhiProtocol::READ_ROWS) {
+        row.resize(topic_size);
+        ba::read(*socket, ba::buffer(row));
+      }
+
+      uint32_t status = PhiProtocol::OK;
+      result.clear();
+      if (!is_in_slice) {
+        status = PhiProtocol::ERROR;
+      } else if (header.operation == PhiProtocol::READ_ROWS) {
+        result.resize(static_cast<size_t>(num_tokens) * topic_size);
+        store->read_rows(nullptr, local_id, local_id + static_cast<int>(num_tokens), result.data());
+      } else if (header.operation == PhiProtocol::WRITE_ROW) {
+        store->write_row(nullptr, local_id, row);
+      } else if (header.operation == PhiProtocol::EXCHANGE_ROW) {
+        result.resize(topic_size);
+        store->exchange_row(nullptr, local_id, row, result.data());
+      } else if (header.operation == PhiProtocol::ADD_ROW) {
+        store->add_to_row(nullptr, local_id, row);
+      } else {
+        status = PhiProtocol::ERROR;
+      }
+
+      std::vector<ba::const_buffer> response = { ba::buffer(&status, sizeof(status)) };
+      if (status == PhiProtocol::OK && !result.empty()) {
+        response.push_back(ba::buffer(result));
+      }
+      ba::write(*socket, response);
+    }
+  } catch (const boost::system::system_error& error) {
+    // eof means that the peer has closed the connection
+    if (error.code() != ba::error::eof) {
+      LOG(WARNING) << "Phi server " << host_ << ":" << port_ << ": connection failed, " << error.what();
+    }
+  } catch (const std::exception& error) {
+    LOG(ERROR) << "Phi server " << host_ << ":" << port_ << ": bad request, " << error.what();
+  }
+}
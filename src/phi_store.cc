@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "glog/logging.h"
+#include "redis_cluster/slothash.h"
+
+#include "async_redis_client.h"
+#include "phi_store.h"
+
+bool PhiStore::add_to_rows(std::shared_ptr<RedisClient> redis_client, const std::vector<int>& token_ids,
+                           const std::vector<std::shared_ptr<std::vector<float>>>& increments)
+{
+  bool retval = true;
+  for (size_t i = 0; i < token_ids.size(); ++i) {
+    if (!add_to_row(redis_client, token_ids[i], *increments[i])) {
+      LOG(ERROR) << "Update of token data " << token_ids[i] << " has failed";
+      retval = false;
+    }
+  }
+  return retval;
+}
+
+std::future<void> PhiStore::read_row_async(std::shared_ptr<RedisClient> redis_client,
+                                           std::shared_ptr<AsyncRedisClient> /* async_client */,
+                                           int token_id, float* buffer) const
+{
+  return std::async(std::launch::deferred, [this, redis_client, token_id, buffer]() {
+    read_row(redis_client, token_id, buffer);
+  });
+}
+
+const size_t RedisPhiStore::kMaxRowsPerFlush;
+constexpr double RedisPhiStore::kMaxFlushCompressionRatio;
+
+RedisPhiStore::RedisPhiStore(const ModelName& model_name,
+                             int topic_size,
+                             const RedisKeyLayout& key_layout,
+                             ValueEncoding encoding,
+                             RowFormat row_format,
+                             bool compress_flush)
+    : model_name_(model_name)
+    , topic_size_(topic_size)
+    , key_layout_(key_layout)
+    , encoding_(encoding)
+    , row_format_(row_format)
+    , compress_flush_(compress_flush)
+{
+  if (row_format_ == RowFormat::ADAPTIVE && key_layout_.is_row_block()) {
+    throw std::runtime_error("Adaptive rows can't be packed into row blocks, model " + model_name_);
+  }
+}
+
+void RedisPhiStore::read_row(std::shared_ptr<RedisClient> redis_client, int token_id, float* buffer) const {
+  // rows are decoded right from replies
+  if (row_format_ == RowFormat::ADAPTIVE) {
+    const int topic_size = topic_size_;
+    const ValueEncoding encoding = encoding_;
+    redis_client->get_raw_value(to_key(token_id), [topic_size, encoding, buffer](const char* data, size_t size) {
+      RowCodec::decode(data, size, topic_size, encoding, buffer);
+    });
+  } else if (key_layout_.is_row_block()) {
+    redis_client->get_range_values(to_key(token_id), key_layout_.row_offset(token_id) * topic_size_,
+                                   buffer, topic_size_, encoding_);
+  } else {
+    redis_client->get_values(to_key(token_id), buffer, topic_size_, encoding_);
+  }
+}
+
+std::future<void> RedisPhiStore::read_row_async(std::shared_ptr<RedisClient> redis_client,
+                                                std::shared_ptr<AsyncRedisClient> async_client,
+                                                int token_id, float* buffer) const
+{
+  if (async_client == nullptr) {
+    return PhiStore::read_row_async(redis_client, async_client, token_id, buffer);
+  }
+
+  std::shared_future<std::string> data;
+  if (key_layout_.is_row_block()) {
+    const int bytes_per_row = static_cast<int>(topic_size_ * ValueEncoder::bytes_per_value(encoding_));
+    const int byte_begin = key_layout_.row_offset(token_id) * bytes_per_row;
+    data = async_client->get_raw_range(to_key(token_id), byte_begin, byte_begin + bytes_per_row).share();
+  } else {
+    data = async_client->get_raw_value(to_key(token_id)).share();
+  }
+
+  // decoding is done by the waiting thread, the loop thread only receives replies
+  return std::async(std::launch::deferred, [this, data, buffer]() {
+    const std::string& row = data.get();
+    if (row_format_ == RowFormat::ADAPTIVE) {
+      RowCodec::decode(row.data(), row.size(), topic_size_, encoding_, buffer);
+    } else {
+      ValueEncoder::decode(row.data(), row.size(), topic_size_, encoding_, buffer);
+    }
+  });
+}
+
+void RedisPhiStore::read_rows(std::shared_ptr<RedisClient> redis_client, int token_begin_index,
+                              int token_end_index, float* buffer) const
+{
+  if (!key_layout_.is_row_block()) {
+    for (int token_id = token_begin_index; token_id < token_end_index; ++token_id) {
+      read_row(redis_client, token_id, buffer + (token_id - token_begin_index) * topic_size_);
+    }
+    return;
+  }
+
+  // each redis value is requested only once
+  int token_id = token_begin_index;
+  while (token_id < token_end_index) {
+    // rows from token_id to the end of its redis value (or of the range)
+    int row_offset = key_layout_.row_offset(token_id);
+    int num_rows = std::min(key_layout_.rows_per_value() - row_offset, token_end_index - token_id);
+
+    redis_client->get_range_values(to_key(token_id), row_offset * topic_size_,
+                                   buffer + (token_id - token_begin_index) * topic_size_,
+                                   num_rows * topic_size_, encoding_);
+    token_id += num_rows;
+  }
+}
+
+void RedisPhiStore::write_row(std::shared_ptr<RedisClient> redis_client, int token_id,
+                              const std::vector<float>& values)
+{
+  if (row_format_ == RowFormat::ADAPTIVE) {
+    std::string data;
+    RowCodec::encode(values.data(), topic_size_, encoding_, &data);
+    redis_client->set_raw_value(to_key(token_id), data);
+  } else if (key_layout_.is_row_block()) {
+    redis_client->set_range_values(to_key(token_id), key_layout_.row_offset(token_id) * topic_size_, values,
+                                   encoding_);
+  } else {
+    redis_client->set_values(to_key(token_id), values, encoding_);
+  }
+}
+
+void RedisPhiStore::exchange_row(std::shared_ptr<RedisClient> redis_client, int token_id,
+                                 const std::vector<float>& values, float* old_values)
+{
+  if (row_format_ == RowFormat::ADAPTIVE) {
+    std::string data;
+    RowCodec::encode(values.data(), topic_size_, encoding_, &data);
+    data = redis_client->get_set_raw_value(to_key(token_id), data);
+    RowCodec::decode(data.data(), data.size(), topic_size_, encoding_, old_values);
+    return;
+  }
+
+  std::vector<float> old;
+  if (key_layout_.is_row_block()) {
+    old = redis_client->get_set_range_values(to_key(token_id), key_layout_.row_offset(token_id) * topic_size_,
+                                             values, encoding_);
+  } else {
+    old = redis_client->get_set_values(to_key(token_id), values, encoding_);
+  }
+  std::copy(old.begin(), old.end(), old_values);
+}
+
+bool RedisPhiStore::add_to_row(std::shared_ptr<RedisClient> redis_client, int token_id,
+                               const std::vector<float>& increment)
+{
+  // accumulation of rounded values would lose small increments, adaptive rows can't be summed by redis
+  if (encoding_ != ValueEncoding::FLOAT32 || row_format_ != RowFormat::DENSE) {
+    throw std::runtime_error("Increase is supported only for dense float32 matrices, model " + model_name_);
+  }
+
+  if (key_layout_.is_row_block()) {
+    return redis_client->increase_range_values(to_key(token_id), key_layout_.row_offset(token_id) * topic_size_,
+                                               increment);
+  }
+  return redis_client->increase_values(to_key(token_id), increment);
+}
+
+bool RedisPhiStore::add_to_rows(std::shared_ptr<RedisClient> redis_client, const std::vector<int>& token_ids,
+                                const std::vector<std::shared_ptr<std::vector<float>>>& increments)
+{
+  if (!compress_flush_) {
+    return PhiStore::add_to_rows(redis_client, token_ids, increments);
+  }
+
+  // one lua call per group of rows from one cluster slot
+  std::unordered_map<int, std::vector<size_t>> slot_groups;
+  for (size_t i = 0; i < token_ids.size(); ++i) {
+    const std::string key = to_key(token_ids[i]);
+    slot_groups[RedisCluster::SlotHash::SlotByKey(key.c_str(), static_cast<int>(key.size()))].push_back(i);
+  }
+
+  bool is_ok = true;
+  size_t encoded_size = 0;
+  for (const auto& group : slot_groups) {
+    for (size_t begin = 0; begin < group.second.size(); begin += kMaxRowsPerFlush) {
+      const size_t end = std::min(begin + kMaxRowsPerFlush, group.second.size());
+
+      std::vector<int> group_token_ids;
+      std::vector<const std::vector<float>*> group_increments;
+      for (size_t i = begin; i < end; ++i) {
+        group_token_ids.push_back(token_ids[group.second[i]]);
+        group_increments.push_back(increments[group.second[i]].get());
+      }
+
+      encoded_size += add_to_slot_rows(redis_client, group_token_ids, group_increments, &is_ok);
+    }
+  }
+
+  if (!token_ids.empty()) {
+    LOG(INFO) << "Flush of " << model_name_ << ": " << token_ids.size() << " rows in " << slot_groups.size()
+              << " slots, compression ratio " << static_cast<double>(encoded_size) /
+                 (token_ids.size() * topic_size_ * sizeof(float));
+  }
+  return is_ok;
+}
+
+size_t RedisPhiStore::add_to_slot_rows(std::shared_ptr<RedisClient> redis_client,
+                                       const std::vector<int>& token_ids,
+                                       const std::vector<const std::vector<float>*>& increments,
+                                       bool* is_ok)
+{
+  std::vector<std::string> keys(token_ids.size());
+  std::vector<int> offsets(token_ids.size());
+  std::vector<std::string> rows(token_ids.size());
+
+  size_t encoded_size = 0;
+  for (size_t i = 0; i < token_ids.size(); ++i) {
+    RowCodec::encode(increments[i]->data(), topic_size_, ValueEncoding::FLOAT32, &rows[i]);
+    keys[i] = to_key(token_ids[i]);
+    offsets[i] = key_layout_.row_offset(token_ids[i]) * topic_size_;
+    encoded_size += rows[i].size();
+  }
+
+  // lua call doesn't pay off for one badly compressed row
+  const size_t dense_size = token_ids.size() * topic_size_ * sizeof(float);
+  bool retval = true;
+  if (token_ids.size() == 1 && encoded_size > kMaxFlushCompressionRatio * dense_size) {
+    retval = add_to_row(redis_client, token_ids[0], *increments[0]);
+  } else {
+    retval = redis_client->increase_encoded_rows(keys, offsets, rows, topic_size_);
+  }
+
+  if (!retval) {
+    LOG(ERROR) << "Compressed update of " << token_ids.size() << " rows of " << model_name_ << " has failed";
+    *is_ok = false;
+  }
+  return encoded_size;
+}
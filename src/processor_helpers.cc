@@ -1,199 +1,348 @@
 #include <algorithm>
+#include <cstdint>
+#include <future>
 
+#include "e_step_kernels.h"
 #include "processor_helpers.h"
 
 namespace {
-  void normalize_theta(int item_index, int inner_iter, int topics_size, const float* n_td) {
-    float sum = 0.0f;
-    for (int topic_index = 0; topic_index < topics_size; ++topic_index) {
-      float val = n_td[topic_index];
-      if (val > 0.0f) {
-        sum += val;
-      }
+  // the serial counting sort is used for smaller chunks, they don't pay off the task switches
+  const int kMinTransposeChunkSize = 16384;
+  // columns of the counts of all chunks are turned into offsets by blocks, that fit in L1
+  const int kTransposeColumnBlockSize = 1024;
+  // E-step splits a batch into parts of at least this number of elements
+  const int kMinEStepPartSize = 2048;
+
+  // splits rows [0, num_rows) of a csr matrix into num_parts ranges of about the same number of
+  // elements, range p is [bounds[p], bounds[p + 1])
+  void split_rows(const int* row_ptr, int num_rows, int num_parts, std::vector<int>* bounds) {
+    const int nnz = row_ptr[num_rows];
+    bounds->resize(num_parts + 1);
+    for (int p = 0; p < num_parts; ++p) {
+      const int first_element = static_cast<int>(static_cast<int64_t>(nnz) * p / num_parts);
+      (*bounds)[p] = static_cast<int>(std::lower_bound(row_ptr, row_ptr + num_rows, first_element) - row_ptr);
     }
+    (*bounds)[num_parts] = num_rows;
+  }
 
-    float sum_inv = sum > 0.0f ? (1.0f / sum) : 0.0f;
-    for (int topic_index = 0; topic_index < topics_size; ++topic_index) {
-      float val = sum_inv * (n_td[topic_index]);
-      if (val < kEps) {
-        val = 0.0f;
+  // calls function(p) for each part, in parallel if there is a pool
+  template <typename Function>
+  void for_each_part(TaskPool* pool, int num_parts, const Function& function) {
+    if (pool == nullptr) {
+      for (int p = 0; p < num_parts; ++p) {
+        function(p);
       }
-
-      const_cast<float*>(n_td)[topic_index] = val;
+    } else {
+      pool->parallel_for(num_parts, function);
     }
   }
 }
 
 std::shared_ptr<LocalThetaMatrix<float>> ProcessorHelpers::initialize_theta(int topic_size, const artm::Batch& batch) {
-  auto Theta = std::make_shared<LocalThetaMatrix<float>>(topic_size, batch.item_size());
+  auto Theta = std::make_shared<LocalThetaMatrix<float>>();
+  initialize_theta(topic_size, batch, Theta.get());
+  return Theta;
+}
 
-  Theta->InitializeZeros();
+void ProcessorHelpers::initialize_theta(int topic_size, const artm::Batch& batch, LocalThetaMatrix<float>* theta) {
+  theta->Resize(topic_size, batch.item_size());
   for (int item_index = 0; item_index < batch.item_size(); ++item_index) {
     const float default_theta = 1.0f / topic_size;
     for (int iTopic = 0; iTopic < topic_size; ++iTopic) {
-      (*Theta)(iTopic, item_index) = default_theta;
+      (*theta)(iTopic, item_index) = default_theta;
     }
   }
-  return Theta;
 }
 
 std::shared_ptr<CsrMatrix<float>> ProcessorHelpers::initialize_sparse_ndw(const artm::Batch& batch) {
-  std::vector<float> n_dw_val;
-  std::vector<int> n_dw_row_ptr;
-  std::vector<int> n_dw_col_ind;
+  auto sparse_ndw = std::make_shared<CsrMatrix<float>>();
+  initialize_sparse_ndw(batch, sparse_ndw.get());
+  return sparse_ndw;
+}
+
+void ProcessorHelpers::initialize_sparse_ndw(const artm::Batch& batch, CsrMatrix<float>* sparse_ndw) {
+  int nnz = 0;
+  for (const auto& item : batch.item()) {
+    nnz += item.token_id_size();
+  }
+
+  sparse_ndw->Resize(batch.item_size(), batch.token_size(), nnz);
+  float* n_dw_val = sparse_ndw->val();
+  int* n_dw_row_ptr = sparse_ndw->row_ptr();
+  int* n_dw_col_ind = sparse_ndw->col_ind();
 
   // For sparse case
+  int index = 0;
   for (int item_index = 0; item_index < batch.item_size(); ++item_index) {
-    n_dw_row_ptr.push_back(static_cast<int>(n_dw_val.size()));
+    n_dw_row_ptr[item_index] = index;
     const auto& item = batch.item(item_index);
 
     for (int token_index = 0; token_index < item.token_id_size(); ++token_index) {
-      const int token_id = item.token_id(token_index);
-      const float token_weight = item.token_weight(token_index);
+      n_dw_val[index] = item.token_weight(token_index);
+      n_dw_col_ind[index] = item.token_id(token_index);
+      ++index;
+    }
+  }
+  n_dw_row_ptr[batch.item_size()] = index;
+}
+
+void ProcessorHelpers::transpose_sparse_ndw(const CsrMatrix<float>& sparse_ndw,
+                                            CsrMatrix<float>* sparse_nwd,
+                                            EStepWorkspace* workspace,
+                                            TaskPool* pool)
+{
+  const int docs_count = sparse_ndw.m();
+  const int tokens_count = sparse_ndw.n();
+  const int nnz = sparse_ndw.nnz();
+  const int num_chunks = pool == nullptr ? 1 : std::min(pool->size(), nnz / kMinTransposeChunkSize);
+  if (num_chunks < 2) {
+    sparse_ndw.TransposeTo(sparse_nwd);
+    return;
+  }
 
-      n_dw_val.push_back(token_weight);
-      n_dw_col_ind.push_back(token_id);
+  sparse_nwd->Resize(tokens_count, docs_count, nnz);
+  const int* n_dw_row_ptr = sparse_ndw.row_ptr();
+  const int* n_dw_col_ind = sparse_ndw.col_ind();
+  const float* n_dw_val = sparse_ndw.val();
+  int* n_wd_row_ptr = sparse_nwd->row_ptr();
+  int* n_wd_col_ind = sparse_nwd->col_ind();
+  float* n_wd_val = sparse_nwd->val();
+
+  // chunk c has documents [chunks[c], chunks[c + 1])
+  std::vector<int>& chunks = workspace->transpose_chunks;
+  split_rows(n_dw_row_ptr, docs_count, num_chunks, &chunks);
+
+  // counts[c * tokens_count + w] is the number of elements of token w in chunk c,
+  // then it's the position of the next of them in row w of sparse_nwd
+  std::vector<int>& counts = workspace->transpose_counts;
+  counts.resize(static_cast<size_t>(num_chunks) * tokens_count);
+
+  pool->parallel_for(num_chunks, [&](int c) {
+    int* chunk_counts = &counts[static_cast<size_t>(c) * tokens_count];
+    std::fill(chunk_counts, chunk_counts + tokens_count, 0);
+    for (int i = n_dw_row_ptr[chunks[c]]; i < n_dw_row_ptr[chunks[c + 1]]; ++i) {
+      ++chunk_counts[n_dw_col_ind[i]];
+    }
+  });
+
+  // offsets within rows of sparse_nwd follow the order of chunks, so the result is the same
+  // as the one of the serial sort; sizes of rows are accumulated in row_ptr[w + 1]
+  const int num_column_blocks = (tokens_count + kTransposeColumnBlockSize - 1) / kTransposeColumnBlockSize;
+  pool->parallel_for(num_column_blocks, [&](int block) {
+    const int block_begin = block * kTransposeColumnBlockSize;
+    const int block_end = std::min(block_begin + kTransposeColumnBlockSize, tokens_count);
+    std::fill(n_wd_row_ptr + block_begin + 1, n_wd_row_ptr + block_end + 1, 0);
+    for (int c = 0; c < num_chunks; ++c) {
+      int* chunk_counts = &counts[static_cast<size_t>(c) * tokens_count];
+      for (int w = block_begin; w < block_end; ++w) {
+        const int count = chunk_counts[w];
+        chunk_counts[w] = n_wd_row_ptr[w + 1];
+        n_wd_row_ptr[w + 1] += count;
+      }
     }
+  });
+
+  n_wd_row_ptr[0] = 0;
+  for (int w = 0; w < tokens_count; ++w) {
+    n_wd_row_ptr[w + 1] += n_wd_row_ptr[w];
   }
-  n_dw_row_ptr.push_back(static_cast<int>(n_dw_val.size()));
-  return std::make_shared<CsrMatrix<float>>(batch.token_size(), &n_dw_val, &n_dw_row_ptr, &n_dw_col_ind);
+
+  pool->parallel_for(num_chunks, [&](int c) {
+    int* chunk_counts = &counts[static_cast<size_t>(c) * tokens_count];
+    for (int d = chunks[c]; d < chunks[c + 1]; ++d) {
+      for (int i = n_dw_row_ptr[d]; i < n_dw_row_ptr[d + 1]; ++i) {
+        const int w = n_dw_col_ind[i];
+        const int position = n_wd_row_ptr[w] + chunk_counts[w]++;
+        n_wd_col_ind[position] = d;
+        n_wd_val[position] = n_dw_val[i];
+      }
+    }
+  });
 }
 
 void ProcessorHelpers::find_batch_token_ids(const artm::Batch& batch,
-                                            const RedisPhiMatrixAdapter& phi_matrix,
+                                            const TokenCollection& token_collection,
                                             std::vector<int>* token_id)
 {
   token_id->resize(batch.token_size(), -1);
   for (int token_index = 0; token_index < batch.token_size(); ++token_index) {
-    token_id->at(token_index) = phi_matrix.token_index(Token(batch.class_id(token_index), batch.token(token_index)));
+    token_id->at(token_index) = token_collection.token_id(batch.class_id(token_index), batch.token(token_index));
   }
 }
 
 void ProcessorHelpers::infer_theta_and_update_nwt_sparse(const artm::Batch& batch,
                                                          const CsrMatrix<float>& sparse_ndw,
+                                                         const std::vector<int>& token_id,
                                                          const RedisPhiMatrixAdapter& p_wt,
                                                          LocalThetaMatrix<float>* theta_matrix,
                                                          NwtWriteAdapter* nwt_writer,
-                                                         Blas* blas,
                                                          int num_inner_iters,
                                                          double* perplexity_value)
 {
-  LocalThetaMatrix<float> n_td(theta_matrix->num_topics(), theta_matrix->num_items());
+  EStepWorkspace workspace;
+  infer_theta_and_update_nwt_sparse(batch, sparse_ndw, nullptr, token_id, p_wt, theta_matrix, nwt_writer,
+                                    num_inner_iters, perplexity_value, &workspace, nullptr);
+}
+
+void ProcessorHelpers::infer_theta_and_update_nwt_sparse(const artm::Batch& batch,
+                                                         const CsrMatrix<float>& sparse_ndw,
+                                                         const CsrMatrix<float>* sparse_nwd,
+                                                         const std::vector<int>& token_id,
+                                                         const RedisPhiMatrixAdapter& p_wt,
+                                                         LocalThetaMatrix<float>* theta_matrix,
+                                                         NwtWriteAdapter* nwt_writer,
+                                                         int num_inner_iters,
+                                                         double* perplexity_value,
+                                                         EStepWorkspace* workspace,
+                                                         TaskPool* pool)
+{
   const int num_topics = p_wt.topic_size();
+  const int padded_topics = EStepKernels::padded_size(num_topics);
+  const EStepKernels kernels = EStepKernels::get(num_topics);
   const int docs_count = theta_matrix->num_items();
   const int tokens_count = batch.token_size();
 
-  std::vector<int> token_id;
-  ProcessorHelpers::find_batch_token_ids(batch, p_wt, &token_id);
-
-  int max_local_token_size = 0;  // find the longest document from the batch
-  for (int d = 0; d < docs_count; ++d) {
-    const int begin_index = sparse_ndw.row_ptr()[d];
-    const int end_index = sparse_ndw.row_ptr()[d + 1];
-    const int local_token_size = end_index - begin_index;
-    max_local_token_size = std::max(max_local_token_size, local_token_size);
+  assert(token_id.size() == static_cast<size_t>(tokens_count));
+  assert(theta_matrix->stride() == padded_topics);
+
+  // theta of each document depends only on p_wt and counters of the document, so documents are
+  // split into parts processed in parallel; then the increment of n_wt of each token depends
+  // only on the token, so tokens are split the same way, and no part writes to the others
+  const int max_num_parts = pool == nullptr ? 1 : pool->size();
+  const int num_parts = std::max(1, std::min(max_num_parts, sparse_ndw.nnz() / kMinEStepPartSize));
+  std::vector<EStepWorkspace::Part>& parts = workspace->parts;
+  std::vector<int>& part_bounds = workspace->part_bounds;
+  if (parts.size() < static_cast<size_t>(num_parts)) {
+    parts.resize(num_parts);
   }
 
-  LocalPhiMatrix<float> local_phi(max_local_token_size, num_topics);
-  std::vector<float> helper_vector(num_topics, 0.0f);
-
-  for (int d = 0; d < docs_count; ++d) {
-    float* ntd_ptr = &n_td(0, d);
-    float* theta_ptr = &(*theta_matrix)(0, d);  // NOLINT
+  // without async client a row would be read by get() of its future anyway
+  const bool read_async = p_wt.has_async_client();
+  split_rows(sparse_ndw.row_ptr(), docs_count, num_parts, &part_bounds);
+  for_each_part(pool, num_parts, [&](int part_index) {
+    EStepWorkspace::Part& part = parts[part_index];
+    const int docs_begin = part_bounds[part_index];
+    const int docs_end = part_bounds[part_index + 1];
+
+    int max_local_token_size = 0;  // find the longest document of the part
+    for (int d = docs_begin; d < docs_end; ++d) {
+      const int begin_index = sparse_ndw.row_ptr()[d];
+      const int end_index = sparse_ndw.row_ptr()[d + 1];
+      const int local_token_size = end_index - begin_index;
+      max_local_token_size = std::max(max_local_token_size, local_token_size);
+    }
 
-    const int begin_index = sparse_ndw.row_ptr()[d];
-    const int end_index = sparse_ndw.row_ptr()[d + 1];
-    local_phi.InitializeZeros();
-    bool item_has_tokens = false;
-    for (int i = begin_index; i < end_index; ++i) {
-      int w = sparse_ndw.col_ind()[i];
-      if (token_id[w] == RedisPhiMatrix::kUndefIndex) {
-        continue;
-      }
-      item_has_tokens = true;
-      float* local_phi_ptr = &local_phi(i - begin_index, 0);
-      p_wt.get(token_id[w], &helper_vector);
-      for (int k = 0; k < num_topics; ++k) {
-        local_phi_ptr[k] = helper_vector[k];
+    // rows of the next item are requested while the current one is processed,
+    // so each of two local phi matrices is either being filled or being used,
+    // rows of them and columns of theta are padded with zeros as the kernels expect
+    LocalPhiMatrix<float>* local_phi_buffers = part.local_phi;
+    std::vector<std::future<void>>* pending_rows = part.pending_rows;
+    local_phi_buffers[0].Resize(max_local_token_size, num_topics);
+    local_phi_buffers[1].Resize(max_local_token_size, num_topics);
+    assert(local_phi_buffers[0].stride() == padded_topics || max_local_token_size == 0);
+    bool has_tokens[2] = { false, false };
+
+    auto request_rows = [&](int d) {
+      const int buffer_id = d % 2;
+      LocalPhiMatrix<float>& local_phi = local_phi_buffers[buffer_id];
+      const int begin_index = sparse_ndw.row_ptr()[d];
+      const int end_index = sparse_ndw.row_ptr()[d + 1];
+
+      has_tokens[buffer_id] = false;
+      pending_rows[buffer_id].clear();
+      for (int i = begin_index; i < end_index; ++i) {
+        int w = sparse_ndw.col_ind()[i];
+        float* row = &local_phi(i - begin_index, 0);
+        if (token_id[w] == RedisPhiMatrix::kUndefIndex) {
+          std::fill(row, row + num_topics, 0.0f);
+          continue;
+        }
+        has_tokens[buffer_id] = true;
+        // the row (dense or sparse) is decoded right into local phi
+        if (read_async) {
+          pending_rows[buffer_id].push_back(p_wt.get_async(token_id[w], row));
+        } else {
+          p_wt.get(token_id[w], row);
+        }
       }
-    }
+    };
 
-    if (!item_has_tokens) {
-      continue;  // continue to the next item
+    if (docs_begin < docs_end) {
+      request_rows(docs_begin);
     }
 
-    for (int inner_iter = 0; inner_iter < num_inner_iters; ++inner_iter) {
-      for (int k = 0; k < num_topics; ++k) {
-        ntd_ptr[k] = 0.0f;
-      }
-
-      for (int i = begin_index; i < end_index; ++i) {
-        const float* phi_ptr = &local_phi(i - begin_index, 0);
+    std::vector<float>& n_td = part.n_td;
+    n_td.resize(padded_topics);
+    for (int d = docs_begin; d < docs_end; ++d) {
+      float* theta_ptr = &(*theta_matrix)(0, d);  // NOLINT
 
-        float p_dw_val = 0;
-        for (int k = 0; k < num_topics; ++k) {
-          p_dw_val += phi_ptr[k] * theta_ptr[k];
-        }
-        if (p_dw_val == 0) {
-          continue;
-        }
+      if (d + 1 < docs_end) {
+        request_rows(d + 1);
+      }
 
-        const float alpha = sparse_ndw.val()[i] / p_dw_val;
-        for (int k = 0; k < num_topics; ++k) {
-          ntd_ptr[k] += alpha * phi_ptr[k];
-        }
+      const int begin_index = sparse_ndw.row_ptr()[d];
+      const int end_index = sparse_ndw.row_ptr()[d + 1];
+      const LocalPhiMatrix<float>& local_phi = local_phi_buffers[d % 2];
+      for (auto& row : pending_rows[d % 2]) {
+        row.get();
       }
 
-      for (int k = 0; k < num_topics; ++k) {
-        theta_ptr[k] *= ntd_ptr[k];
+      if (!has_tokens[d % 2]) {
+        continue;  // continue to the next item
       }
 
-      normalize_theta(d, inner_iter, num_topics, theta_ptr);
+      kernels.infer_theta(num_topics, &local_phi(0, 0), sparse_ndw.val() + begin_index, end_index - begin_index,
+                          num_inner_iters, theta_ptr, &n_td[0]);
     }
-  }
+  });
 
   if (nwt_writer == nullptr) {
     return;
   }
 
-  std::vector<int> token_nwt_id;
-  ProcessorHelpers::find_batch_token_ids(batch, *nwt_writer->n_wt(), &token_nwt_id);
-
-  CsrMatrix<float> sparse_nwd(sparse_ndw);
-  sparse_nwd.Transpose(blas);
+  assert(nwt_writer->n_wt()->token_collection() == p_wt.token_collection());
 
-  std::vector<float> p_wt_local(num_topics, 0.0f);
-  std::vector<float> n_wt_local(num_topics, 0.0f);
-  for (int w = 0; w < tokens_count; ++w) {
-    if (token_nwt_id[w] == -1) {
-      continue;
-    }
+  if (sparse_nwd == nullptr) {
+    transpose_sparse_ndw(sparse_ndw, &workspace->n_wd, workspace, pool);
+    sparse_nwd = &workspace->n_wd;
+  }
+  assert(sparse_nwd->m() == tokens_count && sparse_nwd->nnz() == sparse_ndw.nnz());
+
+  split_rows(sparse_nwd->row_ptr(), tokens_count, num_parts, &part_bounds);
+  for_each_part(pool, num_parts, [&](int part_index) {
+    EStepWorkspace::Part& part = parts[part_index];
+    std::vector<float>& p_wt_local = part.p_wt;
+    std::vector<float>& n_wt_local = part.n_wt;
+    p_wt_local.resize(num_topics);
+    n_wt_local.assign(num_topics, 0.0f);
+    part.perplexity_value = 0.0;
+    for (int w = part_bounds[part_index]; w < part_bounds[part_index + 1]; ++w) {
+      if (token_id[w] == -1) {
+        continue;
+      }
 
-    if (token_id[w] != -1) {
       p_wt.get(token_id[w], &p_wt_local);
-    } else {
-      p_wt_local.assign(num_topics, 1.0f);
-    }
 
-    for (int i = sparse_nwd.row_ptr()[w]; i < sparse_nwd.row_ptr()[w + 1]; ++i) {
-      int d = sparse_nwd.col_ind()[i];
-      float p_wd_val = blas->sdot(num_topics, &p_wt_local[0], 1, &(*theta_matrix)(0, d), 1);  // NOLINT
-      if (p_wd_val < kEps) {
-        continue;
+      const int begin_index = sparse_nwd->row_ptr()[w];
+      const int end_index = sparse_nwd->row_ptr()[w + 1];
+      part.perplexity_value += kernels.update_nwt(num_topics, &p_wt_local[0],
+                                                  theta_matrix->get_data(), theta_matrix->stride(),
+                                                  sparse_nwd->col_ind() + begin_index,
+                                                  sparse_nwd->val() + begin_index,
+                                                  end_index - begin_index, &n_wt_local[0]);
+
+      // n_wt of the token is turned into values of the increment and zeroed after
+      for (int topic_index = 0; topic_index < num_topics; ++topic_index) {
+        n_wt_local[topic_index] *= p_wt_local[topic_index];
       }
-      blas->saxpy(num_topics, sparse_nwd.val()[i] / p_wd_val,
-        &(*theta_matrix)(0, d), 1, &n_wt_local[0], 1);  // NOLINT
-
-      // compute perplexity
-      *perplexity_value += p_wd_val > 0.0f ? static_cast<double>(sparse_nwd.val()[i] * log(p_wd_val)) : 0.0;
-    }
 
-    std::vector<float> values(num_topics, 0.0f);
-    for (int topic_index = 0; topic_index < num_topics; ++topic_index) {
-      values[topic_index] = p_wt_local[topic_index] * n_wt_local[topic_index];
-      n_wt_local[topic_index] = 0.0f;
+      nwt_writer->store(token_id[w], n_wt_local);
+      std::fill(n_wt_local.begin(), n_wt_local.end(), 0.0f);
     }
+  });
 
-    nwt_writer->store(token_nwt_id[w], values);
+  // parts are summed in the same order whatever thread has processed them
+  for (int part_index = 0; part_index < num_parts; ++part_index) {
+    *perplexity_value += parts[part_index].perplexity_value;
   }
 }
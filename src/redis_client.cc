@@ -1,106 +1,523 @@
+#include <algorithm>
+#include <cstdarg>
+#include <cstring>
+#include <unordered_map>
+
+#include "metrics.h"
+#include "mock_redis.h"
 #include "redis_client.h"
 
-void RedisClient::set_values(const std::string& key, const std::vector<float>& values) const {
-  auto val_ptr = reinterpret_cast<const char*>(&(values[0]));
-  auto val_size = (size_t) (values.size() * sizeof(float));
+namespace {
+  // KEYS[1] - key of the value, ARGV[1] - byte offset, ARGV[2] - new data of the range
+  const std::string kGetSetRangeScript =
+    "local offset = tonumber(ARGV[1]) "
+    "local old = redis.call('GETRANGE', KEYS[1], offset, offset + string.len(ARGV[2]) - 1) "
+    "redis.call('SETRANGE', KEYS[1], offset, ARGV[2]) "
+    "return old";
+
+  // KEYS[1] - key of the value, ARGV[1] - byte offset, ARGV[2] - increments of the range (floats)
+  const std::string kIncreaseRangeScript =
+    "local offset = tonumber(ARGV[1]) "
+    "local inc = ARGV[2] "
+    "local old = redis.call('GETRANGE', KEYS[1], offset, offset + string.len(inc) - 1) "
+    "local res = {} "
+    "for i = 1, string.len(inc), 4 do "
+    "  local value = struct.unpack('<f', inc, i) "
+    "  if i + 3 <= string.len(old) then value = value + struct.unpack('<f', old, i) end "
+    "  res[#res + 1] = struct.pack('<f', value) "
+    "end "
+    "redis.call('SETRANGE', KEYS[1], offset, table.concat(res)) "
+    "return 1";
+
+  // KEYS - keys of the values, ARGV[1] - number of values in row,
+  // ARGV[2 * i] - byte offset of i-th row, ARGV[2 * i + 1] - increments of i-th row encoded by RowCodec
+  const std::string kIncreaseRowsScript =
+    "local num_values = tonumber(ARGV[1]) "
+    "local index_format, index_size = '<I4', 4 "
+    "if num_values <= 65536 then index_format, index_size = '<H', 2 end "
+    "for i = 1, #KEYS do "
+    "  local offset = tonumber(ARGV[2 * i]) "
+    "  local row = ARGV[2 * i + 1] "
+    "  if string.byte(row, 1) == 0 then "
+    "    local old = redis.call('GETRANGE', KEYS[i], offset, offset + 4 * num_values - 1) "
+    "    local res = {} "
+    "    for k = 0, num_values - 1 do "
+    "      local value = struct.unpack('<f', row, 2 + 4 * k) "
+    "      if 4 * k + 4 <= string.len(old) then value = value + struct.unpack('<f', old, 1 + 4 * k) end "
+    "      res[#res + 1] = struct.pack('<f', value) "
+    "    end "
+    "    redis.call('SETRANGE', KEYS[i], offset, table.concat(res)) "
+    "  else "
+    "    local num_non_zeros = (string.len(row) - 1) / (index_size + 4) "
+    "    local values_begin = 2 + num_non_zeros * index_size "
+    "    for j = 0, num_non_zeros - 1 do "
+    "      local position = offset + 4 * struct.unpack(index_format, row, 2 + j * index_size) "
+    "      local old = redis.call('GETRANGE', KEYS[i], position, position + 3) "
+    "      local value = struct.unpack('<f', row, values_begin + 4 * j) "
+    "      if string.len(old) == 4 then value = value + struct.unpack('<f', old, 1) end "
+    "      redis.call('SETRANGE', KEYS[i], position, struct.pack('<f', value)) "
+    "    end "
+    "  end "
+    "end "
+    "return #KEYS";
+
+  // decodes available bytes of reply into values, the rest is filled with zeros
+  void reply_to_values(const redisReply* reply, float* values, int values_size, ValueEncoding encoding) {
+    if (reply->type == REDIS_REPLY_STRING) {
+      ValueEncoder::decode(reply->str, reply->len, values_size, encoding, values);
+    } else {
+      std::fill(values, values + values_size, 0.0f);
+    }
+  }
+
+  std::vector<float> reply_to_values(const redisReply* reply, int values_size, ValueEncoding encoding) {
+    std::vector<float> retval(values_size, 0.0f);
+    if (values_size > 0) {
+      reply_to_values(reply, &retval[0], values_size, encoding);
+    }
+    return retval;
+  }
+
+  std::string reply_to_string(const redisReply* reply) {
+    if (reply->type == REDIS_REPLY_STRING) {
+      return std::string(reply->str, reply->len);
+    }
+    return std::string();
+  }
+
+  bool is_noscript_error(const redisReply* reply) {
+    return reply->type == REDIS_REPLY_ERROR && std::string(reply->str, reply->len).find("NOSCRIPT") == 0;
+  }
+
+  // raw bytes of values in the given encoding, float32 values are sent without copying
+  class EncodedValues {
+   public:
+    EncodedValues(const std::vector<float>& values, ValueEncoding encoding)
+        : data_(reinterpret_cast<const char*>(values.data()))
+        , size_(values.size() * ValueEncoder::bytes_per_value(encoding))
+    {
+      if (encoding != ValueEncoding::FLOAT32) {
+        buffer_.resize(size_);
+        ValueEncoder::encode(values.data(), values.size(), encoding, buffer_.data());
+        data_ = buffer_.data();
+      }
+    }
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+   private:
+    std::vector<char> buffer_;
+    const char* data_;
+    size_t size_;
+  };
+
+  struct CommandMetrics {
+    Counter* ops;
+    Counter* bytes_sent;
+    Counter* bytes_received;
+    LatencyHistogram* latency_us;
+  };
+
+  // metrics of the command type (GET, SETRANGE, ...) in the registry of the calling thread,
+  // command names are short enough for small string optimization, so lookups don't allocate
+  CommandMetrics& command_metrics(const std::string& command_name) {
+    thread_local MetricsRegistry* registry = nullptr;
+    thread_local std::unordered_map<std::string, CommandMetrics> cache;
+
+    MetricsRegistry& current = MetricsRegistry::current();
+    if (registry != &current) {
+      cache.clear();
+      registry = &current;
+    }
+
+    auto iter = cache.find(command_name);
+    if (iter == cache.end()) {
+      const std::string prefix = "redis." + command_name + ".";
+      CommandMetrics metrics = { &current.counter(prefix + "ops"), &current.counter(prefix + "bytes_sent"),
+                                 &current.counter(prefix + "bytes_received"),
+                                 &current.histogram(prefix + "latency_us") };
+      iter = cache.emplace(command_name, metrics).first;
+    }
+    return iter->second;
+  }
+
+  // payload bytes of the formatted command: literals and arguments ('%b' - binary string,
+  // '%s' - c string, '%d' - int), protocol framing is not counted
+  size_t command_size(const char* format, va_list ap) {
+    va_list args;
+    va_copy(args, ap);
+
+    size_t retval = 0;
+    for (const char* c = format; *c != '\0'; ++c) {
+      if (*c != '%') {
+        retval += (*c != ' ');
+        continue;
+      }
+
+      ++c;
+      if (*c == 'b') {
+        va_arg(args, const char*);
+        retval += va_arg(args, size_t);
+      } else if (*c == 's') {
+        retval += strlen(va_arg(args, const char*));
+      } else if (*c == 'd') {
+        int value = va_arg(args, int);
+        do {
+          ++retval;
+        } while ((value /= 10) != 0);
+      } else if (*c == '\0') {
+        break;
+      }
+    }
+
+    va_end(args);
+    return retval;
+  }
 
-  reply_ = (redisReply*) HiredisCommand<>::Command(context_, key.c_str(), "SET %s %b", key.c_str(), val_ptr, val_size);
-  clean_reply();
+  size_t reply_size(const redisReply* reply) {
+    if (reply == nullptr) {
+      return 0;
+    }
+    if (reply->type == REDIS_REPLY_INTEGER) {
+      return sizeof(reply->integer);
+    }
+    if (reply->type == REDIS_REPLY_ARRAY) {
+      size_t retval = 0;
+      for (size_t i = 0; i < reply->elements; ++i) {
+        retval += reply_size(reply->element[i]);
+      }
+      return retval;
+    }
+    return reply->len;
+  }
 }
 
-std::vector<float> RedisClient::get_values(const std::string& key, int values_size) const {
-  reply_ = (redisReply*) HiredisCommand<>::Command(context_, key.c_str(), "GET %s", key.c_str());
+const std::string& RedisClient::get_set_range_script() {
+  return kGetSetRangeScript;
+}
 
-  auto values = reinterpret_cast<const float*>(reply_->str);
-  auto retval = std::vector<float>(values, values + values_size);
+const std::string& RedisClient::increase_range_script() {
+  return kIncreaseRangeScript;
+}
 
-  clean_reply();
-  return retval;
+const std::string& RedisClient::increase_rows_script() {
+  return kIncreaseRowsScript;
 }
 
-std::vector<float> RedisClient::get_set_values(const std::string& key, const std::vector<float>& set_values) {
-  auto val_ptr = reinterpret_cast<const char*>(&(set_values[0]));
-  auto val_size = (size_t) (set_values.size() * sizeof(float));
+RedisReplyPtr RedisClient::command(const std::string& key, const char* format, ...) const {
+  CommandMetrics& metrics = command_metrics(std::string(format, strcspn(format, " ")));
+  ScopedLatency latency(metrics.latency_us);
+
+  va_list ap;
+  va_start(ap, format);
+  metrics.ops->add();
+  metrics.bytes_sent->add(command_size(format, ap));
+
+  if (mock_ != nullptr) {
+    std::vector<std::string> argv;
+    try {
+      argv = MockRedis::format_command(format, ap);
+    } catch (...) {
+      va_end(ap);
+      throw;
+    }
+    va_end(ap);
+
+    RedisReplyPtr reply(mock_->command(argv));
+    metrics.bytes_received->add(reply_size(reply.get()));
+    return reply;
+  }
 
-  reply_ = (redisReply*) HiredisCommand<>::Command(context_, key.c_str(), "GETSET %s %b", key.c_str(), val_ptr, val_size);
+  auto connection = pool_->lease();
+  try {
+    RedisReplyPtr reply(static_cast<redisReply*>(HiredisCommand<>::Command(connection.cluster(), key, format, ap)));
+    metrics.bytes_received->add(reply_size(reply.get()));
+    va_end(ap);
+    return reply;
+  } catch (const ClusterException&) {
+    va_end(ap);
+    connection.set_broken();
+    throw;
+  }
+}
 
-  auto values = reinterpret_cast<const float*>(reply_->str);
-  auto retval = std::vector<float>(values, values + set_values.size());
+RedisReplyPtr RedisClient::command(const std::string& key, int argc, const char** argv, const size_t* argvlen) const {
+  CommandMetrics& metrics = command_metrics(std::string(argv[0], argvlen[0]));
+  ScopedLatency latency(metrics.latency_us);
 
-  clean_reply();
-  return retval;
+  metrics.ops->add();
+  for (int i = 0; i < argc; ++i) {
+    metrics.bytes_sent->add(argvlen[i]);
+  }
+
+  if (mock_ != nullptr) {
+    std::vector<std::string> args;
+    for (int i = 0; i < argc; ++i) {
+      args.emplace_back(argv[i], argvlen[i]);
+    }
+
+    RedisReplyPtr reply(mock_->command(args));
+    metrics.bytes_received->add(reply_size(reply.get()));
+    return reply;
+  }
+
+  auto connection = pool_->lease();
+  try {
+    RedisReplyPtr reply(static_cast<redisReply*>(
+      HiredisCommand<>::Command(connection.cluster(), key, argc, argv, argvlen)));
+    metrics.bytes_received->add(reply_size(reply.get()));
+    return reply;
+  } catch (const ClusterException&) {
+    connection.set_broken();
+    throw;
+  }
 }
 
-void RedisClient::set_value(const std::string& key, const std::string& value) const {
-  reply_ = (redisReply*) HiredisCommand<>::Command(context_, key.c_str(),
-    "SET %s %b", key.c_str(), value.c_str(), value.size());
+void RedisClient::set_values(const std::string& key, const std::vector<float>& values,
+                             ValueEncoding encoding) const
+{
+  EncodedValues encoded(values, encoding);
 
-  clean_reply();
+  command(key, "SET %b %b", key.data(), key.size(), encoded.data(), encoded.size());
 }
 
-std::string RedisClient::get_value(const std::string& key) const {
-  reply_ = (redisReply*) HiredisCommand<>::Command(context_, key.c_str(), "EXISTS %s", key.c_str());
+std::vector<float> RedisClient::get_values(const std::string& key, int values_size, ValueEncoding encoding) const {
+  auto reply = command(key, "GET %b", key.data(), key.size());
+  return reply_to_values(reply.get(), values_size, encoding);
+}
 
-  if (reply_->integer == 0) {
-    clean_reply();
-    throw std::runtime_error("get_value: no such key in redis: " + key);
+void RedisClient::get_values(const std::string& key, float* values, int values_size, ValueEncoding encoding) const {
+  auto reply = command(key, "GET %b", key.data(), key.size());
+  reply_to_values(reply.get(), values, values_size, encoding);
+}
+
+std::vector<float> RedisClient::get_set_values(const std::string& key, const std::vector<float>& set_values,
+                                               ValueEncoding encoding)
+{
+  EncodedValues encoded(set_values, encoding);
+
+  auto reply = command(key, "GETSET %b %b", key.data(), key.size(), encoded.data(), encoded.size());
+  return reply_to_values(reply.get(), set_values.size(), encoding);
+}
+
+void RedisClient::set_range_values(const std::string& key, int offset, const std::vector<float>& values,
+                                   ValueEncoding encoding) const
+{
+  EncodedValues encoded(values, encoding);
+  const int byte_offset = static_cast<int>(offset * ValueEncoder::bytes_per_value(encoding));
+
+  command(key, "SETRANGE %b %d %b", key.data(), key.size(), byte_offset, encoded.data(), encoded.size());
+}
+
+std::vector<float> RedisClient::get_range_values(const std::string& key, int offset, int values_size,
+                                                 ValueEncoding encoding) const
+{
+  std::vector<float> retval(values_size, 0.0f);
+  if (values_size > 0) {
+    get_range_values(key, offset, &retval[0], values_size, encoding);
   }
+  return retval;
+}
+
+void RedisClient::get_range_values(const std::string& key, int offset, float* values, int values_size,
+                                   ValueEncoding encoding) const
+{
+  const size_t bytes_per_value = ValueEncoder::bytes_per_value(encoding);
+  const int begin = static_cast<int>(offset * bytes_per_value);
+  const int end = static_cast<int>((offset + values_size) * bytes_per_value) - 1;
 
-  clean_reply();
+  auto reply = command(key, "GETRANGE %b %d %d", key.data(), key.size(), begin, end);
+  reply_to_values(reply.get(), values, values_size, encoding);
+}
 
-  reply_ = (redisReply*) HiredisCommand<>::Command(context_, key.c_str(), "GET %s", key.c_str());
+std::vector<float> RedisClient::get_set_range_values(const std::string& key, int offset,
+                                                     const std::vector<float>& values, ValueEncoding encoding)
+{
+  EncodedValues encoded(values, encoding);
+  const int byte_offset = static_cast<int>(offset * ValueEncoder::bytes_per_value(encoding));
+  auto reply = eval_range_script(kGetSetRangeScript, &get_set_range_sha_, key, byte_offset,
+                                 encoded.data(), encoded.size());
+
+  return reply_to_values(reply.get(), values.size(), encoding);
+}
 
-  std::string retval = std::string(reply_->str);
-  clean_reply();
+bool RedisClient::increase_range_values(const std::string& key, int offset,
+                                        const std::vector<float>& increments) const
+{
+  EncodedValues encoded(increments, ValueEncoding::FLOAT32);
+  const int byte_offset = static_cast<int>(offset * sizeof(float));
+  auto reply = eval_range_script(kIncreaseRangeScript, &increase_range_sha_, key, byte_offset,
+                                 encoded.data(), encoded.size());
 
+  return reply->type == REDIS_REPLY_INTEGER;
+}
+
+bool RedisClient::increase_encoded_rows(const std::vector<std::string>& keys, const std::vector<int>& offsets,
+                                        const std::vector<std::string>& rows, int num_values) const
+{
+  if (keys.empty()) {
+    return true;
+  }
+
+  std::vector<std::string> args;
+  args.reserve(1 + 2 * rows.size());
+  args.push_back(std::to_string(num_values));
+  for (size_t i = 0; i < rows.size(); ++i) {
+    args.push_back(std::to_string(offsets[i] * sizeof(float)));
+    args.push_back(rows[i]);
+  }
+
+  auto reply = eval_script(kIncreaseRowsScript, &increase_rows_sha_, keys[0], keys, args);
+  return reply->type == REDIS_REPLY_INTEGER;
+}
+
+std::string RedisClient::load_script(const std::string& script, ScriptSha* sha, const std::string& route_key) const {
+  std::string retval = sha->get();
+  if (retval.empty()) {
+    auto reply = command(route_key, "SCRIPT LOAD %b", script.data(), script.size());
+    if (reply->type == REDIS_REPLY_STRING) {
+      retval = std::string(reply->str, reply->len);
+      sha->set(retval);
+    }
+  }
   return retval;
 }
 
+RedisReplyPtr RedisClient::eval_script(const std::string& script, ScriptSha* sha, const std::string& route_key,
+                                       const std::vector<std::string>& keys,
+                                       const std::vector<std::string>& args) const
+{
+  const std::string num_keys = std::to_string(keys.size());
+
+  // argv[0] is the command, argv[1] is either sha or script
+  std::vector<const char*> argv(3, nullptr);
+  std::vector<size_t> argvlen(3, 0);
+  argv[2] = num_keys.data();
+  argvlen[2] = num_keys.size();
+  for (const auto& key : keys) {
+    argv.push_back(key.data());
+    argvlen.push_back(key.size());
+  }
+  for (const auto& arg : args) {
+    argv.push_back(arg.data());
+    argvlen.push_back(arg.size());
+  }
+
+  const std::string script_sha = load_script(script, sha, route_key);
+  if (!script_sha.empty()) {
+    argv[0] = "EVALSHA";
+    argvlen[0] = 7;
+    argv[1] = script_sha.data();
+    argvlen[1] = script_sha.size();
+    auto reply = command(route_key, argv.size(), &argv[0], &argvlen[0]);
+
+    if (!is_noscript_error(reply.get())) {
+      return reply;
+    }
+  }
+
+  argv[0] = "EVAL";
+  argvlen[0] = 4;
+  argv[1] = script.data();
+  argvlen[1] = script.size();
+  return command(route_key, argv.size(), &argv[0], &argvlen[0]);
+}
+
+RedisReplyPtr RedisClient::eval_range_script(const std::string& script, ScriptSha* sha, const std::string& key,
+                                             int byte_offset, const char* data, size_t data_size) const
+{
+  const std::string script_sha = load_script(script, sha, key);
+  if (!script_sha.empty()) {
+    auto reply = command(key, "EVALSHA %b 1 %b %d %b",
+      script_sha.data(), script_sha.size(), key.data(), key.size(), byte_offset, data, data_size);
+
+    // scripts are cached by each node separately
+    if (!is_noscript_error(reply.get())) {
+      return reply;
+    }
+  }
+
+  return command(key, "EVAL %b 1 %b %d %b",
+    script.data(), script.size(), key.data(), key.size(), byte_offset, data, data_size);
+}
+
+void RedisClient::set_raw_value(const std::string& key, const std::string& data) const {
+  command(key, "SET %b %b", key.data(), key.size(), data.data(), data.size());
+}
+
+std::string RedisClient::get_raw_value(const std::string& key) const {
+  auto reply = command(key, "GET %b", key.data(), key.size());
+  return reply_to_string(reply.get());
+}
+
+std::string RedisClient::get_set_raw_value(const std::string& key, const std::string& data) {
+  auto reply = command(key, "GETSET %b %b", key.data(), key.size(), data.data(), data.size());
+  return reply_to_string(reply.get());
+}
+
+void RedisClient::set_value(const std::string& key, const std::string& value) const {
+  command(key, "SET %b %b", key.data(), key.size(), value.c_str(), value.size());
+}
+
+std::string RedisClient::get_value(const std::string& key) const {
+  auto exists_reply = command(key, "EXISTS %b", key.data(), key.size());
+  if (exists_reply->integer == 0) {
+    throw std::runtime_error("get_value: no such key in redis: " + key);
+  }
+
+  auto reply = command(key, "GET %b", key.data(), key.size());
+  return std::string(reply->str);
+}
+
 void RedisClient::set_hashmap(const std::string& key, const Normalizers& hashmap) const {
-  reply_ = (redisReply*) HiredisCommand<>::Command(context_, key.c_str(), "DEL %s", key.c_str());
-  clean_reply();
+  command(key, "DEL %b", key.data(), key.size());
 
   for (const auto& kv : hashmap) {
     auto val_ptr = reinterpret_cast<const char*>(&(kv.second[0]));
     auto val_size = (size_t) (kv.second.size() * sizeof(double));
 
-    reply_ = (redisReply*) HiredisCommand<>::Command(context_, key.c_str(),
-      "HSET %s %s %b", key.c_str(), kv.first.c_str(), val_ptr, val_size);
-
-    clean_reply();
+    command(key, "HSET %b %s %b", key.data(), key.size(), kv.first.c_str(), val_ptr, val_size);
   }
 }
 
 Normalizers RedisClient::get_hashmap(const std::string& key, int values_size) const {
-  reply_ = (redisReply*) HiredisCommand<>::Command(context_, key.c_str(), "HKEYS %s", key.c_str());
   std::vector<std::string> hkeys;
-  for (int i = 0; i < reply_->elements; ++ i) {
-    hkeys.push_back(reply_->element[i]->str);
+  {
+    auto reply = command(key, "HKEYS %b", key.data(), key.size());
+    for (int i = 0; i < reply->elements; ++ i) {
+      hkeys.push_back(reply->element[i]->str);
+    }
   }
-  clean_reply();
 
   Normalizers retval;
   for (const auto& hkey : hkeys) {
-    reply_ = (redisReply*) HiredisCommand<>::Command(context_, key.c_str(), "HGET %s %s", key.c_str(), hkey.c_str());
+    auto reply = command(key, "HGET %b %s", key.data(), key.size(), hkey.c_str());
 
-    auto values = reinterpret_cast<const double*>(reply_->str);
+    auto values = reinterpret_cast<const double*>(reply->str);
     retval.emplace(std::make_pair(hkey, std::vector<double>(values, values + values_size)));
-
-    clean_reply();    
   }
 
   return retval;
 }
 
-bool RedisClient::increase_values(const std::string& key, const std::vector<float>& increments) const {
-  reply_ = (redisReply*) HiredisCommand<>::Command(context_, "MULTI", key.c_str());
-  clean_reply();
+int64_t RedisClient::get_server_time_us(const std::string& route_key) const {
+  auto reply = command(route_key, "TIME");
+  if (reply->type != REDIS_REPLY_ARRAY || reply->elements != 2) {
+    throw std::runtime_error("Unexpected reply of redis TIME command");
+  }
 
-  reply_ = (redisReply*) HiredisCommand<>::Command(context_, key.c_str(), "GET %s", key.c_str());
+  return std::stoll(std::string(reply->element[0]->str, reply->element[0]->len)) * 1000000 +
+         std::stoll(std::string(reply->element[1]->str, reply->element[1]->len));
+}
 
-  auto values = reinterpret_cast<const float*>(reply_->str);
-  auto buffer = std::vector<float>(values, values + increments.size());
-  clean_reply();
+bool RedisClient::increase_values(const std::string& key, const std::vector<float>& increments) const {
+  std::vector<float> buffer;
+  {
+    auto reply = command(key, "GET %b", key.data(), key.size());
+    auto values = reinterpret_cast<const float*>(reply->str);
+    buffer.assign(values, values + increments.size());
+  }
 
   for (int j = 0; j < increments.size(); ++j) {
     buffer[j] += increments[j];
@@ -109,11 +526,7 @@ bool RedisClient::increase_values(const std::string& key, const std::vector<floa
   auto val_ptr = reinterpret_cast<const char*>(&(buffer[0]));
   auto val_size = (size_t) (buffer.size() * sizeof(float));
 
-  reply_ = (redisReply*) HiredisCommand<>::Command(context_, key.c_str(), "SET %s %b", key.c_str(), val_ptr, val_size);
-  clean_reply();
-
-  reply_ = (redisReply*) HiredisCommand<>::Command(context_, "EXEC", key.c_str());
+  command(key, "SET %b %b", key.data(), key.size(), val_ptr, val_size);
 
-  clean_reply();  // ToDo(MelLain): check memory leaks in this place
   return true;
 }
@@ -0,0 +1,118 @@
+#include <stdexcept>
+
+#include "glog/logging.h"
+
+#include "redis_connection_pool.h"
+
+namespace {
+  const struct timeval kConnectTimeout = { 3, 0 };
+
+  redisContext* connect_node(const char* host, int port, void*) {
+    return redisConnectWithTimeout(host, port, kConnectTimeout);
+  }
+
+  void disconnect_node(redisContext* context) {
+    redisFree(context);
+  }
+}
+
+RedisConnectionPool::RedisConnectionPool(const std::string& ip, int port, int max_connections)
+    : ip_(ip)
+    , port_(port)
+    , max_connections_(max_connections)
+    , num_connections_(0)
+    , slots_version_(0)
+{
+  if (max_connections_ <= 0) {
+    throw std::runtime_error("Redis connection pool should have at least one connection");
+  }
+
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  refresh_slots();
+}
+
+RedisConnectionPool::~RedisConnectionPool() {
+  // all leases should be returned by now
+  for (auto connection : idle_connections_) {
+    delete connection->cluster;
+    delete connection;
+  }
+}
+
+RedisConnectionPool::Lease RedisConnectionPool::lease() {
+  std::shared_ptr<redisReply> slots;
+  int slots_version = 0;
+  {
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    while (idle_connections_.empty() && num_connections_ >= max_connections_) {
+      released_.wait(lock);
+    }
+
+    if (!idle_connections_.empty()) {
+      Connection* connection = idle_connections_.back();
+      idle_connections_.pop_back();
+      return Lease(this, connection);
+    }
+
+    ++num_connections_;
+    slots = slots_;
+    slots_version = slots_version_;
+  }
+
+  // new connection is opened without the lock, the slot is already reserved
+  try {
+    auto cluster = new Cluster<redisContext>(slots.get(), connect_node, disconnect_node, nullptr);
+    return Lease(this, new Connection({ cluster, slots_version }));
+  } catch (...) {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    --num_connections_;
+    released_.notify_one();
+    throw;
+  }
+}
+
+void RedisConnectionPool::release(Connection* connection, bool is_broken) {
+  boost::lock_guard<boost::mutex> lock(mutex_);
+
+  const bool is_moved = connection->cluster->isMoved();
+  if (is_moved && connection->slots_version == slots_version_) {
+    LOG(INFO) << "Redis slots have been moved, requesting slot map from " << ip_ << ":" << port_;
+    try {
+      refresh_slots();
+    } catch (const std::exception& error) {
+      LOG(ERROR) << "Unable to refresh redis slot map: " << error.what();
+    }
+  }
+
+  if (is_broken || is_moved || connection->slots_version != slots_version_) {
+    delete connection->cluster;
+    delete connection;
+    --num_connections_;
+  } else {
+    idle_connections_.push_back(connection);
+  }
+
+  released_.notify_one();
+}
+
+void RedisConnectionPool::refresh_slots() {
+  redisContext* context = redisConnectWithTimeout(ip_.c_str(), port_, kConnectTimeout);
+  if (context == nullptr || context->err) {
+    if (context != nullptr) {
+      redisFree(context);
+    }
+    throw std::runtime_error("Unable to connect to redis " + ip_ + ":" + std::to_string(port_));
+  }
+
+  auto reply = static_cast<redisReply*>(redisCommand(context, Cluster<redisContext>::CmdInit()));
+  redisFree(context);
+  if (reply == nullptr || reply->type != REDIS_REPLY_ARRAY) {
+    if (reply != nullptr) {
+      freeReplyObject(reply);
+    }
+    throw std::runtime_error("Unable to get redis slot map from " + ip_ + ":" + std::to_string(port_));
+  }
+
+  slots_ = std::shared_ptr<redisReply>(reply, freeReplyObject);
+  ++slots_version_;
+}
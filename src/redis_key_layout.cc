@@ -0,0 +1,116 @@
+#include <cstdint>
+#include <stdexcept>
+
+#include "redis_cluster/slothash.h"
+
+#include "redis_key_layout.h"
+
+namespace {
+  const char kHexDigits[] = "0123456789abcdef";
+}
+
+const int RedisKeyLayout::kNumSlots;
+const int RedisKeyLayout::kBlockTagLength;
+
+RedisKeyLayout::RedisKeyLayout(RedisKeyMode mode, int block_size, int num_tokens, int rows_per_value)
+    : mode_(mode)
+    , block_size_(block_size)
+    , num_tokens_(num_tokens)
+    , rows_per_value_(rows_per_value)
+{
+  if (mode_ == RedisKeyMode::BLOCK && block_size_ <= 0) {
+    throw std::runtime_error("RedisKeyLayout: block_size should be a positive integer");
+  }
+
+  if (rows_per_value_ <= 0) {
+    throw std::runtime_error("RedisKeyLayout: rows_per_value should be a positive integer");
+  }
+
+  if (mode_ == RedisKeyMode::SLOT) {
+    tags_for_slots();  // build the table once, before any concurrent access
+  }
+}
+
+void RedisKeyLayout::make_key(int token_id, const ModelName& model_name, std::string* key) const {
+  // all rows of one value share the key, so it's built from the first token of the value
+  token_id = value_begin(token_id);
+  const int value_id = token_id / rows_per_value_;
+
+  key->clear();
+  if (mode_ == RedisKeyMode::TEXT) {
+    key->append(std::to_string(value_id));
+    key->append(model_name);
+    return;
+  }
+
+  key->push_back('{');
+  if (mode_ == RedisKeyMode::BLOCK) {
+    uint32_t block_id = static_cast<uint32_t>(token_id / block_size_);
+    for (int i = kBlockTagLength - 1; i >= 0; --i) {
+      key->push_back(kHexDigits[(block_id >> (4 * i)) & 0xF]);
+    }
+  } else {
+    key->append(tags_for_slots()[slot(token_id)]);
+  }
+  key->push_back('}');
+
+  uint32_t id = static_cast<uint32_t>(value_id);
+  for (int i = 0; i < 4; ++i) {
+    key->push_back(static_cast<char>((id >> (8 * i)) & 0xFF));
+  }
+  key->append(model_name);
+}
+
+int RedisKeyLayout::slot(int token_id) const {
+  token_id = value_begin(token_id);
+  if (mode_ == RedisKeyMode::SLOT) {
+    if (num_tokens_ <= 0) {
+      return 0;
+    }
+    return static_cast<int>(static_cast<int64_t>(token_id) * kNumSlots / num_tokens_);
+  }
+
+  std::string key;
+  make_key(token_id, ModelName(), &key);
+  return static_cast<int>(RedisCluster::SlotHash::SlotByKey(key.c_str(), static_cast<int>(key.size())));
+}
+
+RedisKeyMode RedisKeyLayout::parse_mode(const std::string& mode) {
+  if (mode == KEY_LAYOUT_TEXT) {
+    return RedisKeyMode::TEXT;
+  }
+  if (mode == KEY_LAYOUT_BLOCK) {
+    return RedisKeyMode::BLOCK;
+  }
+  if (mode == KEY_LAYOUT_SLOT) {
+    return RedisKeyMode::SLOT;
+  }
+  throw std::runtime_error("key_layout should be in text|block|slot");
+}
+
+const std::vector<std::string>& RedisKeyLayout::tags_for_slots() {
+  // C++11 guarantees thread-safe initialization of static locals
+  static const std::vector<std::string> tags = []() {
+    std::vector<std::string> retval(kNumSlots);
+    int num_found = 0;
+    for (int length = 1; num_found < kNumSlots; ++length) {
+      std::string tag(length, '0');
+      // enumerate all hex strings of given length
+      for (uint64_t value = 0; value < (uint64_t(1) << (4 * length)) && num_found < kNumSlots; ++value) {
+        for (int i = 0; i < length; ++i) {
+          tag[length - 1 - i] = kHexDigits[(value >> (4 * i)) & 0xF];
+        }
+
+        std::string key = "{" + tag + "}";
+        int slot = static_cast<int>(RedisCluster::SlotHash::SlotByKey(key.c_str(), static_cast<int>(key.size())));
+        if (retval[slot].empty()) {
+          retval[slot] = tag;
+          ++num_found;
+        }
+      }
+    }
+    return retval;
+  }();
+
+  return tags;
+}
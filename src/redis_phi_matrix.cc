@@ -17,59 +17,87 @@ void SpinLock::unlock() {
 }
 
 int RedisPhiMatrix::token_size() const {
-  return token_collection_.token_size();
+  return token_collection_->token_size();
 }
 
 const Token RedisPhiMatrix::token(int token_id) const {
-  return token_collection_.token(token_id);
+  return token_collection_->token(token_id);
+}
+
+const ClassId& RedisPhiMatrix::class_id(int token_id) const {
+  return token_collection_->class_id(token_id);
 }
 
 bool RedisPhiMatrix::has_token(const Token& token) const {
-  return token_collection_.has_token(token);
+  return token_collection_->has_token(token);
 }
 
 int RedisPhiMatrix::token_index(const Token& token) const {
-  return token_collection_.token_id(token);
+  return token_collection_->token_id(token);
 }
 
 // ATTN: this method should be used only for debugging, it's too slow for learning process!
 float RedisPhiMatrix::get(std::shared_ptr<RedisClient> redis_client, int token_id, int topic_id) const {
-  std::vector<float> buffer = redis_client->get_values(to_key(token_id), topic_size());
+  std::vector<float> buffer(topic_size());
+  store_->read_row(redis_client, token_id, &buffer[0]);
   return buffer[topic_id];
 }
 
 void RedisPhiMatrix::get(std::shared_ptr<RedisClient> redis_client, int token_id, std::vector<float>* buffer) const {
+  get(redis_client, token_id, &(*buffer)[0]);
+}
+
+void RedisPhiMatrix::get(std::shared_ptr<RedisClient> redis_client, int token_id, float* buffer) const {
   if (cache_mode_ == PhiMatrixCacheMode::READ && cache_.has_key(token_id)) {
     auto values_ptr = cache_.get(token_id);
-    for (int topic_id = 0; topic_id < topic_size(); ++topic_id) {
-      (*buffer)[topic_id] = (*values_ptr)[topic_id];
-    }
+    std::copy(values_ptr->begin(), values_ptr->begin() + topic_size(), buffer);
   } else {
-    std::vector<float> values = redis_client->get_values(to_key(token_id), topic_size());
-    for (int topic_id = 0; topic_id < topic_size(); ++topic_id) {
-      (*buffer)[topic_id] = values[topic_id];
-    }
+    store_->read_row(redis_client, token_id, buffer);
 
     if (cache_mode_ == PhiMatrixCacheMode::READ) {
-      cache_.set(token_id, std::make_shared<std::vector<float>>(values));
+      cache_.set(token_id, std::make_shared<std::vector<float>>(buffer, buffer + topic_size()));
     }
   }
 }
 
+std::future<void> RedisPhiMatrix::get_async(std::shared_ptr<RedisClient> redis_client,
+                                            std::shared_ptr<AsyncRedisClient> async_client,
+                                            int token_id, float* buffer) const
+{
+  if (cache_mode_ == PhiMatrixCacheMode::READ && cache_.has_key(token_id)) {
+    get(redis_client, token_id, buffer);
+    return std::async(std::launch::deferred, []() { });
+  }
+
+  auto row = store_->read_row_async(redis_client, async_client, token_id, buffer).share();
+  return std::async(std::launch::deferred, [this, row, token_id, buffer]() {
+    row.get();
+    if (cache_mode_ == PhiMatrixCacheMode::READ) {
+      cache_.set(token_id, std::make_shared<std::vector<float>>(buffer, buffer + topic_size()));
+    }
+  });
+}
+
 void RedisPhiMatrix::get_set(std::shared_ptr<RedisClient> redis_client, int token_id,
                              std::vector<float>* buffer, const std::vector<float>& values)
 {
   lock(token_id);
-  std::vector<float> temp = redis_client->get_set_values(to_key(token_id), values);
-  for (int topic_id = 0; topic_id < topic_size(); ++topic_id) {
-    (*buffer)[topic_id] = temp[topic_id];
-  }
+  store_->exchange_row(redis_client, token_id, values, &(*buffer)[0]);
   unlock(token_id);
 }
 
+void RedisPhiMatrix::get_range(std::shared_ptr<RedisClient> redis_client, int token_begin_index,
+                               int token_end_index, std::vector<float>* buffer) const
+{
+  buffer->resize((token_end_index - token_begin_index) * topic_size());
+  if (!buffer->empty()) {
+    store_->read_rows(redis_client, token_begin_index, token_end_index, &(*buffer)[0]);
+  }
+}
+
 void RedisPhiMatrix::set(std::shared_ptr<RedisClient> redis_client, int token_id, const std::vector<float>& buffer) {
   lock(token_id);
-  redis_client->set_values(to_key(token_id), buffer);
+  store_->write_row(redis_client, token_id, buffer);
   unlock(token_id);
 }
 
@@ -78,7 +106,6 @@ void RedisPhiMatrix::increase(std::shared_ptr<RedisClient> redis_client,
 {
   lock(token_id);
 
-  auto key = to_key(token_id);
   if (cache_mode_ == PhiMatrixCacheMode::WRITE) {
     if (cache_.has_key(token_id)) {
       auto values_ptr = cache_.get(token_id);
@@ -90,35 +117,14 @@ void RedisPhiMatrix::increase(std::shared_ptr<RedisClient> redis_client,
       cache_.set(token_id, std::make_shared<std::vector<float>>(increment));
     }
   } else {
-    if (!redis_client->increase_values(key, increment)) {
-      LOG(WARNING) << "Update of token data " << key << " has failed" << std::endl;
+    if (!store_->add_to_row(redis_client, token_id, increment)) {
+      LOG(WARNING) << "Update of token data " << token_id << model_name_ << " has failed" << std::endl;
     }
   }
 
   unlock(token_id);
 }
 
-int RedisPhiMatrix::add_token(std::shared_ptr<RedisClient> redis_client, const Token& token, bool flag) {
-  auto values = std::vector<float>(topic_size(), 0.0f);
-  return add_token(redis_client, token, flag, values);
-}
-
-int RedisPhiMatrix::add_token(std::shared_ptr<RedisClient> redis_client, const Token& token,
-                              bool flag, const std::vector<float>& values)
-{
-  int token_id = token_collection_.token_id(token);
-  if (token_id != -1) {
-    return token_id;
-  }
-  
-  spin_locks_.push_back(std::make_shared<SpinLock>());
-  int index = token_collection_.add_token(token);
-  if (flag) {
-    redis_client->set_values(to_key(index), values);
-  }
-  return index;
-}
-
 void RedisPhiMatrix::dump_write_cache(std::shared_ptr<RedisClient> redis_client,
                                       int token_begin_index,
                                       int token_end_index)
@@ -132,19 +138,19 @@ void RedisPhiMatrix::dump_write_cache(std::shared_ptr<RedisClient> redis_client,
   std::iota(indices->begin(), indices->end(), token_begin_index);
   std::random_shuffle(indices->begin(), indices->end());
 
+  // No need in lock on token as each thread deal only with own set of tokens
+  std::vector<int> token_ids;
+  std::vector<std::shared_ptr<std::vector<float>>> increments;
   for (int token_id : *indices) {
-    // No need in lock on token as each thread deal only with own set of tokens
-    auto key = to_key(token_id);
-    if (!cache_.has_key(token_id)) {
-      continue;
-    }
-
     auto values_ptr = cache_.get(token_id);
-
-    if (!redis_client->increase_values(key, *values_ptr)) {
-      LOG(ERROR) << "Update of token data from cache " << key << " has failed" << std::endl;
+    if (values_ptr != nullptr) {
+      token_ids.push_back(token_id);
+      increments.push_back(values_ptr);
+      cache_.erase(token_id);
     }
+  }
 
-    cache_.erase(token_id);
+  if (!store_->add_to_rows(redis_client, token_ids, increments)) {
+    LOG(ERROR) << "Update of token data from cache of " << model_name_ << " has failed" << std::endl;
   }
 }
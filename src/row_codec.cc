@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "common.h"
+#include "row_codec.h"
+
+namespace {
+  const int kChunkSize = 256;
+
+  void write_index(int index, size_t bytes_per_index, char* out) {
+    if (bytes_per_index == 2) {
+      uint16_t value = static_cast<uint16_t>(index);
+      std::memcpy(out, &value, sizeof(value));
+    } else {
+      uint32_t value = static_cast<uint32_t>(index);
+      std::memcpy(out, &value, sizeof(value));
+    }
+  }
+
+  int read_index(const char* data, size_t bytes_per_index) {
+    if (bytes_per_index == 2) {
+      uint16_t value;
+      std::memcpy(&value, data, sizeof(value));
+      return value;
+    }
+    uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return static_cast<int>(value);
+  }
+}
+
+const char RowCodec::kDenseHeader;
+const char RowCodec::kSparseHeader;
+
+void RowCodec::encode(const float* values, int size, ValueEncoding encoding, std::string* out) {
+  const size_t bytes_per_value = ValueEncoder::bytes_per_value(encoding);
+  const size_t index_size = bytes_per_index(size);
+
+  int num_non_zeros = 0;
+  for (int i = 0; i < size; ++i) {
+    if (values[i] != 0.0f) {
+      ++num_non_zeros;
+    }
+  }
+
+  const size_t dense_size = size * bytes_per_value;
+  const size_t sparse_size = num_non_zeros * (index_size + bytes_per_value);
+
+  if (dense_size <= sparse_size) {
+    out->resize(1 + dense_size);
+    (*out)[0] = kDenseHeader;
+    ValueEncoder::encode(values, size, encoding, &(*out)[1]);
+    return;
+  }
+
+  // [header][indices of non-zeros][values of non-zeros], values are encoded by chunks
+  out->resize(1 + sparse_size);
+  (*out)[0] = kSparseHeader;
+  char* indices_ptr = &(*out)[1];
+  char* values_ptr = indices_ptr + num_non_zeros * index_size;
+
+  float buffer[kChunkSize];
+  int buffer_size = 0;
+  for (int i = 0; i < size; ++i) {
+    if (values[i] == 0.0f) {
+      continue;
+    }
+
+    write_index(i, index_size, indices_ptr);
+    indices_ptr += index_size;
+
+    buffer[buffer_size++] = values[i];
+    if (buffer_size == kChunkSize) {
+      ValueEncoder::encode(buffer, buffer_size, encoding, values_ptr);
+      values_ptr += buffer_size * bytes_per_value;
+      buffer_size = 0;
+    }
+  }
+  ValueEncoder::encode(buffer, buffer_size, encoding, values_ptr);
+}
+
+void RowCodec::decode(const char* data, size_t data_size, int size, ValueEncoding encoding, float* out) {
+  if (data_size == 0) {
+    std::fill(out, out + size, 0.0f);
+    return;
+  }
+
+  if (data[0] == kDenseHeader) {
+    ValueEncoder::decode(data + 1, data_size - 1, size, encoding, out);
+    return;
+  }
+
+  if (data[0] != kSparseHeader) {
+    throw std::runtime_error("Unknown header of phi row: " + std::to_string(static_cast<int>(data[0])));
+  }
+
+  const size_t bytes_per_value = ValueEncoder::bytes_per_value(encoding);
+  const size_t index_size = bytes_per_index(size);
+  const int num_non_zeros = (data_size - 1) / (index_size + bytes_per_value);
+
+  const char* indices_ptr = data + 1;
+  const char* values_ptr = indices_ptr + num_non_zeros * index_size;
+
+  std::fill(out, out + size, 0.0f);
+
+  float buffer[kChunkSize];
+  for (int begin = 0; begin < num_non_zeros; begin += kChunkSize) {
+    const int count = std::min(kChunkSize, num_non_zeros - begin);
+    ValueEncoder::decode(values_ptr + begin * bytes_per_value, count * bytes_per_value, count, encoding, buffer);
+
+    for (int i = 0; i < count; ++i) {
+      const int index = read_index(indices_ptr + (begin + i) * index_size, index_size);
+      if (index < size) {
+        out[index] = buffer[i];
+      }
+    }
+  }
+}
+
+RowFormat RowCodec::parse_format(const std::string& format) {
+  if (format == ROW_FORMAT_DENSE) {
+    return RowFormat::DENSE;
+  }
+  if (format == ROW_FORMAT_ADAPTIVE) {
+    return RowFormat::ADAPTIVE;
+  }
+  throw std::runtime_error("row format should be in dense|adaptive");
+}
@@ -0,0 +1,189 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef USE_NUMA
+#include <numa.h>
+#endif
+
+#include "glog/logging.h"
+
+#include "shm_phi_store.h"
+
+namespace {
+  const uint32_t kSegmentReady = 0x50484931;  // "PHI1"
+  const size_t kHeaderSize = 64;
+
+  // the segment is created by another process, wait for it at most 10 seconds
+  const int kMaxWaitIterations = 5000;
+  const int kWaitIntervalUs = 2000;
+}
+
+struct ShmPhiStore::Header {
+  std::atomic<uint32_t> state;
+  int64_t token_size;
+  int64_t topic_size;
+};
+
+const int ShmPhiStore::kNumStripes;
+
+ShmPhiStore::ShmPhiStore(const std::string& name, int token_size, int topic_size, bool numa_interleave)
+    : name_(name)
+    , token_size_(token_size)
+    , topic_size_(topic_size)
+    , size_(kHeaderSize + kNumStripes * sizeof(Stripe) + static_cast<size_t>(token_size) * topic_size * sizeof(float))
+    , data_(nullptr)
+    , stripes_(nullptr)
+    , values_(nullptr)
+{
+  static_assert(sizeof(Header) <= kHeaderSize, "header of phi segment doesn't fit into reserved space");
+  map_segment(numa_interleave);
+
+  stripes_ = reinterpret_cast<Stripe*>(data_ + kHeaderSize);
+  values_ = reinterpret_cast<float*>(data_ + kHeaderSize + kNumStripes * sizeof(Stripe));
+}
+
+ShmPhiStore::~ShmPhiStore() {
+  if (data_ != nullptr) {
+    munmap(data_, size_);
+  }
+}
+
+void ShmPhiStore::map_segment(bool numa_interleave) {
+  int fd = -1;
+  bool is_creator = true;
+  const std::string path = "/" + name_;
+
+  if (!name_.empty()) {
+    fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0 && errno == EEXIST) {
+      is_creator = false;
+      fd = shm_open(path.c_str(), O_RDWR, 0600);
+    }
+    if (fd < 0) {
+      throw std::runtime_error("Unable to open shared memory segment " + path + ": " + std::strerror(errno));
+    }
+
+    if (is_creator) {
+      // new pages are zeros, so all rows and locks are initialized by ftruncate
+      if (ftruncate(fd, size_) != 0) {
+        close(fd);
+        shm_unlink(path.c_str());
+        throw std::runtime_error("Unable to allocate shared memory segment " + path);
+      }
+    } else {
+      struct stat info = { };
+      int iteration = 0;
+      while (fstat(fd, &info) == 0 && info.st_size == 0 && iteration++ < kMaxWaitIterations) {
+        usleep(kWaitIntervalUs);
+      }
+      if (static_cast<size_t>(info.st_size) != size_) {
+        close(fd);
+        throw std::runtime_error("Shared memory segment " + path + " has another size, "
+                                 "remove it if the sizes of the matrix have changed");
+      }
+    }
+  }
+
+  const int flags = name_.empty() ? (MAP_SHARED | MAP_ANONYMOUS) : MAP_SHARED;
+  void* ptr = mmap(nullptr, size_, PROT_READ | PROT_WRITE, flags, fd, 0);
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (ptr == MAP_FAILED) {
+    throw std::runtime_error("Unable to map shared memory segment " + path);
+  }
+  data_ = static_cast<char*>(ptr);
+
+  Header* header = reinterpret_cast<Header*>(data_);
+  if (is_creator) {
+    if (numa_interleave) {
+#ifdef USE_NUMA
+      // policy of shared memory is kept by the segment, so it works for pages touched by any process
+      if (numa_available() >= 0) {
+        numa_interleave_memory(data_, size_, numa_all_nodes_ptr);
+      } else {
+        LOG(WARNING) << "NUMA is not available, pages of " << path << " are placed by default policy";
+      }
+#else
+      throw std::runtime_error("NUMA interleaving requires build with USE_NUMA");
+#endif
+    }
+
+    header->token_size = token_size_;
+    header->topic_size = topic_size_;
+    header->state.store(kSegmentReady, std::memory_order_release);
+    return;
+  }
+
+  int iteration = 0;
+  while (header->state.load(std::memory_order_acquire) != kSegmentReady && iteration++ < kMaxWaitIterations) {
+    usleep(kWaitIntervalUs);
+  }
+
+  if (header->state.load(std::memory_order_acquire) != kSegmentReady ||
+      header->token_size != token_size_ || header->topic_size != topic_size_)
+  {
+    throw std::runtime_error("Shared memory segment " + path + " isn't initialized or has another sizes");
+  }
+}
+
+void ShmPhiStore::lock(int token_id) const {
+  auto& state = stripes_[token_id % kNumStripes].state;
+  while (state.exchange(1, std::memory_order_acquire) == 1) {
+    /* busy-wait */
+  }
+}
+
+void ShmPhiStore::unlock(int token_id) const {
+  stripes_[token_id % kNumStripes].state.store(0, std::memory_order_release);
+}
+
+void ShmPhiStore::read_row(std::shared_ptr<RedisClient> redis_client, int token_id, float* buffer) const {
+  lock(token_id);
+  std::copy(row(token_id), row(token_id) + topic_size_, buffer);
+  unlock(token_id);
+}
+
+void ShmPhiStore::read_rows(std::shared_ptr<RedisClient> redis_client, int token_begin_index,
+                            int token_end_index, float* buffer) const
+{
+  for (int token_id = token_begin_index; token_id < token_end_index; ++token_id) {
+    read_row(redis_client, token_id, buffer + (token_id - token_begin_index) * topic_size_);
+  }
+}
+
+void ShmPhiStore::write_row(std::shared_ptr<RedisClient> redis_client, int token_id,
+                            const std::vector<float>& values)
+{
+  lock(token_id);
+  std::copy(values.begin(), values.begin() + topic_size_, row(token_id));
+  unlock(token_id);
+}
+
+void ShmPhiStore::exchange_row(std::shared_ptr<RedisClient> redis_client, int token_id,
+                               const std::vector<float>& values, float* old_values)
+{
+  lock(token_id);
+  std::copy(row(token_id), row(token_id) + topic_size_, old_values);
+  std::copy(values.begin(), values.begin() + topic_size_, row(token_id));
+  unlock(token_id);
+}
+
+bool ShmPhiStore::add_to_row(std::shared_ptr<RedisClient> redis_client, int token_id,
+                             const std::vector<float>& increment)
+{
+  lock(token_id);
+  float* values = row(token_id);
+  for (int topic_id = 0; topic_id < topic_size_; ++topic_id) {
+    values[topic_id] += increment[topic_id];
+  }
+  unlock(token_id);
+  return true;
+}
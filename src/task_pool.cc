@@ -0,0 +1,116 @@
+#include "boost/thread/locks.hpp"
+
+#include "task_pool.h"
+
+TaskPool::TaskPool(int size)
+    : is_stopping_(false)
+    , generation_(0)
+    , num_active_(0)
+    , context_(nullptr)
+    , function_(nullptr)
+    , metrics_(nullptr)
+    , num_tasks_(0)
+    , next_task_(0)
+{
+  for (int i = 1; i < size; ++i) {
+    threads_.emplace_back(&TaskPool::thread_function, this);
+  }
+}
+
+TaskPool::~TaskPool() {
+  {
+    boost::lock_guard<boost::mutex> guard(mutex_);
+    is_stopping_ = true;
+  }
+  started_.notify_all();
+
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void TaskPool::run(int num_tasks, const void* context, TaskFunction* function) {
+  boost::unique_lock<boost::mutex> run_lock(run_mutex_, boost::try_to_lock);
+  if (!run_lock.owns_lock() || threads_.empty() || num_tasks <= 1) {
+    for (int task_index = 0; task_index < num_tasks; ++task_index) {
+      function(context, task_index);
+    }
+    return;
+  }
+
+  {
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    // threads that have woken up late for the previous loop leave it
+    while (num_active_ > 0) {
+      finished_.wait(lock);
+    }
+
+    context_ = context;
+    function_ = function;
+    metrics_ = &MetricsRegistry::current();
+    num_tasks_ = num_tasks;
+    next_task_.store(0);
+    error_ = nullptr;
+    ++generation_;
+    ++num_active_;
+  }
+  started_.notify_all();
+
+  execute_tasks();
+
+  boost::unique_lock<boost::mutex> lock(mutex_);
+  --num_active_;
+  while (num_active_ > 0) {
+    finished_.wait(lock);
+  }
+
+  if (error_ != nullptr) {
+    std::exception_ptr error = error_;
+    error_ = nullptr;
+    std::rethrow_exception(error);
+  }
+}
+
+void TaskPool::execute_tasks() {
+  while (true) {
+    const int task_index = next_task_.fetch_add(1);
+    if (task_index >= num_tasks_) {
+      break;
+    }
+
+    try {
+      function_(context_, task_index);
+    } catch (...) {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      if (error_ == nullptr) {
+        error_ = std::current_exception();
+      }
+    }
+  }
+}
+
+void TaskPool::thread_function() {
+  int generation = 0;
+  boost::unique_lock<boost::mutex> lock(mutex_);
+  while (true) {
+    while (!is_stopping_ && generation_ == generation) {
+      started_.wait(lock);
+    }
+    if (is_stopping_) {
+      break;
+    }
+
+    generation = generation_;
+    ++num_active_;
+    MetricsRegistry::set_current(metrics_);
+    lock.unlock();
+
+    execute_tasks();
+    MetricsRegistry::set_current(nullptr);
+
+    lock.lock();
+    if (--num_active_ == 0) {
+      finished_.notify_all();
+    }
+  }
+}
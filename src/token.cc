@@ -1,42 +1,163 @@
 // Copyright 2017, Additive Regularization of Topic Models.
 
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
 #include "token.h"
 
+namespace {
+  const size_t kMinNumSlots = 16;
+
+  // keep load factor of the index below 1/2
+  size_t num_slots_for(size_t num_tokens) {
+    size_t retval = kMinNumSlots;
+    while (retval < 2 * num_tokens) {
+      retval *= 2;
+    }
+    return retval;
+  }
+}
+
+const uint32_t TokenCollection::kEmptySlot;
+
 int TokenCollection::add_token(const Token& token) {
-  int token_id = this->token_id(token);
+  return add_token(token.class_id, token.keyword.data(), token.keyword.size(), token.hash());
+}
+
+int TokenCollection::add_token(const ClassId& class_id, const char* keyword, size_t keyword_size, size_t hash) {
+  int token_id = find(hash, class_id, keyword, keyword_size);
   if (token_id != -1) {
     return token_id;
   }
 
+  if (keyword_arena_.size() + keyword_size > std::numeric_limits<uint32_t>::max()) {
+    throw std::runtime_error("TokenCollection: keyword arena overflow");
+  }
+
+  int class_index = find_class_index(class_id);
+  if (class_index == -1) {
+    if (class_table_.size() > std::numeric_limits<uint16_t>::max()) {
+      throw std::runtime_error("TokenCollection: too many class ids");
+    }
+    class_index = static_cast<int>(class_table_.size());
+    class_table_.push_back(class_id);
+  }
+
   token_id = token_size();
-  token_to_token_id_.insert(std::make_pair(token, token_id));
-  token_id_to_token_.push_back(token);
+  keyword_arena_.insert(keyword_arena_.end(), keyword, keyword + keyword_size);
+  keyword_offset_.push_back(static_cast<uint32_t>(keyword_arena_.size()));
+  class_index_.push_back(static_cast<uint16_t>(class_index));
+  hash_.push_back(static_cast<uint32_t>(hash));
+
+  if (slots_.size() < 2 * hash_.size()) {
+    rehash(2 * slots_.size());
+  } else {
+    size_t mask = slots_.size() - 1;
+    size_t slot = hash_.back() & mask;
+    while (slots_[slot] != kEmptySlot) {
+      slot = (slot + 1) & mask;
+    }
+    slots_[slot] = static_cast<uint32_t>(token_id);
+  }
+
   return token_id;
 }
 
+void TokenCollection::reserve(int size) {
+  keyword_offset_.reserve(size + 1);
+  class_index_.reserve(size);
+  hash_.reserve(size);
+  if (slots_.size() < num_slots_for(size)) {
+    rehash(num_slots_for(size));
+  }
+}
+
 void TokenCollection::swap(TokenCollection* rhs) {
-  token_to_token_id_.swap(rhs->token_to_token_id_);
-  token_id_to_token_.swap(rhs->token_id_to_token_);
+  keyword_arena_.swap(rhs->keyword_arena_);
+  keyword_offset_.swap(rhs->keyword_offset_);
+  class_index_.swap(rhs->class_index_);
+  hash_.swap(rhs->hash_);
+  class_table_.swap(rhs->class_table_);
+  slots_.swap(rhs->slots_);
 }
 
 bool TokenCollection::has_token(const Token& token) const {
-  return token_to_token_id_.count(token) > 0;
+  return find(token.hash(), token.class_id, token.keyword.data(), token.keyword.size()) != -1;
 }
 
 int TokenCollection::token_id(const Token& token) const {
-  auto iter = token_to_token_id_.find(token);
-  return (iter != token_to_token_id_.end()) ? iter->second : -1;
+  return find(token.hash(), token.class_id, token.keyword.data(), token.keyword.size());
 }
 
-const Token& TokenCollection::token(int index) const {
-  return token_id_to_token_[index];
+int TokenCollection::token_id(const ClassId& class_id, const std::string& keyword) const {
+  return find(Token::calc_hash(class_id, keyword), class_id, keyword.data(), keyword.size());
+}
+
+Token TokenCollection::token(int index) const {
+  return Token(class_id(index), keyword(index));
+}
+
+std::string TokenCollection::keyword(int index) const {
+  return std::string(keyword_arena_.data() + keyword_offset_[index],
+                     keyword_arena_.data() + keyword_offset_[index + 1]);
+}
+
+const ClassId& TokenCollection::class_id(int index) const {
+  return class_table_[class_index_[index]];
 }
 
 void TokenCollection::clear() {
-  token_to_token_id_.clear();
-  token_id_to_token_.clear();
+  keyword_arena_.clear();
+  keyword_offset_.assign(1, 0);
+  class_index_.clear();
+  hash_.clear();
+  class_table_.clear();
+  slots_.assign(kMinNumSlots, kEmptySlot);
 }
 
 int TokenCollection::token_size() const {
-  return static_cast<int>(token_to_token_id_.size());
+  return static_cast<int>(hash_.size());
+}
+
+int TokenCollection::find(size_t hash, const ClassId& class_id, const char* keyword, size_t keyword_size) const {
+  const uint32_t short_hash = static_cast<uint32_t>(hash);
+  const size_t mask = slots_.size() - 1;
+
+  for (size_t slot = short_hash & mask; slots_[slot] != kEmptySlot; slot = (slot + 1) & mask) {
+    const uint32_t index = slots_[slot];
+    if (hash_[index] != short_hash) {
+      continue;
+    }
+
+    const uint32_t begin = keyword_offset_[index];
+    const uint32_t size = keyword_offset_[index + 1] - begin;
+    if (size == keyword_size && std::memcmp(keyword_arena_.data() + begin, keyword, size) == 0 &&
+        class_table_[class_index_[index]] == class_id) {
+      return static_cast<int>(index);
+    }
+  }
+
+  return -1;
+}
+
+int TokenCollection::find_class_index(const ClassId& class_id) const {
+  for (size_t i = 0; i < class_table_.size(); ++i) {
+    if (class_table_[i] == class_id) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+void TokenCollection::rehash(size_t num_slots) {
+  slots_.assign(num_slots, kEmptySlot);
+  const size_t mask = num_slots - 1;
+  for (size_t index = 0; index < hash_.size(); ++index) {
+    size_t slot = hash_[index] & mask;
+    while (slots_[slot] != kEmptySlot) {
+      slot = (slot + 1) & mask;
+    }
+    slots_[slot] = static_cast<uint32_t>(index);
+  }
 }
@@ -0,0 +1,175 @@
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "boost/thread/locks.hpp"
+#include "boost/thread/mutex.hpp"
+
+#include "glog/logging.h"
+
+#include "common.h"
+#include "redis_client.h"
+#include "trace.h"
+
+namespace {
+  const std::string kTraceEpochKey = kEscChar + std::string("trace-epoch");
+  const int kNumClockSamples = 8;
+
+  struct TraceEvent {
+    const char* name;
+    const char* detail;
+    int64_t begin_us;
+    int64_t end_us;
+  };
+
+  struct TraceBuffer {
+    std::string thread_name;
+    int tid;
+    std::vector<TraceEvent> events;
+    // number of recorded events, the buffer holds the last events.size() of them
+    std::atomic<uint64_t> num_events;
+  };
+
+  boost::mutex buffers_lock;
+  std::vector<std::shared_ptr<TraceBuffer>> buffers;
+  int buffer_size = 0;
+  int64_t clock_offset_us = 0;
+
+  thread_local TraceBuffer* thread_buffer = nullptr;
+
+  TraceBuffer* get_thread_buffer() {
+    if (thread_buffer == nullptr) {
+      boost::lock_guard<boost::mutex> guard(buffers_lock);
+      auto buffer = std::make_shared<TraceBuffer>();
+      buffer->tid = static_cast<int>(buffers.size());
+      buffer->thread_name = "thread " + std::to_string(buffer->tid);
+      buffer->events.resize(buffer_size);
+      buffer->num_events.store(0, std::memory_order_relaxed);
+      buffers.push_back(buffer);
+      thread_buffer = buffer.get();
+    }
+    return thread_buffer;
+  }
+
+  std::string escape_json(const std::string& value) {
+    std::string retval;
+    for (char c : value) {
+      if (c == '"' || c == '\\') {
+        retval += '\\';
+      }
+      retval += c;
+    }
+    return retval;
+  }
+
+  int64_t get_epoch_us(const RedisClient& redis_client) {
+    int64_t retval = 0;
+    redis_client.get_raw_value(kTraceEpochKey, [&retval](const char* data, size_t size) {
+      if (size > 0) {
+        retval = std::stoll(std::string(data, size));
+      }
+    });
+    return retval;
+  }
+}
+
+std::atomic<bool> Tracer::enabled_(false);
+
+void Tracer::enable(int size) {
+  if (size <= 0) {
+    throw std::runtime_error("Trace buffer should have a positive size");
+  }
+
+  {
+    boost::lock_guard<boost::mutex> guard(buffers_lock);
+    buffer_size = size;
+  }
+  enabled_.store(true, std::memory_order_relaxed);
+}
+
+void Tracer::set_thread_name(const std::string& name) {
+  if (is_enabled()) {
+    TraceBuffer* buffer = get_thread_buffer();
+    boost::lock_guard<boost::mutex> guard(buffers_lock);
+    buffer->thread_name = name;
+  }
+}
+
+void Tracer::record(const char* name, const char* detail, int64_t begin_us, int64_t end_us) {
+  TraceBuffer* buffer = get_thread_buffer();
+  const uint64_t index = buffer->num_events.load(std::memory_order_relaxed);
+  buffer->events[index % buffer->events.size()] = { name, detail, begin_us, end_us };
+  buffer->num_events.store(index + 1, std::memory_order_release);
+}
+
+int64_t Tracer::now_us() {
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+void Tracer::synchronize(const RedisClient& redis_client) {
+  // the sample with the shortest round trip bounds the error best
+  int64_t best_round_trip_us = -1;
+  int64_t best_offset_us = 0;
+  for (int i = 0; i < kNumClockSamples; ++i) {
+    const int64_t begin_us = now_us();
+    const int64_t server_us = redis_client.get_server_time_us(kTraceEpochKey);
+    const int64_t end_us = now_us();
+
+    if (best_round_trip_us < 0 || end_us - begin_us < best_round_trip_us) {
+      best_round_trip_us = end_us - begin_us;
+      best_offset_us = server_us - (begin_us + end_us) / 2;
+    }
+  }
+
+  boost::lock_guard<boost::mutex> guard(buffers_lock);
+  clock_offset_us = best_offset_us;
+  LOG(INFO) << "Trace clock offset: " << clock_offset_us << " us, round trip: " << best_round_trip_us << " us";
+}
+
+void Tracer::publish_epoch(const RedisClient& redis_client) {
+  redis_client.set_raw_value(kTraceEpochKey, std::to_string(redis_client.get_server_time_us(kTraceEpochKey)));
+}
+
+void Tracer::write(const std::string& path, int pid, const std::string& process_name,
+                   const RedisClient& redis_client)
+{
+  const int64_t epoch_us = get_epoch_us(redis_client);
+
+  std::ofstream fout(path);
+  if (!fout.is_open()) {
+    throw std::runtime_error("Unable to create trace file " + path);
+  }
+
+  boost::lock_guard<boost::mutex> guard(buffers_lock);
+
+  fout << "{\"otherData\":{\"epoch_us\":" << epoch_us << ",\"clock_offset_us\":" << clock_offset_us << "},\n"
+       << "\"traceEvents\":[\n"
+       << "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":" << pid
+       << ",\"args\":{\"name\":\"" << escape_json(process_name) << "\"}}";
+
+  size_t num_events = 0;
+  for (const auto& buffer : buffers) {
+    fout << ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << pid << ",\"tid\":" << buffer->tid
+         << ",\"args\":{\"name\":\"" << escape_json(buffer->thread_name) << "\"}}";
+
+    const uint64_t end = buffer->num_events.load(std::memory_order_acquire);
+    const uint64_t capacity = buffer->events.size();
+    for (uint64_t index = (end > capacity ? end - capacity : 0); index < end; ++index) {
+      const TraceEvent& event = buffer->events[index % capacity];
+      fout << ",\n{\"ph\":\"X\",\"name\":\"" << escape_json(event.name) << "\",\"pid\":" << pid
+           << ",\"tid\":" << buffer->tid << ",\"ts\":" << event.begin_us + clock_offset_us
+           << ",\"dur\":" << event.end_us - event.begin_us;
+      if (event.detail != nullptr) {
+        fout << ",\"args\":{\"detail\":\"" << escape_json(event.detail) << "\"}";
+      }
+      fout << "}";
+    }
+    num_events += static_cast<size_t>(end - (end > capacity ? end - capacity : 0));
+  }
+
+  fout << "\n]}\n";
+  LOG(INFO) << "Trace with " << num_events << " spans has been written into " << path;
+}
@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+#include "common.h"
+#include "value_encoding.h"
+
+namespace {
+  inline uint32_t float_to_bits(float value) {
+    uint32_t retval;
+    std::memcpy(&retval, &value, sizeof(retval));
+    return retval;
+  }
+
+  inline float float_from_bits(uint32_t bits) {
+    float retval;
+    std::memcpy(&retval, &bits, sizeof(retval));
+    return retval;
+  }
+
+  // Branch-free IEEE conversions with rounding to nearest even, see
+  // https://github.com/Maratyszcza/FP16 (constants are powers of 2 given by their bits)
+  inline uint16_t float_to_half(float value) {
+    const float scale_to_inf = float_from_bits(0x77800000);   // 2^112
+    const float scale_to_zero = float_from_bits(0x08800000);  // 2^-110
+    float base = (std::fabs(value) * scale_to_inf) * scale_to_zero;
+
+    const uint32_t w = float_to_bits(value);
+    const uint32_t shl1_w = w + w;
+    const uint32_t sign = w & 0x80000000u;
+    uint32_t bias = shl1_w & 0xFF000000u;
+    if (bias < 0x71000000u) {
+      bias = 0x71000000u;
+    }
+
+    base = float_from_bits((bias >> 1) + 0x07800000u) + base;
+    const uint32_t bits = float_to_bits(base);
+    const uint32_t exp_bits = (bits >> 13) & 0x00007C00u;
+    const uint32_t mantissa_bits = bits & 0x00000FFFu;
+    const uint32_t nonsign = exp_bits + mantissa_bits;
+    return static_cast<uint16_t>((sign >> 16) | (shl1_w > 0xFF000000u ? 0x7E00u : nonsign));
+  }
+
+  inline float half_to_float(uint16_t half) {
+    const uint32_t w = static_cast<uint32_t>(half) << 16;
+    const uint32_t sign = w & 0x80000000u;
+    const uint32_t two_w = w + w;
+
+    const uint32_t exp_offset = 0xE0u << 23;
+    const float exp_scale = float_from_bits(0x07800000);  // 2^-112
+    const float normalized_value = float_from_bits((two_w >> 4) + exp_offset) * exp_scale;
+
+    const uint32_t magic_mask = 126u << 23;
+    const float magic_bias = 0.5f;
+    const float denormalized_value = float_from_bits((two_w >> 17) | magic_mask) - magic_bias;
+
+    const uint32_t denormalized_cutoff = 1u << 27;
+    const uint32_t result = sign | (two_w < denormalized_cutoff ? float_to_bits(denormalized_value)
+                                                                : float_to_bits(normalized_value));
+    return float_from_bits(result);
+  }
+
+  inline uint16_t float_to_bfloat(float value) {
+    uint32_t bits = float_to_bits(value);
+    if ((bits & 0x7FFFFFFFu) > 0x7F800000u) {
+      return static_cast<uint16_t>((bits >> 16) | 0x0040u);  // keep NaN quiet
+    }
+    bits += 0x7FFFu + ((bits >> 16) & 1u);  // round to nearest even
+    return static_cast<uint16_t>(bits >> 16);
+  }
+
+  inline float bfloat_to_float(uint16_t bfloat) {
+    return float_from_bits(static_cast<uint32_t>(bfloat) << 16);
+  }
+
+  void encode_half(const float* values, int size, uint16_t* out) {
+    int i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= size; i += 8) {
+      __m128i half = _mm256_cvtps_ph(_mm256_loadu_ps(values + i), _MM_FROUND_TO_NEAREST_INT);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), half);
+    }
+#endif
+    for (; i < size; ++i) {
+      out[i] = float_to_half(values[i]);
+    }
+  }
+
+  void decode_half(const uint16_t* data, int size, float* out) {
+    int i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= size; i += 8) {
+      __m128i half = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+      _mm256_storeu_ps(out + i, _mm256_cvtph_ps(half));
+    }
+#endif
+    for (; i < size; ++i) {
+      out[i] = half_to_float(data[i]);
+    }
+  }
+}
+
+void ValueEncoder::encode(const float* values, int size, ValueEncoding encoding, char* out) {
+  switch (encoding) {
+    case ValueEncoding::FLOAT32:
+      std::memcpy(out, values, size * sizeof(float));
+      break;
+
+    case ValueEncoding::FLOAT16: {
+      // out may be unaligned, so the values are converted through aligned buffer
+      uint16_t buffer[256];
+      for (int begin = 0; begin < size; begin += 256) {
+        int count = std::min(256, size - begin);
+        encode_half(values + begin, count, buffer);
+        std::memcpy(out + 2 * begin, buffer, 2 * count);
+      }
+      break;
+    }
+
+    case ValueEncoding::BFLOAT16:
+      for (int i = 0; i < size; ++i) {
+        uint16_t value = float_to_bfloat(values[i]);
+        std::memcpy(out + 2 * i, &value, 2);
+      }
+      break;
+  }
+}
+
+void ValueEncoder::decode(const char* data, size_t data_size, int size, ValueEncoding encoding, float* out) {
+  const int available = std::min<size_t>(size, data_size / bytes_per_value(encoding));
+
+  switch (encoding) {
+    case ValueEncoding::FLOAT32:
+      std::memcpy(out, data, available * sizeof(float));
+      break;
+
+    case ValueEncoding::FLOAT16: {
+      uint16_t buffer[256];
+      for (int begin = 0; begin < available; begin += 256) {
+        int count = std::min(256, available - begin);
+        std::memcpy(buffer, data + 2 * begin, 2 * count);
+        decode_half(buffer, count, out + begin);
+      }
+      break;
+    }
+
+    case ValueEncoding::BFLOAT16:
+      for (int i = 0; i < available; ++i) {
+        uint16_t value;
+        std::memcpy(&value, data + 2 * i, 2);
+        out[i] = bfloat_to_float(value);
+      }
+      break;
+  }
+
+  for (int i = available; i < size; ++i) {
+    out[i] = 0.0f;
+  }
+}
+
+ValueEncoding ValueEncoder::parse(const std::string& encoding) {
+  if (encoding == VALUE_ENCODING_FP32) {
+    return ValueEncoding::FLOAT32;
+  }
+  if (encoding == VALUE_ENCODING_FP16) {
+    return ValueEncoding::FLOAT16;
+  }
+  if (encoding == VALUE_ENCODING_BF16) {
+    return ValueEncoding::BFLOAT16;
+  }
+  throw std::runtime_error("encoding should be in fp32|fp16|bf16");
+}
@@ -0,0 +1,136 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "boost/thread.hpp"
+
+#include "vocab_loader.h"
+
+namespace {
+  // Read-only mapping of the whole file, unmapped on destruction.
+  class MappedFile : boost::noncopyable {
+   public:
+    explicit MappedFile(const std::string& path) : data_(nullptr), size_(0) {
+      int fd = open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+        throw std::runtime_error("Unable to open file " + path);
+      }
+
+      struct stat info;
+      if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw std::runtime_error("Unable to stat file " + path);
+      }
+
+      size_ = static_cast<size_t>(info.st_size);
+      if (size_ > 0) {
+        void* ptr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED) {
+          close(fd);
+          throw std::runtime_error("Unable to mmap file " + path);
+        }
+        madvise(ptr, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const char*>(ptr);
+      }
+      close(fd);
+    }
+
+    ~MappedFile() {
+      if (data_ != nullptr) {
+        munmap(const_cast<char*>(data_), size_);
+      }
+    }
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+   private:
+    const char* data_;
+    size_t size_;
+  };
+
+  // Line of the mapped file with the hash of the corresponding token.
+  struct ParsedLine {
+    const char* begin;
+    size_t size;
+    size_t hash;
+  };
+
+  // Parses lines in [begin, end), 'end' is either the end of file or points right after '\n'.
+  // The semantics is the same as for std::getline: the last line may have no '\n'.
+  void parse_chunk(const char* begin, const char* end, std::vector<ParsedLine>* lines) {
+    const char* line_begin = begin;
+    while (line_begin < end) {
+      const char* line_end = static_cast<const char*>(memchr(line_begin, '\n', end - line_begin));
+      if (line_end == nullptr) {
+        line_end = end;
+      }
+
+      const size_t size = line_end - line_begin;
+      lines->push_back({ line_begin, size, Token::calc_hash(DefaultClass, std::string(line_begin, size)) });
+      line_begin = line_end + 1;
+    }
+  }
+}
+
+std::shared_ptr<TokenCollection> VocabLoader::load(const std::string& vocab_path, int num_threads) {
+  MappedFile file(vocab_path);
+  auto retval = std::make_shared<TokenCollection>();
+  if (file.size() == 0) {
+    return retval;
+  }
+
+  if (num_threads <= 0) {
+    num_threads = std::max(1, static_cast<int>(boost::thread::hardware_concurrency()));
+  }
+
+  // split file into chunks, each chunk starts at the beginning of a line
+  const char* data = file.data();
+  const char* data_end = data + file.size();
+  const size_t step = std::max<size_t>(file.size() / num_threads, 1);
+
+  std::vector<const char*> bounds = { data };
+  while (bounds.back() < data_end) {
+    const char* next = bounds.back() + std::min<size_t>(step, data_end - bounds.back());
+    if (next < data_end) {
+      next = static_cast<const char*>(memchr(next - 1, '\n', data_end - next + 1));
+      next = (next == nullptr) ? data_end : next + 1;
+    }
+    bounds.push_back(next);
+  }
+
+  const int num_chunks = static_cast<int>(bounds.size()) - 1;
+  std::vector<std::vector<ParsedLine>> chunks(num_chunks);
+
+  boost::thread_group threads;
+  for (int chunk_id = 0; chunk_id < num_chunks; ++chunk_id) {
+    threads.create_thread([&bounds, &chunks, chunk_id]() {
+      parse_chunk(bounds[chunk_id], bounds[chunk_id + 1], &chunks[chunk_id]);
+    });
+  }
+  threads.join_all();
+
+  size_t num_tokens = 0;
+  for (const auto& chunk : chunks) {
+    num_tokens += chunk.size();
+  }
+
+  // hashes were computed in parallel, so the merge only inserts precomputed values
+  retval->reserve(static_cast<int>(num_tokens));
+  for (auto& chunk : chunks) {
+    for (const auto& line : chunk) {
+      retval->add_token(DefaultClass, line.begin, line.size, line.hash);
+    }
+    std::vector<ParsedLine>().swap(chunk);
+  }
+
+  return retval;
+}
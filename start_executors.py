@@ -7,11 +7,23 @@ parser.add_argument('-v', '--vocab')
 parser.add_argument('-b', '--batches-path')
 parser.add_argument('-r', '--redis-addresses-path')
 parser.add_argument('-n', '--num-executor-threads')
+parser.add_argument('--e-step-threads', default='1')
 
 parser.add_argument('-t', '--num-topics')
 parser.add_argument('-i', '--num-inner-iter')
 parser.add_argument('-c', '--continue-fitting')
 parser.add_argument('-p', '--caching-phi-mode')
+parser.add_argument('-k', '--key-layout', default='text')
+parser.add_argument('-s', '--key-block-size', default='1')
+parser.add_argument('-w', '--rows-per-value', default='1')
+parser.add_argument('-e', '--pwt-encoding', default='fp32')
+parser.add_argument('-f', '--pwt-row-format', default='dense')
+parser.add_argument('-z', '--nwt-compressed-flush', default='0')
+parser.add_argument('-a', '--pwt-prefetch', default='0')
+parser.add_argument('-m', '--phi-store', default='redis')
+parser.add_argument('--shm-name', default='cluster-bigartm')
+parser.add_argument('--server-port', default='0')
+parser.add_argument('--trace-dir', default='')
 
 def ceil(number):
     z = int(number)
@@ -48,13 +60,26 @@ def main():
 	assert batch_indices[-1][-1] == num_batches
 
 	cmd_str = ('./executor_main --num-topics {} --num-inner-iter {} --batches-dir-path {} ' +
-			   '--vocab-path {} --continue-fitting {} --caching-phi-mode {}').format(
+			   '--vocab-path {} --continue-fitting {} --caching-phi-mode {} ' +
+			   '--key-layout {} --key-block-size {} --rows-per-value {} --pwt-encoding {} ' +
+			   '--pwt-row-format {} --nwt-compressed-flush {} --pwt-prefetch {} --phi-store {} --shm-name {} ' +
+			   '--e-step-threads {}').format(
     	args['num_topics'],
     	args['num_inner_iter'],
     	args['batches_path'],
     	args['vocab'],
     	args['continue_fitting'],
-    	args['caching_phi_mode'])
+    	args['caching_phi_mode'],
+    	args['key_layout'],
+    	args['key_block_size'],
+    	args['rows_per_value'],
+    	args['pwt_encoding'],
+    	args['pwt_row_format'],
+    	args['nwt_compressed_flush'],
+    	args['pwt_prefetch'],
+    	args['phi_store'],
+    	args['shm_name'],
+    	args['e_step_threads'])
 
 	for executor_id, addr in enumerate(redis_addresses):
 		additional_args = '--redis-ip {} --redis-port {} --num-threads {} '.format(addr[0], addr[1], int(args['num_executor_threads']))
@@ -64,6 +89,12 @@ def main():
 			token_indices[executor_id][1],
 			batch_indices[executor_id][0],
 			batch_indices[executor_id][1])
+		if int(args['server_port']) != 0:
+			# executors share the host, so each one gets its own port
+			additional_args += ' --server-port {}'.format(int(args['server_port']) + executor_id)
+		if args['trace_dir']:
+			# merge traces with merge_traces.py
+			additional_args += ' --trace-file {}'.format(os.path.join(args['trace_dir'], 'executor-{}.json'.format(executor_id)))
 
 		print '{} {} &'.format(cmd_str, additional_args)
 		os.popen('{} {} &'.format(cmd_str, additional_args))